@@ -81,3 +81,37 @@ std::unique_ptr<RenderObject> CreateRenderObjectFromJson(
   object->SerializeFromJson(json);
   return object;
 }
+
+std::unique_ptr<RenderObject> CreateRenderObjectFromMapTile(
+    const MapTile& tile, uint32_t node_index) {
+  const MapTileNode& node = tile.node(node_index);
+  std::string type_name = tile.string(node.type);
+  if (kRegisteredFacotryFuncMap.find(type_name) ==
+      kRegisteredFacotryFuncMap.end()) {
+    printf("Not registered type name: %s\n", type_name.c_str());
+    return nullptr;
+  }
+  std::unique_ptr<RenderObject> object =
+      kRegisteredFacotryFuncMap.at(type_name)();
+  // Only groups read no record.
+  if (object->kind() != kRoadElementObject &&
+      node.record == kMapTileInvalidIndex) {
+    printf("%s node without mesh record\n", type_name.c_str());
+    return nullptr;
+  }
+  object->SerializeFromMapTile(tile, node);
+  return object;
+}
+
+std::unique_ptr<RenderObject> CreateRenderObjectFromDesc(
+    RenderObjectDesc& desc) {
+  if (kRegisteredFacotryFuncMap.find(desc.type) ==
+      kRegisteredFacotryFuncMap.end()) {
+    printf("Not registered type name: %s\n", desc.type.c_str());
+    return nullptr;
+  }
+  std::unique_ptr<RenderObject> object =
+      kRegisteredFacotryFuncMap.at(desc.type)();
+  object->SerializeFromDesc(desc);
+  return object;
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
 #include <glm/gtc/type_ptr.hpp>
 
 #include "app/extension_command_list.h"
@@ -9,8 +13,13 @@
 #include "core/shader_manager.h"
 
 class RenderObject;
+struct RenderObjectDesc;
 std::unique_ptr<RenderObject> CreateRenderObjectFromJson(
     const nlohmann::json& json);
+std::unique_ptr<RenderObject> CreateRenderObjectFromMapTile(
+    const MapTile& tile, uint32_t node_index);
+std::unique_ptr<RenderObject> CreateRenderObjectFromDesc(
+    RenderObjectDesc& desc);
 
 template <typename MatType>
 inline MatType MatFromJson(const nlohmann::json& json) {
@@ -21,33 +30,109 @@ inline MatType MatFromJson(const nlohmann::json& json) {
   return mat;
 }
 
+// Objects whose shader data (world, color, alpha) changed, in the order of
+// their first change. GL thread only.
+class ObjectChangeList {
+ public:
+  void Add(RenderObject* object) { objects_.push_back(object); }
+  void Remove(RenderObject* object) {
+    objects_.erase(std::remove(objects_.begin(), objects_.end(), object),
+                   objects_.end());
+  }
+  // Returns the changed objects and empties the list.
+  std::vector<RenderObject*> Take() { return std::move(objects_); }
+
+  bool empty() const { return objects_.empty(); }
+
+ private:
+  std::vector<RenderObject*> objects_;
+};
+
+// Concrete type of a RenderObject, set by the constructor of each subclass so
+// the draw paths can dispatch with a switch instead of dynamic_cast, see
+// VisitRenderObject.
+enum RenderObjectKind : uint8_t {
+  kUnknownObject = 0,
+  kLineObject,
+  kDashedStripeObject,
+  kSimpleTexturedObject,
+  kRoadElementObject,
+};
+
 class RenderObject {
  public:
   using PreRenderCallback = std::function<bool(RenderObject*)>;
   using PostRenderCallback = std::function<void(RenderObject*)>;
 
-  virtual ~RenderObject() = default;
+  RenderObject() = default;
+  virtual ~RenderObject() {
+    if (dirty_ && change_list_) {
+      change_list_->Remove(this);
+    }
+  }
 
   virtual void SerializeFromJson(const nlohmann::json& json) {}
+  virtual void SerializeFromMapTile(const MapTile& tile,
+                                    const MapTileNode& node) {}
+  // Takes ownership of the mesh data held by |desc|.
+  virtual void SerializeFromDesc(RenderObjectDesc& desc) {}
+  // CPU side upload preparation, safe to call from loader threads. Adds what
+  // mesh optimization did to |*stats| unless null. Returns the number of
+  // bytes Initialize will upload.
+  virtual uint64_t PrepareUpload(MeshOptimizeStats* stats) { return 0; }
   virtual void Initialize(BufferManager* buffer_manager) {}
   virtual void Render(const ShaderManager& shader_manager,
                       PreRenderCallback pre_render = nullptr,
                       PostRenderCallback post_render = nullptr) {}
 
-  void set_world(const glm::mat4& world) { world_ = world; }
+  void set_world(const glm::mat4& world) {
+    world_ = world;
+    MarkDirty();
+  }
   const glm::mat4& world() const { return world_; }
 
+  // Starts reporting shader data changes to |change_list|, the data as of
+  // now is considered uploaded unless it already reports to it. Objects are
+  // created on loader threads, they are tracked once the GL thread took them
+  // over.
+  void set_change_list(ObjectChangeList* change_list) {
+    if (change_list_ == change_list) {
+      return;
+    }
+    if (dirty_ && change_list_) {
+      change_list_->Remove(this);
+    }
+    change_list_ = change_list;
+    dirty_ = false;
+  }
+  bool dirty() const { return dirty_; }
+  void clear_dirty() { dirty_ = false; }
+
   void set_shader(const std::string& shader) { shader_ = shader; }
   const std::string& shader() const { return shader_; }
 
   const MeshRenderer& mesh_renderer() const { return mesh_renderer_; }
 
+  RenderObjectKind kind() const { return kind_; }
+
  protected:
+  explicit RenderObject(RenderObjectKind kind) : kind_(kind) {}
+
+  void MarkDirty() {
+    if (!dirty_ && change_list_) {
+      change_list_->Add(this);
+    }
+    dirty_ = true;
+  }
+
   MeshRenderer mesh_renderer_;
 
  private:
   std::string shader_;
   glm::mat4 world_;
+  ObjectChangeList* change_list_ = nullptr;
+  bool dirty_ = false;
+  RenderObjectKind kind_ = kUnknownObject;
 };
 
 struct LineStyle {
@@ -72,9 +157,28 @@ struct LineStyle {
   }
 };
 
+// Flat description of one map file entry, filled by the streaming parser in
+// app/render_object_parser.h. Leaf objects use the draw info and mesh, group
+// objects only sub_meshes.
+struct RenderObjectDesc {
+  std::string type;
+  std::string shader;
+  glm::vec4 color{1.0f};
+  float alpha = 1.0f;
+  LineStyle line_style;
+  glm::mat4 world{1.0f};
+  GLenum draw_mode = GL_TRIANGLES;
+  Mesh mesh;
+  std::vector<RenderObjectDesc> sub_meshes;
+};
+
 class LineObject : public RenderObject {
  public:
-  LineObject() = default;
+  // Lines and stripes span long distances thinly, far away most of their
+  // vertices land on the same pixels.
+  LineObject() : RenderObject(kLineObject) {
+    mesh_renderer_.set_build_lods(true);
+  }
 
   void SerializeFromJson(const nlohmann::json& json) override {
     const auto& draw_info = json["draw_info"];
@@ -93,6 +197,38 @@ class LineObject : public RenderObject {
     mesh_renderer_.set_mesh(std::move(mesh));
   }
 
+  void SerializeFromMapTile(const MapTile& tile,
+                            const MapTileNode& node) override {
+    const MapTileMeshRecord& record = tile.record(node.record);
+    set_color(glm::make_vec4(record.color));
+    LineStyle style;
+    style.line_width = record.line_width;
+    style.line_stipple = record.line_stipple;
+    style.line_stipple_factor = record.line_stipple_factor;
+    style.line_stipple_pattern = record.line_stipple_pattern;
+    set_line_style(style);
+
+    set_shader(tile.string(record.shader));
+    set_world(glm::make_mat4(record.world_matrix));
+
+    mesh_renderer_.set_mesh(Mesh::SerializeFromMapTile(tile, record));
+  }
+
+  void SerializeFromDesc(RenderObjectDesc& desc) override {
+    set_color(desc.color);
+    set_line_style(desc.line_style);
+
+    set_shader(desc.shader);
+    set_world(desc.world);
+
+    desc.mesh.set_draw_mode(desc.draw_mode);
+    mesh_renderer_.set_mesh(std::move(desc.mesh));
+  }
+
+  uint64_t PrepareUpload(MeshOptimizeStats* stats) override {
+    return mesh_renderer_.PrepareUpload(stats);
+  }
+
   void Initialize(BufferManager* buffer_manager) override {
     mesh_renderer_.Initialize(buffer_manager);
   }
@@ -124,7 +260,10 @@ class LineObject : public RenderObject {
   void set_line_style(const LineStyle& line_style) { line_style_ = line_style; }
   const LineStyle& line_style() const { return line_style_; }
 
-  void set_color(const glm::vec4& color) { color_ = color; }
+  void set_color(const glm::vec4& color) {
+    color_ = color;
+    MarkDirty();
+  }
   const glm::vec4& color() const { return color_; }
 
  private:
@@ -134,7 +273,9 @@ class LineObject : public RenderObject {
 
 class DashedStripeObject : public RenderObject {
  public:
-  DashedStripeObject() = default;
+  DashedStripeObject() : RenderObject(kDashedStripeObject) {
+    mesh_renderer_.set_build_lods(true);
+  }
 
   void SerializeFromJson(const nlohmann::json& json) override {
     const auto& draw_info = json["draw_info"];
@@ -150,6 +291,31 @@ class DashedStripeObject : public RenderObject {
     mesh_renderer_.set_mesh(std::move(mesh));
   }
 
+  void SerializeFromMapTile(const MapTile& tile,
+                            const MapTileNode& node) override {
+    const MapTileMeshRecord& record = tile.record(node.record);
+    set_color(glm::make_vec4(record.color));
+
+    set_shader(tile.string(record.shader));
+    set_world(glm::make_mat4(record.world_matrix));
+
+    mesh_renderer_.set_mesh(Mesh::SerializeFromMapTile(tile, record));
+  }
+
+  void SerializeFromDesc(RenderObjectDesc& desc) override {
+    set_color(desc.color);
+
+    set_shader(desc.shader);
+    set_world(desc.world);
+
+    desc.mesh.set_draw_mode(desc.draw_mode);
+    mesh_renderer_.set_mesh(std::move(desc.mesh));
+  }
+
+  uint64_t PrepareUpload(MeshOptimizeStats* stats) override {
+    return mesh_renderer_.PrepareUpload(stats);
+  }
+
   void Initialize(BufferManager* buffer_manager) override {
     mesh_renderer_.Initialize(buffer_manager);
   }
@@ -166,7 +332,10 @@ class DashedStripeObject : public RenderObject {
     }
   }
 
-  void set_color(const glm::vec4& color) { color_ = color; }
+  void set_color(const glm::vec4& color) {
+    color_ = color;
+    MarkDirty();
+  }
   const glm::vec4& color() const { return color_; }
 
  private:
@@ -175,7 +344,7 @@ class DashedStripeObject : public RenderObject {
 
 class SimpleTexturedObject : public RenderObject {
  public:
-  SimpleTexturedObject() = default;
+  SimpleTexturedObject() : RenderObject(kSimpleTexturedObject) {}
 
   void SerializeFromJson(const nlohmann::json& json) override {
     const auto& draw_info = json["draw_info"];
@@ -191,6 +360,31 @@ class SimpleTexturedObject : public RenderObject {
     mesh_renderer_.set_mesh(std::move(mesh));
   }
 
+  void SerializeFromMapTile(const MapTile& tile,
+                            const MapTileNode& node) override {
+    const MapTileMeshRecord& record = tile.record(node.record);
+    set_alpha(record.alpha);
+
+    set_shader(tile.string(record.shader));
+    set_world(glm::make_mat4(record.world_matrix));
+
+    mesh_renderer_.set_mesh(Mesh::SerializeFromMapTile(tile, record));
+  }
+
+  void SerializeFromDesc(RenderObjectDesc& desc) override {
+    set_alpha(desc.alpha);
+
+    set_shader(desc.shader);
+    set_world(desc.world);
+
+    desc.mesh.set_draw_mode(desc.draw_mode);
+    mesh_renderer_.set_mesh(std::move(desc.mesh));
+  }
+
+  uint64_t PrepareUpload(MeshOptimizeStats* stats) override {
+    return mesh_renderer_.PrepareUpload(stats);
+  }
+
   void Initialize(BufferManager* buffer_manager) override {
     mesh_renderer_.Initialize(buffer_manager);
   }
@@ -207,7 +401,10 @@ class SimpleTexturedObject : public RenderObject {
     }
   }
 
-  void set_alpha(float alpha) { alpha_ = alpha; }
+  void set_alpha(float alpha) {
+    alpha_ = alpha;
+    MarkDirty();
+  }
   float alpha() const { return alpha_; }
 
  private:
@@ -216,7 +413,7 @@ class SimpleTexturedObject : public RenderObject {
 
 class RoadElementObject : public RenderObject {
  public:
-  RoadElementObject() = default;
+  RoadElementObject() : RenderObject(kRoadElementObject) {}
 
   void SerializeFromJson(const nlohmann::json& json) override {
     const auto& sub_meshes = json["sub_mesh"];
@@ -229,6 +426,34 @@ class RoadElementObject : public RenderObject {
     }
   }
 
+  void SerializeFromMapTile(const MapTile& tile,
+                            const MapTileNode& node) override {
+    for (uint32_t i = 0; i < node.child_count; ++i) {
+      auto mesh_render =
+          CreateRenderObjectFromMapTile(tile, node.first_child + i);
+      if (mesh_render) {
+        sub_meshes_.emplace_back(std::move(mesh_render));
+      }
+    }
+  }
+
+  void SerializeFromDesc(RenderObjectDesc& desc) override {
+    for (auto& sub_mesh_desc : desc.sub_meshes) {
+      auto mesh_render = CreateRenderObjectFromDesc(sub_mesh_desc);
+      if (mesh_render) {
+        sub_meshes_.emplace_back(std::move(mesh_render));
+      }
+    }
+  }
+
+  uint64_t PrepareUpload(MeshOptimizeStats* stats) override {
+    uint64_t size = 0;
+    for (auto& sub_mesh : sub_meshes_) {
+      size += sub_mesh->PrepareUpload(stats);
+    }
+    return size;
+  }
+
   void Initialize(BufferManager* buffer_manager) override {
     for (auto& sub_mesh : sub_meshes_) {
       sub_mesh->Initialize(buffer_manager);
@@ -249,6 +474,45 @@ class RoadElementObject : public RenderObject {
     }
   }
 
+  const std::vector<std::unique_ptr<RenderObject>>& sub_meshes() const {
+    return sub_meshes_;
+  }
+
  private:
   std::vector<std::unique_ptr<RenderObject>> sub_meshes_;
-};
\ No newline at end of file
+};
+
+namespace internal {
+
+// Derived with the constness of Object.
+template <typename Derived, typename Object>
+using MatchConst =
+    std::conditional_t<std::is_const<Object>::value, const Derived, Derived>;
+
+}  // namespace internal
+
+// Calls |visitor| with |object| cast to its concrete type, or unchanged for
+// kUnknownObject. |object| may be const, the casts keep it. All overloads of
+// |visitor| must return the same type.
+template <typename Object, typename Visitor>
+decltype(auto) VisitRenderObject(Object* object, Visitor&& visitor) {
+  static_assert(std::is_same<std::remove_const_t<Object>, RenderObject>::value,
+                "visit through a RenderObject pointer");
+  switch (object->kind()) {
+    case kLineObject:
+      return visitor(
+          static_cast<internal::MatchConst<LineObject, Object>*>(object));
+    case kDashedStripeObject:
+      return visitor(static_cast<internal::MatchConst<DashedStripeObject,
+                                                      Object>*>(object));
+    case kSimpleTexturedObject:
+      return visitor(static_cast<internal::MatchConst<SimpleTexturedObject,
+                                                      Object>*>(object));
+    case kRoadElementObject:
+      return visitor(static_cast<internal::MatchConst<RoadElementObject,
+                                                      Object>*>(object));
+    case kUnknownObject:
+      break;
+  }
+  return visitor(object);
+}
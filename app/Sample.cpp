@@ -1,32 +1,54 @@
 #include "Sample.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cfloat>
 #include <chrono>
+#include <cstddef>
 #include <cstdio>
 #include <experimental/filesystem>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <numeric>
 #include <set>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <tuple>
+#include <unordered_set>
 #include <vector>
 
 #include "app/extension_command_list.h"
+#include "app/map_loader.h"
+#include "app/render_object_parser.h"
+#include "app/roaming_spline.h"
+#include "app/token_stream_writer.h"
+#include "core/map_tile.h"
+#include "core/mesh_lod.h"
+#include "core/radix_sort.h"
 #include "core/stb_image.h"
 
 namespace {
 
 using SceneData = common::SceneData;
 using ObjectData = common::ObjectData;
+using PackedObjectData = common::PackedObjectData;
 using MaterialData = common::MaterialData;
 using us = std::chrono::microseconds;
 namespace fs = std::experimental::filesystem;
 using namespace nvgl;
 
 constexpr int kBufferBlockSize = 128 * 1024 * 1024;  // 128 MB
+// Vertical, in degrees.
+constexpr float kFieldOfView = 60.0f;
+// Upload positions and UVs in the 16-bit formats of MeshRenderer where they
+// keep their precision.
+constexpr bool kCompressVertices = true;
+// Bytes uploaded per MapLoader::DrainUploads call.
+constexpr uint64_t kUploadBatchBytes = 4 * 1024 * 1024;  // 4 MB
 // constexpr int kBufferBlockSize = 0;
 
 std::chrono::time_point<std::chrono::system_clock> start_time;
@@ -77,6 +99,8 @@ class ProfileTimer {
 
 std::set<std::string> extensions;
 constexpr int kUniformBufferOffsetAlignment = 256;
+// Frames of object data kBasicUniformBuffer keeps in flight.
+constexpr int kObjectRingBufferFrameCount = 3;
 int kMultiSampleCount = 8;
 
 int UniformBufferAlignedOffset(int size) {
@@ -90,8 +114,189 @@ void PushCommandToBuffer(const Command& command, std::string* buffer) {
                  (const char*)(&command) + sizeof(Command));
 }
 
+// Everything the tokens of one draw need, resolved on the GL thread.
+struct TokenDraw {
+  // Of the first token in the chunk token buffer.
+  GLintptr offset = 0;
+  GLuint state = 0;
+  // Of the PACKED_OBJECT_BLOCK_SIZE window holding the object, 0 when the
+  // previous draw of the sequence bound it already.
+  GLuint64 object_block_address = 0;
+  // In the object block window, passed as the base instance.
+  GLuint object_index = 0;
+  // 0 when the program reads no material.
+  GLuint64 material_address = 0;
+  GLuint64 vbo_address = 0;
+  // 0 for non indexed draws.
+  GLuint64 ibo_address = 0;
+  // Bytes per index of the element buffer.
+  GLuint index_size = 0;
+  // 0 when the line width is not set.
+  float line_width = 0.0f;
+  GLenum draw_mode = 0;
+  GLuint count = 0;
+};
+
+// Emits the tokens of one draw, no GL calls.
+void WriteTokenDraw(const TokenDraw& draw, GLuint64 scene_address,
+                    TokenStreamWriter* writer) {
+  const CommandTokenHeaders& headers = writer->headers();
+  // Set up uniform binding info
+  if (draw.object_block_address) {
+    writer->UniformAddress(UBO_OBJECT, headers.vertex_stage,
+                           draw.object_block_address);
+    writer->UniformAddress(UBO_OBJECT, headers.fragment_stage,
+                           draw.object_block_address);
+  }
+  writer->UniformAddress(UBO_SCENE, headers.vertex_stage, scene_address);
+  writer->UniformAddress(UBO_SCENE, headers.fragment_stage, scene_address);
+  if (draw.material_address) {
+    writer->UniformAddress(UBO_MATERIAL, headers.vertex_stage,
+                           draw.material_address);
+    writer->UniformAddress(UBO_MATERIAL, headers.fragment_stage,
+                           draw.material_address);
+  }
+
+  // Set up vertex attrib binding info
+  writer->AttributeAddress(0, draw.vbo_address);
+  // Set up index binding info
+  if (draw.ibo_address) {
+    writer->ElementAddress(draw.ibo_address, draw.index_size);
+  }
+
+  // Set up aux info
+  if (draw.line_width > 0.0f) {
+    writer->LineWidth(draw.line_width);
+  }
+
+  // Set up draw command
+  if (draw.ibo_address) {
+    writer->DrawElementsInstanced(draw.draw_mode, draw.count, 1, 0, 0,
+                                  draw.object_index);
+  } else {
+    writer->DrawArraysInstanced(draw.draw_mode, draw.count, 1, 0,
+                                draw.object_index);
+  }
+}
+
+// Command layouts read by glMultiDrawElementsIndirect and
+// glMultiDrawArraysIndirect.
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+struct DrawArraysIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first;
+  GLuint base_instance;
+};
+
+// GpuCulling writes draw commands back from the copy in common::CullDraw.
+static_assert(sizeof(DrawElementsInstancedCommandNV) <=
+                      sizeof(common::CullDraw::words) &&
+                  sizeof(DrawElementsIndirectCommand) <=
+                      sizeof(common::CullDraw::words),
+              "draw commands do not fit common::CullDraw");
+
+PackedObjectData PackObjectData(const glm::mat4& world,
+                                const glm::vec4& color) {
+  PackedObjectData packed = {};
+  glm::mat4 rows = glm::transpose(world);
+  for (int i = 0; i < 3; ++i) {
+    packed.rows[i] = rows[i];
+  }
+  packed.color = glm::packUnorm4x8(color);
+  return packed;
+}
+
+// Level of detail of entry |index| of |draw_list| seen from |view|.
+int SelectDrawLod(const DrawList& draw_list, int index,
+                  const GpuCulling::View& view) {
+  if (view.lod_scale <= 0.0f) {
+    return 0;
+  }
+  return draw_list.mesh_renderers[index]->SelectLod(
+      ProjectedScreenSize(draw_list.bounds[index], view.eye, view.lod_scale));
+}
+
+// Copies the levels of detail of |mesh_renderer| into |cull_draw|, whose
+// command has its draw count at |count_offset| and its first index or vertex
+// at |first_offset| in bytes.
+void SetCullDrawLods(const MeshRenderer& mesh_renderer, size_t count_offset,
+                     size_t first_offset, common::CullDraw* cull_draw) {
+  const std::vector<MeshLod>& lods = mesh_renderer.lods();
+  cull_draw->lod_count = std::min<size_t>(lods.size(), MAX_MESH_LODS);
+  cull_draw->count_word = count_offset / sizeof(GLuint);
+  cull_draw->first_word = first_offset / sizeof(GLuint);
+  for (uint32_t level = 0; level < cull_draw->lod_count; ++level) {
+    cull_draw->lod_firsts[level] = lods[level].first - lods[0].first;
+    cull_draw->lod_counts[level] = lods[level].count;
+    cull_draw->lod_screen_sizes[level] = lods[level].max_screen_size;
+  }
+}
+
+// Draws entry |index| of |draw_list| at level of detail |lod| with the bound
+// program and object data, setting the line state of line objects like
+// LineObject::Render.
+void RenderDraw(const DrawList& draw_list, int index, int lod) {
+  const DrawState& state = draw_list.states[index];
+  if (draw_list.line_widths[index] > 0.0f) {
+    glLineWidth(draw_list.line_widths[index]);
+  }
+  if (state.line_stipple) {
+    glEnable(GL_LINE_STIPPLE);
+    glLineStipple(state.stipple_factor, state.stipple_pattern);
+  }
+  draw_list.mesh_renderers[index]->Render(lod);
+  if (state.line_stipple) {
+    glDisable(GL_LINE_STIPPLE);
+  }
+}
+
+// Uploads |size| bytes into |*buffer|, creating or growing it as needed.
+void UploadBufferData(GLuint* buffer, int* buffer_size, const void* data,
+                      int size) {
+  if (!*buffer) {
+    glCreateBuffers(1, buffer);
+  }
+  if (*buffer_size < size) {
+    glNamedBufferData(*buffer, size, data, GL_DYNAMIC_DRAW);
+    *buffer_size = size;
+  } else {
+    glNamedBufferSubData(*buffer, 0, size, data);
+  }
+}
+
 // constexpr const char kMapDataFolder[] = "assets/dumped_map_data";
 constexpr const char kMapDataFolder[] = "assets/dumped_map_data_compact";
+// Packed by json_to_map_tile.py, preferred over kMapDataFolder when present.
+constexpr const char kMapTileFile[] = "assets/dumped_map_data.nvmt";
+// Written by json_to_map_tile.py --tile_size, streamed around the camera when
+// present instead of loading the whole map.
+constexpr const char kMapTileDirectory[] = "assets/map_tiles";
+constexpr float kStreamLoadRadius = 5000.0f;
+constexpr float kStreamUnloadRadius = 6000.0f;
+constexpr uint64_t kStreamUploadBytesPerFrame = 8 * 1024 * 1024;  // 8 MB
+// Seconds ahead on the roaming spline whose tiles are prefetched.
+constexpr float kStreamLookaheadSeconds[] = {2.0f, 5.0f, 10.0f};
+// Vertex data moved per frame by BufferManager::Compact.
+constexpr uint64_t kCompactionBytesPerFrame = 4 * 1024 * 1024;  // 4 MB
+// Compiles of the token streams a state object may stay unused before
+// CollectUnusedStates deletes it.
+constexpr uint64_t kStateObjectMaxIdleGenerations = 8;
+
+// Bounds the wait for the GPU to finish reading the previous token stream.
+constexpr GLuint64 kCommandStreamFenceTimeout = 1000000000;  // 1s in ns
+constexpr uint64_t kMinCommandStreamBufferSize = 1 << 20;
+
+// Draws per token writing task, large enough to amortize the task overhead.
+constexpr size_t kTokenDrawsPerTask = 1024;
+
 constexpr const char kExtensionNVCommandList[] = "GL_NV_command_list";
 constexpr const char kExtensionARBBindlessTexture[] = "GL_ARB_bindless_texture";
 constexpr const char kExtensionNVShaderBufferLoad[] =
@@ -154,59 +359,26 @@ nlohmann::json LoadJsonFromFile(const fs::path& path) {
   return json;
 }
 
-void LoadMapDataThreaded(const std::vector<fs::path>& files,
-                         std::vector<std::unique_ptr<RenderObject>>& objects,
-                         std::atomic_int& read_slot_idx,
-                         std::atomic_int& write_slot_idx) {
-  while (true) {
-    int current_slot_idx = read_slot_idx++;
-    if (current_slot_idx >= files.size()) {
-      break;
-    }
-    nlohmann::json json = LoadJsonFromFile(files[current_slot_idx]);
-    if (json == nlohmann::json()) {
-      printf("parsing json error: %s\n",
-             files[current_slot_idx].string().c_str());
-      continue;
-    } else {
-      // printf("parsing file: %s\n", directory_entry.path().string().c_str());
-      auto object = CreateRenderObjectFromJson(json);
-      if (object) {
-        int write_idx = write_slot_idx++;
-        objects[write_idx] = std::move(object);
-      }
+std::vector<std::unique_ptr<RenderObject>> LoadMapTile(
+    const std::string& path) {
+  std::vector<std::unique_ptr<RenderObject>> objects;
+  MapTile tile;
+  if (!tile.Open(path)) {
+    return objects;
+  }
+  objects.reserve(tile.root_count());
+  for (uint32_t i = 0; i < tile.root_count(); ++i) {
+    auto object = CreateRenderObjectFromMapTile(tile, i);
+    if (object) {
+      objects.push_back(std::move(object));
     }
   }
+  return objects;
 }
 
-#define MULTI_THREAD
-std::vector<std::unique_ptr<RenderObject>> LoadMapData(
-    const std::string& map_directory, BufferManager* buffer_manager) {
-#ifdef MULTI_THREAD
-  std::vector<fs::path> files;
-  for (auto& directory_entry :
-       fs::directory_iterator(fs::path(map_directory))) {
-    files.push_back(directory_entry.path());
-  }
-  // files.resize(100);
-
-  std::vector<std::unique_ptr<RenderObject>> objects(files.size());
-  std::atomic_int read_slot_idx{0};
-  std::atomic_int write_slot_idx{0};
-  const int kThreadCount = 15;
-  std::vector<std::thread> threads;
-
-  for (int i = 0; i < kThreadCount; ++i) {
-    threads.push_back(
-        std::thread([&]() { LoadMapDataThreaded(files, objects, read_slot_idx, write_slot_idx); }));
-  }
-  LoadMapDataThreaded(files, objects, read_slot_idx, write_slot_idx);
-  for (int i = 0; i < kThreadCount; ++i) {
-    threads[i].join();
-  }
-
-  objects.resize(write_slot_idx);
-
+void InitializeRenderObjects(
+    std::vector<std::unique_ptr<RenderObject>>& objects,
+    BufferManager* buffer_manager) {
   std::vector<int> object_indices;
   for (int i = 0; i < objects.size(); ++i) {
     object_indices.push_back(i);
@@ -223,6 +395,40 @@ std::vector<std::unique_ptr<RenderObject>> LoadMapData(
   // for (auto& object : objects) {
   //   object->Initialize(buffer_manager);
   // }
+}
+
+#define MULTI_THREAD
+// Sets |*stats| to what mesh optimization did to the loaded objects.
+std::vector<std::unique_ptr<RenderObject>> LoadMapData(
+    const std::string& map_directory, TaskScheduler* scheduler,
+    BufferManager* buffer_manager, MeshOptimizeStats* stats) {
+  if (fs::exists(kMapTileFile)) {
+    auto objects = LoadMapTile(kMapTileFile);
+    for (auto& object : objects) {
+      object->PrepareUpload(stats);
+    }
+    InitializeRenderObjects(objects, buffer_manager);
+    return objects;
+  }
+#ifdef MULTI_THREAD
+  std::vector<std::string> files;
+  for (auto& directory_entry :
+       fs::directory_iterator(fs::path(map_directory))) {
+    files.push_back(directory_entry.path().string());
+  }
+  // files.resize(100);
+
+  // Objects are uploaded here as soon as workers finish them, in completion
+  // order, while the remaining files are still being parsed.
+  std::vector<std::unique_ptr<RenderObject>> objects;
+  objects.reserve(files.size());
+  MapLoader loader(scheduler);
+  loader.LoadFilesAsync(files);
+  while (!loader.idle()) {
+    loader.WaitForUploads();
+    loader.DrainUploads(buffer_manager, &objects, kUploadBatchBytes);
+  }
+  *stats = loader.mesh_optimize_stats();
 #else
   std::vector<std::unique_ptr<RenderObject>> objects;
   for (auto& directory_entry :
@@ -252,78 +458,6 @@ std::vector<glm::vec3> tangents;
 float radius = 1000.0f;
 int pointsCount = 200;
 
-// 初始化Spline的控制点和对应的时间
-void InitSpline(const float radius, const int pointsCount,
-                const float camera_speed_, std::vector<glm::vec3>& points,
-                std::vector<float>& times, std::vector<glm::vec3>& tangents) {
-  srand(1000);
-  // 随机生成控制点
-  for (int i = 0; i < pointsCount; i++) {
-    float x = static_cast<float>(rand() % 200 - 100) / 100.0f;
-    float y = static_cast<float>(rand() % 200 - 100) / 100.0f;
-    float z = static_cast<float>(rand() % 200) / 200.0f;
-    glm::vec3 point = glm::normalize(glm::vec3(x, y, z)) * radius;
-    points.push_back(point);
-  }
-
-  // 计算切线向量
-  for (int i = 0; i < points.size(); i++) {
-    glm::vec3 tangent;
-    if (i == 0) {
-      tangent = glm::normalize(points[i + 1] - points[i]);
-    } else if (i == points.size() - 1) {
-      tangent = glm::normalize(points[i] - points[i - 1]);
-    } else {
-      tangent = glm::normalize((points[i + 1] - points[i - 1]) / 2.0f);
-    }
-
-    tangents.push_back(tangent);
-  }
-
-  // 计算每个控制点对应的时间值
-  float time = 0.0;
-  for (int i = 0; i < points.size() - 1; i++) {
-    times.push_back(time);
-    float distance = glm::length(points[i + 1] - points[i]);
-    time += distance / camera_speed_;
-  }
-}
-
-// 根据给定的时间值，计算摄像机的位置和方向
-void ComputeCameraPosition(const float time,
-                           const std::vector<glm::vec3>& points,
-                           const std::vector<float>& times,
-                           const std::vector<glm::vec3>& tangents,
-                           glm::vec3& position, glm::vec3& front) {
-  // 保证时间值在合法范围内
-  float T = glm::clamp(glm::mod(time, times.back()), 0.0f, times.back());
-
-  // 找到time对应的区间
-  int i = 0;
-  while (T > times[i]) {
-    i++;
-  }
-
-  // 根据控制点和切线向量计算插值系数
-  float t = (T - times[i - 1]) / (times[i] - times[i - 1]);
-  glm::vec3 p0 = points[i - 1];
-  glm::vec3 p1 = points[i];
-  glm::vec3 m0 = tangents[i - 1] * (times[i] - times[i - 1]);
-  glm::vec3 m1 = tangents[i] * (times[i] - times[i - 1]);
-  float t2 = t * t;
-  float t3 = t2 * t;
-  glm::vec3 A = 2.0f * p0 - 2.0f * p1 + m0 + m1;
-  glm::vec3 B = -3.0f * p0 + 3.0f * p1 - 2.0f * m0 - m1;
-  glm::vec3 C = m0;
-  glm::vec3 D = p0;
-
-  // 计算摄像机的位置和方向
-  position = A * t3 + B * t2 + C * t + D;
-  glm::vec3 dir = glm::mix(tangents[i - 1], tangents[i], t);
-  dir.z = -glm::abs(dir.z);
-  front = glm::normalize(dir);
-}
-
 void PrintOpenGLCapablities() {
   GLint uboSize = 0;
   glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &uboSize);
@@ -356,12 +490,28 @@ GLuint LoadTexture(const char* path) {
   return texture;
 }
 
+// Number of token sequences needed to draw |states| in order, 0 entries are
+// skipped draws.
+int CountTokenSequences(const std::vector<GLuint>& states) {
+  int count = 0;
+  GLuint last_state = 0;
+  for (GLuint state : states) {
+    if (state && state != last_state) {
+      ++count;
+      last_state = state;
+    }
+  }
+  return count;
+}
+
 }  // namespace
 
 CommandListSample::~CommandListSample() {
   if (command_list_supported_) {
     FinalizeCommandListResouce();
   }
+  glDeleteBuffers(1, &multi_draw_indirect_data_.indirect_buffer);
+  glDeleteBuffers(1, &multi_draw_indirect_data_.object_ssbo);
 }
 
 CommandListSample::CommandListSample() : Window(u8"NVCommandListSample") {}
@@ -370,9 +520,27 @@ void CommandListSample::onInitialize() {
   Window::onInitialize();
 
   buffer_manager_ = std::make_unique<BufferManager>(kBufferBlockSize);
-  {
+  task_scheduler_ = std::make_unique<TaskScheduler>();
+  MeshRenderer::set_compress_vertices(kCompressVertices);
+  if (fs::exists(fs::path(kMapTileDirectory) / "index.json")) {
+    map_streamer_ = std::make_unique<MapStreamer>(
+        task_scheduler_.get(), kStreamLoadRadius, kStreamUnloadRadius);
+    if (!map_streamer_->Initialize(kMapTileDirectory)) {
+      map_streamer_.reset();
+    }
+  }
+  if (!map_streamer_) {
     ProfileTimer timer("LoadMapData");
-    render_objects_ = LoadMapData(kMapDataFolder, buffer_manager_.get());
+    render_objects_ =
+        LoadMapData(kMapDataFolder, task_scheduler_.get(),
+                    buffer_manager_.get(), &mesh_optimize_stats_);
+    mesh_optimize_stats_.Print("map mesh optimization");
+    DrawChunk& chunk = draw_chunks_[kStaticDrawChunk];
+    for (auto& object : render_objects_) {
+      chunk.objects.push_back(object.get());
+    }
+    FlattenDrawChunk(&chunk);
+    RebuildSceneObjects();
   }
 
   printf("total render object count:%d\n", render_objects_.size());
@@ -428,7 +596,8 @@ void CommandListSample::onInitialize() {
     glMakeNamedBufferResidentNV(material_ubo_, GL_READ_ONLY);
   }
 
-  glCreateBuffers(1, &object_ubo_);
+  object_ring_buffer_ = std::make_unique<PersistentRingBuffer>(
+      kObjectRingBufferFrameCount, kUniformBufferOffsetAlignment);
 
   program_manager_.m_filetype = nvh::ShaderFileManager::FILETYPE_GLSL;
   program_manager_.addDirectory("./assets/shaders/");
@@ -437,10 +606,18 @@ void CommandListSample::onInitialize() {
   program_manager_.registerInclude("common.h");
 
 
-  const char* glsl_defines = R"(
+  // Without the command list extensions the shaders fall back to texture
+  // units, so kBasic* and kMultiDrawIndirect run on any GL 4.6 driver.
+  const char* glsl_defines = command_list_supported_ ? R"(
     #define ENABLE_BINDLESS_TEXTURE
     #define ENABLE_COMMAND_LIST
-  )";
+  )" : "";
+  // Object data of the token and multi draw indirect paths is packed, see
+  // PackedObjectData.
+  std::string packed_glsl_defines =
+      std::string(glsl_defines) + "#define PACKED_OBJECT_DATA\n";
+  std::string indirect_glsl_defines =
+      packed_glsl_defines + "#define ENABLE_DRAW_INDIRECT\n";
 
   ProgramID unlit_vertex_colored_id = program_manager_.createProgram(
       ProgramManager::Definition(GL_VERTEX_SHADER, glsl_defines,
@@ -474,6 +651,34 @@ void CommandListSample::onInitialize() {
           GL_FRAGMENT_SHADER, glsl_defines,
           "simple_textured_object_uniform_buffer.frag.glsl"));
 
+  ProgramID unlit_colored_packed_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_VERTEX_SHADER, packed_glsl_defines,
+                                 "unlit_colored_uniform_buffer.vert.glsl"),
+      ProgramManager::Definition(GL_FRAGMENT_SHADER, packed_glsl_defines,
+                                 "unlit_colored_uniform_buffer.frag.glsl"));
+
+  ProgramID simple_texture_object_packed_id = program_manager_.createProgram(
+      ProgramManager::Definition(
+          GL_VERTEX_SHADER, packed_glsl_defines,
+          "simple_textured_object_uniform_buffer.vert.glsl"),
+      ProgramManager::Definition(
+          GL_FRAGMENT_SHADER, packed_glsl_defines,
+          "simple_textured_object_uniform_buffer.frag.glsl"));
+
+  ProgramID unlit_colored_indirect_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_VERTEX_SHADER, indirect_glsl_defines,
+                                 "unlit_colored_uniform_buffer.vert.glsl"),
+      ProgramManager::Definition(GL_FRAGMENT_SHADER, indirect_glsl_defines,
+                                 "unlit_colored_uniform_buffer.frag.glsl"));
+
+  ProgramID simple_texture_object_indirect_id = program_manager_.createProgram(
+      ProgramManager::Definition(
+          GL_VERTEX_SHADER, indirect_glsl_defines,
+          "simple_textured_object_uniform_buffer.vert.glsl"),
+      ProgramManager::Definition(
+          GL_FRAGMENT_SHADER, indirect_glsl_defines,
+          "simple_textured_object_uniform_buffer.frag.glsl"));
+
   shader_manager_.RegisterShaderForName(
       "unlit_vertex_colored", program_manager_.get(unlit_vertex_colored_id));
   shader_manager_.RegisterShaderForName("unlit_colored",
@@ -485,6 +690,41 @@ void CommandListSample::onInitialize() {
   shader_manager_.RegisterShaderForName(
       "simple_textured_object_uniform",
       program_manager_.get(simple_texture_object_uniform_id));
+  shader_manager_.RegisterShaderForName(
+      "unlit_colored_packed", program_manager_.get(unlit_colored_packed_id));
+  shader_manager_.RegisterShaderForName(
+      "simple_textured_object_packed",
+      program_manager_.get(simple_texture_object_packed_id));
+  shader_manager_.RegisterShaderForName(
+      "unlit_colored_indirect", program_manager_.get(unlit_colored_indirect_id));
+  shader_manager_.RegisterShaderForName(
+      "simple_textured_object_indirect",
+      program_manager_.get(simple_texture_object_indirect_id));
+
+  ProgramID cull_tokens_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_COMPUTE_SHADER, "",
+                                 "cull_draws.comp.glsl"));
+  ProgramID cull_indirect_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_COMPUTE_SHADER, "#define CULL_INDIRECT\n",
+                                 "cull_draws.comp.glsl"));
+  ProgramID compact_indirect_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_COMPUTE_SHADER, "",
+                                 "compact_draws.comp.glsl"));
+  ProgramID depth_resolve_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_COMPUTE_SHADER,
+                                 "#define DEPTH_PYRAMID_RESOLVE\n",
+                                 "depth_pyramid.comp.glsl"));
+  ProgramID depth_reduce_id = program_manager_.createProgram(
+      ProgramManager::Definition(GL_COMPUTE_SHADER, "",
+                                 "depth_pyramid.comp.glsl"));
+  GpuCulling::Programs cull_programs;
+  cull_programs.cull_tokens = program_manager_.get(cull_tokens_id);
+  cull_programs.cull_indirect = program_manager_.get(cull_indirect_id);
+  cull_programs.compact_indirect =
+      program_manager_.get(compact_indirect_id);
+  cull_programs.depth_resolve = program_manager_.get(depth_resolve_id);
+  cull_programs.depth_reduce = program_manager_.get(depth_reduce_id);
+  gpu_culling_.Initialize(cull_programs, &gl_context_);
 
   glClearColor(0.1, 0.1, 0.1, 1);
   glClearDepth(1.0);
@@ -540,22 +780,40 @@ void CommandListSample::onUpdate() {
     camera_.set_target(pos + dir * camera_.distance());
   }
 
+  UpdateMapStreaming();
+  UpdateChangedObjectData();
+  CompactBuffers();
+
   // Compute VP matrix
   glm::mat4 projection = glm::perspective(
-      glm::radians(60.0f), width / (float)height, 0.01f, 30000.0f);
+      glm::radians(kFieldOfView), width / (float)height, 0.01f, 30000.0f);
   glm::mat4 view = camera_.view();
 
   scene_data_.VP = projection * view;
+  draw_view_.view_projection = scene_data_.VP;
+  draw_view_.eye = camera_.position();
+  draw_view_.lod_scale =
+      mesh_lod_ ? height / (2.0f * std::tan(glm::radians(kFieldOfView) * 0.5f))
+                : 0.0f;
 
   glNamedBufferSubData(scene_ubo_, 0, sizeof(SceneData), &scene_data_);
 
-  for (auto& k_v : shader_manager_.loaded_programs()) {
-    gl_context_.glUseProgram(k_v.second);
-    int VP_loc = glGetUniformLocation(k_v.second, "VP");
-    if (VP_loc != -1) {
-      glUniformMatrix4fv(VP_loc, 1, GL_FALSE, glm::value_ptr(scene_data_.VP));
+  if (frustum_culling_ &&
+      (draw_method_ == kBasic || draw_method_ == kBasicUniformBuffer)) {
+    CullScene();
+  }
+
+  // Per program uniforms of kBasic, set once per frame instead of per draw.
+  for (const auto& k_v : shader_manager_.loaded_programs()) {
+    const ProgramUniformLocations& locations =
+        shader_manager_.uniform_locations(k_v.second);
+    if (locations.vp != -1) {
+      glProgramUniformMatrix4fv(k_v.second, locations.vp, 1, GL_FALSE,
+                                glm::value_ptr(scene_data_.VP));
+    }
+    if (locations.tex0 != -1) {
+      glProgramUniform1i(k_v.second, locations.tex0, 0);
     }
-    gl_context_.glUseProgram(0);
   }
 }
 
@@ -580,6 +838,18 @@ void CommandListSample::onRender() {
     case kCommandList:
       DrawSceneCommandList();
       break;
+    case kMultiDrawIndirect:
+      DrawSceneMultiDrawIndirect();
+      break;
+  }
+  // Occlusion culling of the next frame tests against the depth of this one,
+  // only the fallback framebuffer has a depth texture.
+  if (command_list_supported_ && gpu_culling() && occlusion_culling_ &&
+      (draw_method_ == kCommandToken || draw_method_ == kMultiDrawIndirect)) {
+    gpu_culling_.BuildDepthPyramid(command_list_data_.depth_stencil_texture,
+                                   width, height, scene_data_.VP);
+  } else {
+    gpu_culling_.InvalidateDepthPyramid();
   }
   if (command_list_supported_) {
     BlitFallbackFramebuffer();
@@ -595,6 +865,7 @@ void CommandListSample::onUIUpdate() {
       "kBasicUniformBuffer",
       "kCommandToken",
       "kCommandList",
+      "kMultiDrawIndirect",
   };
 
   ImGui::Begin(u8"设置");
@@ -613,22 +884,78 @@ void CommandListSample::onUIUpdate() {
   ImGui::Checkbox(u8"State Cache", &cache_state);
   gl_context_.set_cache_state(cache_state);
   ImGui::Checkbox(u8"Romaing", &roaming_);
+  ImGui::Checkbox(u8"Shared Vertex Arrays", &share_vertex_arrays_);
 
+  if (ImGui::Checkbox(u8"Sort Draws By State", &sort_draws_by_state_)) {
+    for (auto& k_v : draw_chunks_) {
+      k_v.second.compiled = false;
+    }
+    command_list_data_.draw_commands_compiled = false;
+  }
+  ImGui::Checkbox(u8"Frustum Culling", &frustum_culling_);
+  ImGui::Checkbox(u8"GPU Culling", &gpu_culling_enabled_);
+  ImGui::Checkbox(u8"Occlusion Culling", &occlusion_culling_);
+  ImGui::Checkbox(u8"Mesh LOD", &mesh_lod_);
   ImGui::Checkbox(u8"Selective Draw", &selective_draw_);
   ImGui::DragInt(u8"Selective Draw Start", &selective_draw_start_, 1, 0,
                  command_list_data_.token_sequence.offsets.size());
   ImGui::DragInt(u8"Selective Draw Count", &selective_draw_count_, 1, 0,
                  command_list_data_.token_sequence.offsets.size());
 
+  int total_object_ubo_size = object_ring_buffer_->size();
+  for (const auto& k_v : draw_chunks_) {
+    total_object_ubo_size += k_v.second.object_ubo_size;
+  }
   ImGui::Text("total uniform buffer size: %fMB",
-              object_ubo_size_ / 1024.0f / 1024.0f);
-  ImGui::Text("total states: %d", state_caches_.size());
-  ImGui::Text("total token sequence count: %d",
-              command_list_data_.token_sequence.offsets.size());
+              total_object_ubo_size / 1024.0f / 1024.0f);
+  ImGui::Text("total states: %zu", state_caches_.size());
+  ImGui::Text("state cache hits: %llu, misses: %llu, created: %d, "
+              "collected: %d",
+              (unsigned long long)state_cache_stats_.hits,
+              (unsigned long long)state_cache_stats_.misses,
+              state_cache_stats_.created, state_cache_stats_.collected);
+  ImGui::Text("changed objects uploaded: %d", changed_object_count_);
+  if (frustum_culling_ &&
+      (draw_method_ == kBasic || draw_method_ == kBasicUniformBuffer)) {
+    ImGui::Text("visible draws: %d/%d, cull time: %.3f ms",
+                cull_stats_.visible_draws, scene_draw_count_,
+                cull_stats_.cull_ms);
+  }
+  ImGui::Text("total indirect batches: %zu",
+              multi_draw_indirect_data_.batches.size());
+  ImGui::Text("total token sequence count: %zu (unsorted %d)",
+              command_list_data_.token_sequence.offsets.size(),
+              unsorted_sequence_count());
   ImGui::Text(
       "total command token buffer size: %fMB",
       command_list_data_.command_stream_buffer_size / 1024.0f / 1024.0f);
-  ImGui::Text("total road graph element count: %d", render_objects_.size());
+  ImGui::Text("total road graph element count: %d", scene_objects_.size());
+  BufferAllocatorStats buffer_stats = buffer_manager_->stats();
+  ImGui::Text("vertex buffer blocks: %d, used %.2fMB, free ranges %d, "
+              "fragmentation %.3f",
+              buffer_manager_->block_count(),
+              buffer_stats.used_size / 1024.0f / 1024.0f,
+              buffer_stats.free_range_count, buffer_stats.fragmentation());
+  ImGui::Text("compacted %.2fMB, released blocks %d",
+              buffer_manager_->compacted_bytes() / 1024.0f / 1024.0f,
+              buffer_manager_->released_block_count());
+  const MeshOptimizeStats& optimize_stats =
+      map_streamer_ ? map_streamer_->mesh_optimize_stats()
+                    : mesh_optimize_stats_;
+  ImGui::Text("mesh optimization saved %.2fMB, ACMR %.3f -> %.3f",
+              (double(optimize_stats.buffer_bytes_before) -
+               double(optimize_stats.buffer_bytes_after)) /
+                  1024.0 / 1024.0,
+              optimize_stats.acmr_before(), optimize_stats.acmr_after());
+  ImGui::Text("vertex compression %.2fMB -> %.2fMB",
+              optimize_stats.vertex_bytes_uncompressed / 1024.0f / 1024.0f,
+              optimize_stats.vertex_bytes_compressed / 1024.0f / 1024.0f);
+  if (map_streamer_) {
+    ImGui::Text("map tiles resident/loading/total: %d/%d/%d",
+                map_streamer_->resident_tile_count(),
+                map_streamer_->loading_tile_count(),
+                map_streamer_->total_tile_count());
+  }
 
 
   auto duration = std::chrono::duration_cast<us>(
@@ -654,121 +981,123 @@ void CommandListSample::onResize(int w, int h) {
 
 void CommandListSample::onEndFrame() { Window::onEndFrame(); }
 
+void CommandListSample::BeginMeshRendering() {
+  MeshRenderer::set_shared_vertex_arrays(
+      share_vertex_arrays_ ? &shared_vertex_arrays_ : nullptr);
+  shared_vertex_arrays_.ResetBinding();
+}
+
 void CommandListSample::DrawSceneBasic() {
+  BeginMeshRendering();
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture_[0]);
 
-  // ProfileTimer timer("collect uniform data");
-  auto pre_render_func =
-      [&shader_manager_ = shader_manager_,
-       &gl_context = gl_context_](RenderObject* render_object) -> bool {
-    GLuint program = shader_manager_.GetShader(render_object->shader());
-    gl_context.glUseProgram(program);
-
-    int M_loc = program ? glGetUniformLocation(program, "M") : -1;
-    int color_loc = program ? glGetUniformLocation(program, "color") : -1;
-    int alpha_loc = program ? glGetUniformLocation(program, "in_alpha") : -1;
-    if (M_loc != -1) {
-      glUniformMatrix4fv(M_loc, 1, GL_FALSE,
-                         glm::value_ptr(render_object->world()));
-    }
-    int tex0_loc = program ? glGetUniformLocation(program, "tex0") : -1;
-    if (M_loc != -1) {
-      glUniform1i(tex0_loc, 0);
-    }
-    auto line_object = dynamic_cast<LineObject*>(render_object);
-    if (line_object && color_loc != -1) {
-      glUniform4fv(color_loc, 1, glm::value_ptr(line_object->color()));
-    }
-    auto dashed_stripe_object =
-        dynamic_cast<DashedStripeObject*>(render_object);
-    if (dashed_stripe_object && color_loc != -1) {
-      glUniform4fv(color_loc, 1, glm::value_ptr(dashed_stripe_object->color()));
-    }
-    auto simple_textured_object =
-        dynamic_cast<SimpleTexturedObject*>(render_object);
-    if (simple_textured_object && alpha_loc != -1) {
-      glUniform1f(alpha_loc, simple_textured_object->alpha());
+  std::vector<GLuint> programs = ResolvePrograms("");
+  std::vector<const ProgramUniformLocations*> program_locations;
+  program_locations.reserve(programs.size());
+  for (GLuint program : programs) {
+    program_locations.push_back(&shader_manager_.uniform_locations(program));
+  }
+  for (const auto& k_v : draw_chunks_) {
+    const DrawChunk& chunk = k_v.second;
+    const DrawList& draw_list = chunk.draw_list;
+    int draw_count =
+        frustum_culling_ ? chunk.visible_draws.size() : draw_list.size();
+    for (int draw = 0; draw < draw_count; ++draw) {
+      int i = frustum_culling_ ? chunk.visible_draws[draw] : draw;
+      if (!draw_list.counts[i]) {
+        continue;
+      }
+      uint16_t shader = draw_list.states[i].shader;
+      gl_context_.glUseProgram(programs[shader]);
+
+      // VP and tex0 are set per frame in onUpdate.
+      const ProgramUniformLocations& locations = *program_locations[shader];
+      if (locations.m != -1) {
+        glUniformMatrix4fv(locations.m, 1, GL_FALSE,
+                           glm::value_ptr(draw_list.worlds[i]));
+      }
+      if (locations.color != -1) {
+        glUniform4fv(locations.color, 1, glm::value_ptr(draw_list.colors[i]));
+      }
+      if (locations.in_alpha != -1) {
+        glUniform1f(locations.in_alpha, draw_list.colors[i].a);
+      }
+      RenderDraw(draw_list, i, SelectDrawLod(draw_list, i, draw_view_));
     }
-    return true;
-  };
-
-  for (auto& object : render_objects_) {
-    object->Render(shader_manager_, pre_render_func);
   }
 }
 
 void CommandListSample::DrawSceneBasicUniformBuffer() {
-  // Collect uniform data in buffer
-  std::vector<RenderObject*> real_render_objects;
-  std::vector<ObjectData> object_datas;
+  BeginMeshRendering();
+  BasicUniformData& data = basic_uniform_data_;
   int data_stride = UniformBufferAlignedOffset(sizeof(ObjectData));
-  {
-    // TODO: parallel collect data.
-    // ProfileTimer timer("collect uniform data");
-    auto collect_data_pre_render_func =
-        [&object_datas,
-         &real_render_objects](RenderObject* render_object) -> bool {
-      bool should_continue = true;
-      ObjectData object_data;
-      object_data.M = render_object->world();
-      auto line_object = dynamic_cast<const LineObject*>(render_object);
-      if (line_object) {
-        object_data.color = line_object->color();
-        should_continue = false;
-      }
-      auto dashed_stripe_object =
-          dynamic_cast<const DashedStripeObject*>(render_object);
-      if (dashed_stripe_object) {
-        object_data.color = dashed_stripe_object->color();
-        should_continue = false;
-      }
-      auto simple_textured_object =
-          dynamic_cast<const SimpleTexturedObject*>(render_object);
-      if (simple_textured_object) {
-        object_data.color = glm::vec4(simple_textured_object->alpha());
-        should_continue = false;
-      }
-      if (!should_continue) {
-        object_datas.push_back(object_data);
-        real_render_objects.push_back(render_object);
+  if (!data.valid) {
+    // Gather only when the scene changed, changed objects update their slot
+    // in UpdateChangedObjectData.
+    data.object_datas.resize(scene_draw_count_);
+    for (const auto& k_v : draw_chunks_) {
+      const DrawChunk& chunk = k_v.second;
+      for (int i = 0; i < chunk.draw_list.size(); ++i) {
+        ObjectData& object_data = data.object_datas[chunk.scene_base + i];
+        object_data.M = chunk.draw_list.worlds[i];
+        object_data.color = chunk.draw_list.colors[i];
       }
-      return should_continue;
-    };
-
-    for (auto& object : render_objects_) {
-      object->Render(shader_manager_, collect_data_pre_render_func);
     }
+    data.changed_slots.assign(object_ring_buffer_->frame_count(), {});
+    data.full_upload.assign(object_ring_buffer_->frame_count(), true);
+    data.valid = true;
   }
 
   {
     // ProfileTimer timer("upload uniform data");
-    if (object_ubo_size_ < object_datas.size() * data_stride) {
-      glNamedBufferData(object_ubo_, object_datas.size() * data_stride, 0,
-                        GL_DYNAMIC_DRAW);
-      object_ubo_size_ = object_datas.size() * data_stride;
-      object_ubo_address_ = 0;
+    int allocation_count = object_ring_buffer_->allocation_count();
+    unsigned char* ptr = (unsigned char*)object_ring_buffer_->BeginFrame(
+        data.object_datas.size() * data_stride);
+    if (allocation_count != object_ring_buffer_->allocation_count()) {
+      data.full_upload.assign(data.full_upload.size(), true);
     }
-    unsigned char* ptr =
-        (unsigned char*)glMapNamedBuffer(object_ubo_, GL_WRITE_ONLY);
-    for (int i = 0; i < object_datas.size(); ++i) {
-      memcpy(ptr + data_stride * i, &object_datas[i], sizeof(ObjectData));
+    // A region only needs the slots that changed since it was last written.
+    int region = object_ring_buffer_->frame_index();
+    if (data.full_upload[region]) {
+      for (int i = 0; i < data.object_datas.size(); ++i) {
+        memcpy(ptr + data_stride * i, &data.object_datas[i],
+               sizeof(ObjectData));
+      }
+      data.full_upload[region] = false;
+    } else {
+      for (int i : data.changed_slots[region]) {
+        memcpy(ptr + data_stride * i, &data.object_datas[i],
+               sizeof(ObjectData));
+      }
     }
-    glUnmapNamedBuffer(object_ubo_);
+    data.changed_slots[region].clear();
   }
 
   {
     // ProfileTimer timer("render data");
-
-    for (int i = 0; i < real_render_objects.size(); ++i) {
-      const RenderObject* object = real_render_objects[i];
-      GLuint program = shader_manager_.GetShader(object->shader() + "_uniform");
-      gl_context_.glUseProgram(program);
-      glBindBufferRange(GL_UNIFORM_BUFFER, UBO_OBJECT, object_ubo_,
-                        i * data_stride, sizeof(ObjectData));
-      const_cast<RenderObject*>(object)->Render(shader_manager_);
+    std::vector<GLuint> programs = ResolvePrograms("_uniform");
+    for (const auto& k_v : draw_chunks_) {
+      const DrawChunk& chunk = k_v.second;
+      const DrawList& draw_list = chunk.draw_list;
+      int draw_count =
+          frustum_culling_ ? chunk.visible_draws.size() : draw_list.size();
+      for (int draw = 0; draw < draw_count; ++draw) {
+        int i = frustum_culling_ ? chunk.visible_draws[draw] : draw;
+        if (!draw_list.counts[i]) {
+          continue;
+        }
+        gl_context_.glUseProgram(programs[draw_list.states[i].shader]);
+        glBindBufferRange(GL_UNIFORM_BUFFER, UBO_OBJECT,
+                          object_ring_buffer_->buffer_id(),
+                          object_ring_buffer_->frame_offset() +
+                              (chunk.scene_base + i) * data_stride,
+                          sizeof(ObjectData));
+        RenderDraw(draw_list, i, SelectDrawLod(draw_list, i, draw_view_));
+      }
     }
   }
+  object_ring_buffer_->EndFrame();
 }
 
 void CommandListSample::BindFallbackFramebuffer() {
@@ -792,264 +1121,595 @@ void CommandListSample::BlitFallbackFramebuffer() {
                     GL_COLOR_BUFFER_BIT, GL_NEAREST);
 }
 
-void CommandListSample::CollectRenderObjectData(
-    std::vector<ObjectData>& object_datas,
-    std::vector<RenderObject*>& real_render_objects,
-    std::vector<CapturedStateCache>& render_object_states) {
-  // TODO: parallel collect data.
-  ProfileTimer timer("  collect render datas");
-  auto collect_data_pre_render_func = [&object_datas, &real_render_objects,
-                                       &render_object_states,
-                                       &shader_manager_ = shader_manager_](
-                                          RenderObject* render_object) -> bool {
-    bool should_continue = true;
-    ObjectData object_data;
-    CapturedStateCache render_state;
-    render_state.program =
-        shader_manager_.GetShader(render_object->shader() + "_uniform");
-    render_state.vertex_attrib_mask =
-        render_object->mesh_renderer().vertex_attrib_mask();
-    render_state.base_draw_mode =
-        GetBaseDrawMode(render_object->mesh_renderer().mesh().draw_mode());
-
-    object_data.M = render_object->world();
-    auto line_object = dynamic_cast<const LineObject*>(render_object);
-    if (line_object) {
-      object_data.color = line_object->color();
-      should_continue = false;
-      render_state.enable_line_stipple =
-          (uint8_t)line_object->line_style().line_stipple;
-      render_state.stipple_factor = line_object->line_style().line_stipple_factor;
-      render_state.stipple_pattern = line_object->line_style().line_stipple_pattern;
-    }
-    auto dashed_stripe_object =
-        dynamic_cast<const DashedStripeObject*>(render_object);
-    if (dashed_stripe_object) {
-      object_data.color = dashed_stripe_object->color();
-      should_continue = false;
-    }
-    auto simple_textured_object =
-        dynamic_cast<const SimpleTexturedObject*>(render_object);
-    if (simple_textured_object) {
-      object_data.color = glm::vec4(simple_textured_object->alpha());
-      should_continue = false;
-    }
-
-    if (!should_continue) {
-      object_datas.push_back(object_data);
-      real_render_objects.push_back(render_object);
-      render_object_states.push_back(render_state);
-    }
-    return should_continue;
-  };
-
-  for (auto& object : render_objects_) {
-    object->Render(shader_manager_, collect_data_pre_render_func);
+void CommandListSample::FlattenDrawChunk(DrawChunk* chunk) {
+  DrawList& draw_list = chunk->draw_list;
+  draw_list.Clear();
+  for (RenderObject* object : chunk->objects) {
+    draw_list.Append(object);
+  }
+  // The data is read from the draw list from now on, changes are reported
+  // to refresh it.
+  for (int i = 0; i < draw_list.size(); ++i) {
+    ObjectDataSlot& slot = object_data_slots_[draw_list.objects[i]];
+    slot.chunk = chunk;
+    slot.draw_index = i;
+    draw_list.objects[i]->set_change_list(&object_change_list_);
   }
+  chunk->bvh.Build(draw_list.bounds);
+  chunk->bvh_stale = false;
+  chunk->compiled = false;
 }
 
-void CommandListSample::CompileDrawCommandList() {
-  if (command_list_data_.draw_commands_compiled) {
-    return;
+std::vector<GLuint> CommandListSample::ResolvePrograms(
+    const std::string& suffix) const {
+  std::vector<GLuint> programs(DrawList::shader_count());
+  for (int i = 0; i < programs.size(); ++i) {
+    programs[i] = shader_manager_.GetShader(DrawList::shader_name(i) + suffix);
   }
+  return programs;
+}
 
+void CommandListSample::CompileDrawChunk(DrawChunk* chunk) {
   // Record draw commands
-  std::string& token_buffer = command_list_data_.command_stream_buffer_cpu_;
+  std::string& token_buffer = chunk->token_buffer;
   token_buffer.clear();
-  NVTokenSequence& token_sequence = command_list_data_.token_sequence;
-
-  std::vector<ObjectData> object_datas;
-  std::vector<RenderObject*> real_render_objects;
-  std::vector<CapturedStateCache> render_object_states;
-  CollectRenderObjectData(object_datas, real_render_objects,
-                          render_object_states);
-
-  ProfileTimer timer("  record render commands");
+  NVTokenSequence& token_sequence = chunk->token_sequence;
+  const DrawList& draw_list = chunk->draw_list;
+  std::vector<GLuint> programs = ResolvePrograms("_packed");
+
+  // Capture the states before the object ubo is mapped below.
+  std::vector<GLuint> states(draw_list.size(), 0);
+  for (int i = 0; i < draw_list.size(); ++i) {
+    if (draw_list.counts[i]) {
+      const DrawState& draw_state = draw_list.states[i];
+      states[i] = CaptureState(CapturedStateCache::FromDrawState(
+          draw_state, programs[draw_state.shader]));
+    }
+  }
+  chunk->unsorted_sequence_count = CountTokenSequences(states);
+  // order[slot] is the draw stored at |slot| of the object ubo.
+  std::vector<uint32_t> order;
+  if (sort_draws_by_state_) {
+    SortDrawsByState(draw_list, programs, states, &order);
+  } else {
+    order.resize(draw_list.size());
+    std::iota(order.begin(), order.end(), 0);
+  }
+  chunk->draw_slots.resize(order.size());
+  for (uint32_t slot = 0; slot < order.size(); ++slot) {
+    chunk->draw_slots[order[slot]] = slot;
+  }
 
   token_sequence.offsets.clear();
   token_sequence.sizes.clear();
   token_sequence.states.clear();
   token_sequence.fbos.clear();
+  chunk->buffers.clear();
+  chunk->cull_draws.clear();
 
-  GLuint texture_shader = shader_manager_.GetShader("simple_textured_object_uniform");
+  GLuint texture_shader = shader_manager_.GetShader("simple_textured_object_packed");
 
   // Setup token buffer
-  int data_stride = UniformBufferAlignedOffset(sizeof(ObjectData));
+  int data_stride = sizeof(PackedObjectData);
   {
-    if (object_ubo_size_ < object_datas.size() * data_stride) {
-      object_ubo_size_ = object_datas.size() * data_stride;
-      glNamedBufferData(object_ubo_, object_ubo_size_, 0, GL_DYNAMIC_DRAW);
-      object_ubo_address_ = 0;
+    if (order.empty()) {
+      chunk->compiled = true;
+      return;
+    }
+    if (!chunk->object_ubo) {
+      glCreateBuffers(1, &chunk->object_ubo);
+    }
+    if (chunk->object_ubo_size < order.size() * data_stride) {
+      if (chunk->object_ubo_address) {
+        glMakeNamedBufferNonResidentNV(chunk->object_ubo);
+      }
+      chunk->object_ubo_size = order.size() * data_stride;
+      glNamedBufferData(chunk->object_ubo, chunk->object_ubo_size, 0,
+                        GL_DYNAMIC_DRAW);
+      chunk->object_ubo_address = 0;
     }
-    if (!object_ubo_address_) {
-      glGetNamedBufferParameterui64vNV(object_ubo_, GL_BUFFER_GPU_ADDRESS_NV,
-                                       &object_ubo_address_);
-      glMakeNamedBufferResidentNV(object_ubo_, GL_READ_ONLY);
+    if (!chunk->object_ubo_address) {
+      glGetNamedBufferParameterui64vNV(chunk->object_ubo,
+                                       GL_BUFFER_GPU_ADDRESS_NV,
+                                       &chunk->object_ubo_address);
+      glMakeNamedBufferResidentNV(chunk->object_ubo, GL_READ_ONLY);
     }
 
-    // FIXME? State capture procedure will interfere with the object_ubo_
-    // mapping
-    unsigned char* ptr =
-        (unsigned char*)glMapNamedBuffer(object_ubo_, GL_WRITE_ONLY);
-    for (int i = 0; i < object_datas.size(); ++i) {
-      memcpy(ptr + data_stride * i, &object_datas[i], sizeof(ObjectData));
+    PackedObjectData* ptr = (PackedObjectData*)glMapNamedBuffer(
+        chunk->object_ubo, GL_WRITE_ONLY);
+    for (int slot = 0; slot < order.size(); ++slot) {
+      ptr[slot] = PackObjectData(draw_list.worlds[order[slot]],
+                                 draw_list.colors[order[slot]]);
+    }
+    glUnmapNamedBuffer(chunk->object_ubo);
+
+    // Resolve everything that needs GL on this thread, the tasks below only
+    // write bytes at the offsets computed here.
+    std::vector<TokenDraw> draws;
+    draws.reserve(order.size());
+    int material_index = 0;
+    int bound_object_block = -1;
+    GLintptr token_size = 0;
+    for (int slot = 0; slot < order.size(); ++slot) {
+      int i = order[slot];
+      if (!states[i]) {
+        continue;
+      }
+      const MeshRenderer& mesh_renderer = *draw_list.mesh_renderers[i];
+      TokenDraw draw;
+      draw.offset = token_size;
+      draw.state = states[i];
+      int object_block = slot / PACKED_OBJECT_BLOCK_SIZE;
+      draw.object_index = slot % PACKED_OBJECT_BLOCK_SIZE;
+      // Uniform bindings do not carry over into the next sequence.
+      if (draws.empty() || draws.back().state != states[i] ||
+          object_block != bound_object_block) {
+        draw.object_block_address =
+            chunk->object_ubo_address +
+            object_block * PACKED_OBJECT_BLOCK_SIZE * data_stride;
+        bound_object_block = object_block;
+      }
+      if (programs[draw_list.states[i].shader] == texture_shader) {
+        draw.material_address =
+            material_ubo_address_ +
+            material_index * UniformBufferAlignedOffset(sizeof(MaterialData));
+        material_index = 1 - material_index;
+      }
+      draw.vbo_address =
+          buffer_manager_->GetBufferAddress(mesh_renderer.vbo()->buffer_id()) +
+          mesh_renderer.vbo()->offset();
+      chunk->buffers.insert(mesh_renderer.vbo()->buffer_id());
+      if (draw_list.indexed[i]) {
+        draw.ibo_address = buffer_manager_->GetBufferAddress(
+                               mesh_renderer.ibo()->buffer_id()) +
+                           mesh_renderer.ibo()->offset();
+        draw.index_size = mesh_renderer.index_size();
+        chunk->buffers.insert(mesh_renderer.ibo()->buffer_id());
+      }
+      draw.count = draw_list.counts[i];
+      draw.line_width = draw_list.command_line_widths[i];
+      draw.draw_mode = draw_list.states[i].draw_mode;
+      TokenStreamWriter sizer(&command_list_data_.token_headers);
+      WriteTokenDraw(draw, scene_ubo_address_, &sizer);
+      // The draw token ends the tokens of the draw.
+      size_t draw_token_size = draw.ibo_address
+                                   ? sizeof(DrawElementsInstancedCommandNV)
+                                   : sizeof(DrawArraysInstancedCommandNV);
+      common::CullDraw cull_draw = {};
+      cull_draw.offset =
+          (token_size + sizer.size() - draw_token_size) / sizeof(GLuint);
+      cull_draw.word_count = draw_token_size / sizeof(GLuint);
+      cull_draw.bounds_index = i;
+      if (draw.ibo_address) {
+        SetCullDrawLods(mesh_renderer,
+                        offsetof(DrawElementsInstancedCommandNV, count),
+                        offsetof(DrawElementsInstancedCommandNV, firstIndex),
+                        &cull_draw);
+      } else {
+        SetCullDrawLods(mesh_renderer,
+                        offsetof(DrawArraysInstancedCommandNV, count),
+                        offsetof(DrawArraysInstancedCommandNV, first),
+                        &cull_draw);
+      }
+      chunk->cull_draws.push_back(cull_draw);
+      token_size += sizer.size();
+      draws.push_back(draw);
     }
-    glUnmapNamedBuffer(object_ubo_);
 
-    GLuint last_state = -1;
-    GLintptr last_offset = -1;
+    {
+      ProfileTimer timer("  write tokens");
+      token_buffer.resize(token_size);
+      char* tokens = &token_buffer[0];
+      const CommandTokenHeaders& headers = command_list_data_.token_headers;
+      GLuint64 scene_address = scene_ubo_address_;
+      TaskCounter counter;
+      for (size_t begin = 0; begin < draws.size();
+           begin += kTokenDrawsPerTask) {
+        size_t end = std::min(begin + kTokenDrawsPerTask, draws.size());
+        size_t end_offset =
+            end < draws.size() ? draws[end].offset : token_size;
+        task_scheduler_->Submit(
+            [&draws, &headers, tokens, scene_address, begin, end,
+             end_offset]() {
+              TokenStreamWriter writer(&headers, tokens + draws[begin].offset,
+                                       end_offset - draws[begin].offset);
+              for (size_t i = begin; i < end; ++i) {
+                WriteTokenDraw(draws[i], scene_address, &writer);
+              }
+            },
+            &counter);
+      }
+      task_scheduler_->Wait(&counter);
+    }
+    for (common::CullDraw& cull_draw : chunk->cull_draws) {
+      memcpy(cull_draw.words,
+             token_buffer.data() + cull_draw.offset * sizeof(GLuint),
+             cull_draw.word_count * sizeof(GLuint));
+    }
 
-    // Build token buffer
-    for (int i = 0; i < object_datas.size(); ++i) {
-      if (real_render_objects[i]->mesh_renderer().mesh().positions().empty()) {
+    // Draws sharing a state are contiguous, each run is one sequence.
+    for (int i = 0; i < draws.size(); ++i) {
+      if (i > 0 && draws[i].state == draws[i - 1].state) {
         continue;
       }
+      if (!token_sequence.offsets.empty()) {
+        token_sequence.sizes.push_back(draws[i].offset -
+                                       token_sequence.offsets.back());
+      }
+      token_sequence.offsets.push_back(draws[i].offset);
+      token_sequence.states.push_back(draws[i].state);
+      token_sequence.fbos.push_back(command_list_data_.fallback_framebuffer);
+    }
+    if (!token_sequence.offsets.empty()) {
+      token_sequence.sizes.push_back(token_size -
+                                     token_sequence.offsets.back());
+    }
+  }
+  chunk->compiled = true;
+}
+
+void CommandListSample::CompileDrawCommandList() {
+  if (command_list_data_.draw_commands_compiled) {
+    return;
+  }
 
-      GLuint state = CaptureState(render_object_states[i]);
+  ProfileTimer timer("  record render commands");
+  for (auto& k_v : draw_chunks_) {
+    if (!k_v.second.compiled) {
+      CompileDrawChunk(&k_v.second);
+    }
+  }
 
-      if (last_state != state) {
-        if (last_state != -1) {
-          // record draw command
-          token_sequence.offsets.push_back(last_offset);
-          token_sequence.sizes.push_back(token_buffer.size() - last_offset);
-          token_sequence.states.push_back(last_state);
-          token_sequence.fbos.push_back(command_list_data_.fallback_framebuffer);
-        }
-        last_state = state;
-        last_offset = token_buffer.size();
+  // Concatenate the chunk token streams straight into the mapped command
+  // stream buffer, chunks that did not change are only copied.
+  size_t stream_size = 0;
+  for (const auto& k_v : draw_chunks_) {
+    stream_size += k_v.second.token_buffer.size();
+  }
+  char* stream = MapCommandStreamBuffer(stream_size);
+  NVTokenSequence& token_sequence = command_list_data_.token_sequence;
+  token_sequence.offsets.clear();
+  token_sequence.sizes.clear();
+  token_sequence.states.clear();
+  token_sequence.fbos.clear();
+  std::vector<common::CullDraw> cull_draws;
+  GLintptr base_offset = 0;
+  for (const auto& k_v : draw_chunks_) {
+    const DrawChunk& chunk = k_v.second;
+    memcpy(stream + base_offset, chunk.token_buffer.data(),
+           chunk.token_buffer.size());
+    for (common::CullDraw cull_draw : chunk.cull_draws) {
+      cull_draw.offset += base_offset / sizeof(GLuint);
+      cull_draw.bounds_index += chunk.scene_base;
+      cull_draws.push_back(cull_draw);
+    }
+    for (int i = 0; i < chunk.token_sequence.offsets.size(); ++i) {
+      // Sequences are contiguous, merge across chunk boundaries.
+      if (i == 0 && !token_sequence.states.empty() &&
+          token_sequence.states.back() == chunk.token_sequence.states[i] &&
+          token_sequence.fbos.back() == chunk.token_sequence.fbos[i]) {
+        token_sequence.sizes.back() += chunk.token_sequence.sizes[i];
+        continue;
       }
+      token_sequence.offsets.push_back(base_offset +
+                                       chunk.token_sequence.offsets[i]);
+      token_sequence.sizes.push_back(chunk.token_sequence.sizes[i]);
+      token_sequence.states.push_back(chunk.token_sequence.states[i]);
+      token_sequence.fbos.push_back(chunk.token_sequence.fbos[i]);
+    }
+    base_offset += chunk.token_buffer.size();
+  }
 
-      const RenderObject* object = real_render_objects[i];
-      auto line_object = dynamic_cast<const LineObject*>(object);
+  if (gpu_culling_.valid()) {
+    gpu_culling_.SetTokenDraws(cull_draws);
+  }
 
-      // record draw command
-      GLintptr offset = token_buffer.size();
+  command_list_data_.draw_commands_compiled = true;
+  command_list_data_.command_stream_culled = false;
+  command_list_data_.command_list_compiled = false;
+  CollectUnusedStates();
+}
 
-      // Set up uniform binding info
-      {
-        uint header = glGetCommandHeaderNV(GL_UNIFORM_ADDRESS_COMMAND_NV,
-                                           sizeof(UniformAddressCommandNV));
-        uint64_t uniform_buffer_address = object_ubo_address_ + i * data_stride;
-        PushCommandToBuffer(
-            UniformAddressCommandNV{header, UBO_OBJECT,
-                                    glGetStageIndexNV(GL_VERTEX_SHADER),
-                                    uniform_buffer_address},
-            &token_buffer);
-        PushCommandToBuffer(
-            UniformAddressCommandNV{header, UBO_OBJECT,
-                                    glGetStageIndexNV(GL_FRAGMENT_SHADER),
-                                    uniform_buffer_address},
-            &token_buffer);
-        PushCommandToBuffer(
-            UniformAddressCommandNV{header, UBO_SCENE,
-                                    glGetStageIndexNV(GL_VERTEX_SHADER),
-                                    scene_ubo_address_},
-            &token_buffer);
-        PushCommandToBuffer(
-            UniformAddressCommandNV{header, UBO_SCENE,
-                                    glGetStageIndexNV(GL_FRAGMENT_SHADER),
-                                    scene_ubo_address_},
-            &token_buffer);
-
-        if (render_object_states[i].program == texture_shader) {
-          static int flip = 0;
-          PushCommandToBuffer(
-              UniformAddressCommandNV{
-                  header, UBO_MATERIAL, glGetStageIndexNV(GL_VERTEX_SHADER),
-                  material_ubo_address_ +
-                      flip * UniformBufferAlignedOffset(sizeof(MaterialData))},
-              &token_buffer);
-          PushCommandToBuffer(
-              UniformAddressCommandNV{
-                  header, UBO_MATERIAL, glGetStageIndexNV(GL_FRAGMENT_SHADER),
-                  material_ubo_address_ +
-                      flip * UniformBufferAlignedOffset(sizeof(MaterialData))},
-              &token_buffer);
-          flip = 1 - flip;          
-        }
-      }
+char* CommandListSample::MapCommandStreamBuffer(size_t size) {
+  CommandListExtensionData& data = command_list_data_;
+  // The previous stream may still be read by glDrawCommandsStatesNV.
+  if (data.command_stream_fence) {
+    glClientWaitSync(data.command_stream_fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     kCommandStreamFenceTimeout);
+    glDeleteSync(data.command_stream_fence);
+    data.command_stream_fence = nullptr;
+  }
+  if (data.command_stream_buffer && data.command_stream_buffer_size >= size) {
+    return data.command_stream_mapped;
+  }
 
-      // Set up vertex attrib binding info
-      {
-        uint header = glGetCommandHeaderNV(GL_ATTRIBUTE_ADDRESS_COMMAND_NV,
-                                           sizeof(AttributeAddressCommandNV));
-        GLuint64 vbo_address = buffer_manager_->GetBufferAddress(
-            object->mesh_renderer().vbo()->buffer_id());
-        PushCommandToBuffer(
-            AttributeAddressCommandNV{
-                header, 0,
-                vbo_address + object->mesh_renderer().vbo()->offset()},
-            &token_buffer);
-      }
-      // Set up index binding info
-      if (object->mesh_renderer().mesh().indexed_draw()) {
-        uint header = glGetCommandHeaderNV(GL_ELEMENT_ADDRESS_COMMAND_NV,
-                                           sizeof(ElementAddressCommandNV));
-        GLuint64 ibo_address = buffer_manager_->GetBufferAddress(
-            object->mesh_renderer().ibo()->buffer_id());
-        PushCommandToBuffer(
-            ElementAddressCommandNV{
-                header, ibo_address + object->mesh_renderer().ibo()->offset(),
-                sizeof(Mesh::IndexType)},
-            &token_buffer);
-      }
+  // Immutable storage can not grow, replace the buffer with a larger one.
+  if (data.command_stream_buffer) {
+    glUnmapNamedBuffer(data.command_stream_buffer);
+    glDeleteBuffers(1, &data.command_stream_buffer);
+  }
+  data.command_stream_buffer_size =
+      std::max<uint64_t>(size + size / 2, kMinCommandStreamBufferSize);
+  // Mapped readable, CompileCommandList hands the tokens to the driver from
+  // the mapping.
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT |
+                           GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glCreateBuffers(1, &data.command_stream_buffer);
+  glNamedBufferStorage(data.command_stream_buffer,
+                       data.command_stream_buffer_size, nullptr, flags);
+  data.command_stream_mapped = static_cast<char*>(glMapNamedBufferRange(
+      data.command_stream_buffer, 0, data.command_stream_buffer_size, flags));
+  return data.command_stream_mapped;
+}
 
-      // Set up aux info
-      if (line_object) {
-        uint header = glGetCommandHeaderNV(GL_LINE_WIDTH_COMMAND_NV,
-                                           sizeof(LineWidthCommandNV));
-        float line_width = glm::clamp(line_object->line_style().line_width, 0.5f, 10.0f);
-        PushCommandToBuffer(
-            LineWidthCommandNV{header, line_width},
-            &token_buffer);
+void CommandListSample::CollectUnusedStates() {
+  ++state_cache_generation_;
+  std::unordered_set<GLuint> used_states(
+      command_list_data_.token_sequence.states.begin(),
+      command_list_data_.token_sequence.states.end());
+  std::vector<GLuint> unused_states;
+  for (auto iter = state_caches_.begin(); iter != state_caches_.end();) {
+    CaptureStateData& data = iter->second;
+    if (used_states.count(data.state_object)) {
+      data.last_used_generation = state_cache_generation_;
+    } else if (state_cache_generation_ - data.last_used_generation >
+               kStateObjectMaxIdleGenerations) {
+      unused_states.push_back(data.state_object);
+      iter = state_caches_.erase(iter);
+      continue;
+    }
+    ++iter;
+  }
+  if (!unused_states.empty()) {
+    glDeleteStatesNV(unused_states.size(), unused_states.data());
+    state_cache_stats_.collected += unused_states.size();
+  }
+}
+
+void CommandListSample::SortDrawsByState(const DrawList& draw_list,
+                                         const std::vector<GLuint>& programs,
+                                         const std::vector<GLuint>& states,
+                                         std::vector<uint32_t>* order) {
+  // Bits 63-48 program, 47-24 state object, 23-8 depth bucket. The sort is
+  // stable, so draws with equal keys keep the map order. Programs and states
+  // go in as dense indices in the order of their GL names, the names do not
+  // fit the key bits without colliding.
+  constexpr int kDepthBucketCount = 1 << 16;
+  std::map<GLuint, uint64_t> program_indices;
+  std::map<GLuint, uint64_t> state_indices;
+  for (int i = 0; i < draw_list.size(); ++i) {
+    program_indices[programs[draw_list.states[i].shader]];
+    state_indices[states[i]];
+  }
+  uint64_t next_index = 0;
+  for (auto& k_v : program_indices) {
+    k_v.second = next_index++;
+  }
+  next_index = 0;
+  for (auto& k_v : state_indices) {
+    k_v.second = next_index++;
+  }
+
+  float min_z = FLT_MAX;
+  float max_z = -FLT_MAX;
+  for (const glm::mat4& world : draw_list.worlds) {
+    min_z = std::min(min_z, world[3].z);
+    max_z = std::max(max_z, world[3].z);
+  }
+  float depth_scale =
+      max_z > min_z ? (kDepthBucketCount - 1) / (max_z - min_z) : 0.0f;
+
+  std::vector<uint64_t> keys(draw_list.size());
+  for (int i = 0; i < draw_list.size(); ++i) {
+    uint64_t depth_bucket =
+        uint64_t((draw_list.worlds[i][3].z - min_z) * depth_scale);
+    uint64_t program = program_indices[programs[draw_list.states[i].shader]];
+    keys[i] = (program << 48) | (state_indices[states[i]] << 24) |
+              (depth_bucket << 8);
+  }
+  RadixSortIndices(keys, order);
+}
+
+void CommandListSample::ReleaseDrawChunk(DrawChunk* chunk) {
+  if (chunk->object_ubo_address) {
+    glMakeNamedBufferNonResidentNV(chunk->object_ubo);
+    chunk->object_ubo_address = 0;
+  }
+  if (chunk->object_ubo) {
+    glDeleteBuffers(1, &chunk->object_ubo);
+    chunk->object_ubo = 0;
+  }
+  chunk->object_ubo_size = 0;
+}
+
+int CommandListSample::unsorted_sequence_count() const {
+  int count = 0;
+  for (const auto& k_v : draw_chunks_) {
+    count += k_v.second.unsorted_sequence_count;
+  }
+  return count;
+}
+
+void CommandListSample::UpdateChangedObjectData() {
+  changed_object_count_ = 0;
+  if (object_change_list_.empty()) {
+    return;
+  }
+  // Only the changed slots are written, the token streams and indirect
+  // commands stay as they are.
+  for (RenderObject* object : object_change_list_.Take()) {
+    object->clear_dirty();
+    auto iter = object_data_slots_.find(object);
+    if (iter == object_data_slots_.end()) {
+      continue;
+    }
+    ++changed_object_count_;
+    DrawChunk* chunk = iter->second.chunk;
+    int draw_index = iter->second.draw_index;
+    DrawList& draw_list = chunk->draw_list;
+    draw_list.Update(draw_index);
+    chunk->bvh_stale = true;
+    PackedObjectData packed_object_data = PackObjectData(
+        draw_list.worlds[draw_index], draw_list.colors[draw_index]);
+    // Chunks and indirect data pending recompilation read the draw list
+    // anyway.
+    if (chunk->compiled && chunk->object_ubo) {
+      glNamedBufferSubData(
+          chunk->object_ubo,
+          chunk->draw_slots[draw_index] * sizeof(PackedObjectData),
+          sizeof(PackedObjectData), &packed_object_data);
+    }
+    int scene_index = chunk->scene_base + draw_index;
+    if (gpu_culling_.bounds_valid()) {
+      gpu_culling_.UpdateBounds(scene_index, draw_list.bounds[draw_index]);
+    }
+    if (multi_draw_indirect_data_.compiled &&
+        multi_draw_indirect_data_.object_ssbo) {
+      glNamedBufferSubData(multi_draw_indirect_data_.object_ssbo,
+                           scene_index * sizeof(PackedObjectData),
+                           sizeof(PackedObjectData), &packed_object_data);
+    }
+    if (basic_uniform_data_.valid) {
+      ObjectData& object_data = basic_uniform_data_.object_datas[scene_index];
+      object_data.M = draw_list.worlds[draw_index];
+      object_data.color = draw_list.colors[draw_index];
+      for (auto& changed_slots : basic_uniform_data_.changed_slots) {
+        changed_slots.push_back(scene_index);
       }
+    }
+  }
+}
 
-      // Set up draw command
-      if (object->mesh_renderer().mesh().indexed_draw()) {
-        uint header =
-            glGetCommandHeaderNV(GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV,
-                                 sizeof(DrawElementsInstancedCommandNV));
-        PushCommandToBuffer(
-            DrawElementsInstancedCommandNV{
-                header, object->mesh_renderer().mesh().draw_mode(),
-                (unsigned int)object->mesh_renderer().mesh().indices().size(),
-                1, 0, 0, 0},
-            &token_buffer);
-      } else {
-        uint header =
-            glGetCommandHeaderNV(GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV,
-                                 sizeof(DrawArraysInstancedCommandNV));
-        PushCommandToBuffer(
-            DrawArraysInstancedCommandNV{
-                header, object->mesh_renderer().mesh().draw_mode(),
-                (unsigned int)object->mesh_renderer().mesh().positions().size(),
-                1, 0, 0},
-            &token_buffer);
+void CommandListSample::RebuildSceneObjects() {
+  basic_uniform_data_.valid = false;
+  gpu_culling_.InvalidateBounds();
+  scene_objects_.clear();
+  scene_draw_count_ = 0;
+  for (auto& k_v : draw_chunks_) {
+    DrawChunk& chunk = k_v.second;
+    scene_objects_.insert(scene_objects_.end(), chunk.objects.begin(),
+                          chunk.objects.end());
+    chunk.scene_base = scene_draw_count_;
+    scene_draw_count_ += chunk.draw_list.size();
+  }
+}
+
+void CommandListSample::CompactBuffers() {
+  std::set<GLuint> relocated_buffers;
+  buffer_manager_->Compact(kCompactionBytesPerFrame, &relocated_buffers);
+  if (relocated_buffers.empty()) {
+    return;
+  }
+  // The vertex arrays cache bindings by buffer id, which deleted buffers
+  // hand back to glCreateBuffers.
+  shared_vertex_arrays_.ForgetBuffers(relocated_buffers);
+  for (auto& k_v : draw_chunks_) {
+    for (MeshRenderer* mesh_renderer : k_v.second.draw_list.mesh_renderers) {
+      mesh_renderer->ForgetBuffers(relocated_buffers);
+    }
+  }
+  // Only chunks with tokens pointing into the evacuated block recompile.
+  for (auto& k_v : draw_chunks_) {
+    DrawChunk& chunk = k_v.second;
+    for (GLuint buffer : relocated_buffers) {
+      if (chunk.buffers.count(buffer)) {
+        chunk.compiled = false;
+        break;
       }
     }
+  }
+  command_list_data_.draw_commands_compiled = false;
+  for (const DrawIndirectBatch& batch : multi_draw_indirect_data_.batches) {
+    if (relocated_buffers.count(batch.vertex_buffer) ||
+        relocated_buffers.count(batch.element_buffer)) {
+      multi_draw_indirect_data_.compiled = false;
+      break;
+    }
+  }
+}
 
-    if (last_state != -1) {
-      // record draw command
-      token_sequence.offsets.push_back(last_offset);
-      token_sequence.sizes.push_back(token_buffer.size() - last_offset);
-      token_sequence.states.push_back(last_state);
-      token_sequence.fbos.push_back(command_list_data_.fallback_framebuffer);
+void CommandListSample::UpdateMapStreaming() {
+  if (!map_streamer_) {
+    return;
+  }
+  std::vector<glm::vec3> focus_points{camera_.target()};
+  if (roaming_) {
+    // Prefetch the tiles the roaming camera reaches next.
+    for (float lookahead : kStreamLookaheadSeconds) {
+      glm::vec3 pos;
+      glm::vec3 dir;
+      ComputeCameraPosition(Time::time() + lookahead, points, times, tangents,
+                            pos, dir);
+      focus_points.push_back(pos + dir * camera_.distance());
     }
+  }
+  map_streamer_->Update(focus_points);
 
-    // Transfer data to buffer
-    if (command_list_data_.command_stream_buffer_size < token_buffer.size()) {
-      glNamedBufferData(command_list_data_.command_stream_buffer,
-                        token_buffer.size(), token_buffer.c_str(),
-                        GL_DYNAMIC_DRAW);
-      command_list_data_.command_stream_buffer_size = token_buffer.size();
-    } else {
-      glNamedBufferSubData(command_list_data_.command_stream_buffer, 0,
-                           token_buffer.size(), token_buffer.c_str());
+  std::vector<MapTileKey> loaded;
+  std::vector<MapTileKey> evicted;
+  map_streamer_->DrainUploads(buffer_manager_.get(), kStreamUploadBytesPerFrame,
+                              &loaded, &evicted);
+  if (loaded.empty() && evicted.empty()) {
+    return;
+  }
+  // Objects of evicted tiles are already destroyed, only their chunks are
+  // dropped. The other chunks keep their compiled token streams.
+  for (MapTileKey key : evicted) {
+    auto iter = draw_chunks_.find(key);
+    if (iter != draw_chunks_.end()) {
+      for (RenderObject* object : iter->second.draw_list.objects) {
+        object_data_slots_.erase(object);
+      }
+      ReleaseDrawChunk(&iter->second);
+      draw_chunks_.erase(iter);
     }
   }
-  command_list_data_.draw_commands_compiled = true;
+  for (MapTileKey key : loaded) {
+    DrawChunk& chunk = draw_chunks_[key];
+    for (auto& object : map_streamer_->tile_objects(key)) {
+      chunk.objects.push_back(object.get());
+    }
+    FlattenDrawChunk(&chunk);
+  }
+  RebuildSceneObjects();
+  command_list_data_.draw_commands_compiled = false;
+  multi_draw_indirect_data_.compiled = false;
+}
+
+void CommandListSample::CullScene() {
+  auto start = std::chrono::high_resolution_clock::now();
+  Frustum frustum = Frustum::FromMatrix(scene_data_.VP);
+  int visible_draws = 0;
+  for (auto& k_v : draw_chunks_) {
+    DrawChunk& chunk = k_v.second;
+    if (chunk.bvh_stale) {
+      chunk.bvh.Refit(chunk.draw_list.bounds);
+      chunk.bvh_stale = false;
+    }
+    chunk.visible_draws.clear();
+    chunk.bvh.Cull(frustum, &chunk.visible_draws);
+    // Tree order is spatial, draw list order switches programs less.
+    std::sort(chunk.visible_draws.begin(), chunk.visible_draws.end());
+    visible_draws += chunk.visible_draws.size();
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  cull_stats_.visible_draws = visible_draws;
+  cull_stats_.cull_ms =
+      std::chrono::duration_cast<us>(finish - start).count() * 0.001f;
+}
 
-  printf("total captured states: %d\n", state_caches_.size());
+void CommandListSample::UploadCullBounds() {
+  if (gpu_culling_.bounds_valid()) {
+    return;
+  }
+  std::vector<BoundingBox> bounds;
+  bounds.reserve(scene_draw_count_);
+  for (const auto& k_v : draw_chunks_) {
+    const DrawList& draw_list = k_v.second.draw_list;
+    bounds.insert(bounds.end(), draw_list.bounds.begin(),
+                  draw_list.bounds.end());
+  }
+  gpu_culling_.UploadBounds(bounds);
 }
 
 void CommandListSample::DrawSceneCommandToken() {
@@ -1057,40 +1717,310 @@ void CommandListSample::DrawSceneCommandToken() {
     return;
   }
 
+  // Draws culled in earlier frames stay NOP tokens until the stream is
+  // written again.
+  if (!gpu_culling() && command_list_data_.command_stream_culled) {
+    command_list_data_.draw_commands_compiled = false;
+  }
   CompileDrawCommandList();
+  if (gpu_culling()) {
+    UploadCullBounds();
+    gpu_culling_.CullTokens(
+        command_list_data_.command_stream_buffer, draw_view_,
+        command_list_data_.token_headers.header<NOPCommandNV>());
+    command_list_data_.command_stream_culled = true;
+  }
   {
     ProfileTimer timer("  Play draw commands");
     glDisable(GL_LINE_STIPPLE);
     // Play draw commands
-    if (!selective_draw_) {
-      glDrawCommandsStatesNV(command_list_data_.command_stream_buffer,
-                             command_list_data_.token_sequence.offsets.data(),
-                             command_list_data_.token_sequence.sizes.data(),
-                             command_list_data_.token_sequence.states.data(),
-                             command_list_data_.token_sequence.fbos.data(),
-                             command_list_data_.token_sequence.offsets.size());
-    } else {
-      int start =
-          glm::clamp<int>(selective_draw_start_, 0,
-                          command_list_data_.token_sequence.offsets.size() - 1);
-      int end =
-          glm::clamp<int>(selective_draw_start_ + selective_draw_count_, start,
-                          command_list_data_.token_sequence.offsets.size() - 1);
-      glDrawCommandsStatesNV(
-          command_list_data_.command_stream_buffer,
-          command_list_data_.token_sequence.offsets.data() + start,
-          command_list_data_.token_sequence.sizes.data() + start,
-          command_list_data_.token_sequence.states.data() + start,
-          command_list_data_.token_sequence.fbos.data() + start,
-          end - start + 1);
+    int start;
+    int count;
+    TokenSequenceRange(&start, &count);
+    glDrawCommandsStatesNV(
+        command_list_data_.command_stream_buffer,
+        command_list_data_.token_sequence.offsets.data() + start,
+        command_list_data_.token_sequence.sizes.data() + start,
+        command_list_data_.token_sequence.states.data() + start,
+        command_list_data_.token_sequence.fbos.data() + start, count);
+    if (command_list_data_.command_stream_fence) {
+      glDeleteSync(command_list_data_.command_stream_fence);
     }
+    command_list_data_.command_stream_fence =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
   }
 }
 
+void CommandListSample::TokenSequenceRange(int* start, int* count) const {
+  int sequence_count = command_list_data_.token_sequence.offsets.size();
+  if (!selective_draw_ || !sequence_count) {
+    *start = 0;
+    *count = sequence_count;
+    return;
+  }
+  *start = glm::clamp<int>(selective_draw_start_, 0, sequence_count - 1);
+  int end = glm::clamp<int>(selective_draw_start_ + selective_draw_count_,
+                            *start, sequence_count - 1);
+  *count = end - *start + 1;
+}
+
+void CommandListSample::CompileCommandList(int start, int count) {
+  CommandListExtensionData& data = command_list_data_;
+  if (data.command_list_compiled && data.command_list_start == start &&
+      data.command_list_count == count) {
+    return;
+  }
+
+  ProfileTimer timer("  compile command list");
+  // A compiled list is immutable, it has to be recreated.
+  if (data.command_list_) {
+    glDeleteCommandListsNV(1, &data.command_list_);
+  }
+  glCreateCommandListsNV(1, &data.command_list_);
+  glCommandListSegmentsNV(data.command_list_, 1);
+
+  // The list copies the tokens, they are read through the mapping.
+  std::vector<const void*> indirects(count);
+  for (int i = 0; i < count; ++i) {
+    indirects[i] = data.command_stream_mapped +
+                   data.token_sequence.offsets[start + i];
+  }
+  glListDrawCommandsStatesClientNV(
+      data.command_list_, 0, indirects.data(),
+      data.token_sequence.sizes.data() + start,
+      data.token_sequence.states.data() + start,
+      data.token_sequence.fbos.data() + start, count);
+  glCompileCommandListNV(data.command_list_);
+
+  data.command_list_compiled = true;
+  data.command_list_start = start;
+  data.command_list_count = count;
+}
+
 void CommandListSample::DrawSceneCommandList() {
   if (!command_list_supported_) {
+    // No command lists without the extensions, draw the same scene with the
+    // portable path instead.
+    DrawSceneMultiDrawIndirect();
+    return;
+  }
+
+  // The list copies the tokens, draws culled for kCommandToken would stay
+  // culled in it.
+  if (command_list_data_.command_stream_culled) {
+    command_list_data_.draw_commands_compiled = false;
+  }
+  CompileDrawCommandList();
+  int start;
+  int count;
+  TokenSequenceRange(&start, &count);
+  CompileCommandList(start, count);
+  {
+    ProfileTimer timer("  Call command list");
+    glDisable(GL_LINE_STIPPLE);
+    glCallCommandListNV(command_list_data_.command_list_);
+  }
+}
+
+void CommandListSample::CompileMultiDrawIndirect() {
+  MultiDrawIndirectData& data = multi_draw_indirect_data_;
+  if (data.compiled) {
+    return;
+  }
+
+  ProfileTimer timer("  record indirect commands");
+  std::vector<GLuint> programs = ResolvePrograms("_indirect");
+
+  // Everything one multi draw call cannot vary per draw: program, fixed
+  // function state, vertex format, draw mode, line width, buffer bindings and
+  // index type.
+  using BatchKey = std::tuple<GLuint, uint8_t, GLint, GLushort, uint16_t,
+                              GLenum, float, GLuint, GLuint, GLenum>;
+  // A draw of a chunk draw list, the scene index selects its object data.
+  struct IndirectDraw {
+    const DrawList* draw_list;
+    int index;
+    GLuint scene_index;
+  };
+  std::map<BatchKey, std::vector<IndirectDraw>> batch_draws;
+  for (const auto& k_v : draw_chunks_) {
+    const DrawChunk& chunk = k_v.second;
+    const DrawList& draw_list = chunk.draw_list;
+    for (int i = 0; i < draw_list.size(); ++i) {
+      const DrawState& state = draw_list.states[i];
+      GLuint program = programs[state.shader];
+      if (!draw_list.counts[i] || !program) {
+        continue;
+      }
+      const MeshRenderer& mesh_renderer = *draw_list.mesh_renderers[i];
+      float line_width = draw_list.command_line_widths[i] > 0.0f
+                             ? draw_list.command_line_widths[i]
+                             : 1.0f;
+      batch_draws[BatchKey(program, state.line_stipple, state.stipple_factor,
+                           state.stipple_pattern, state.vertex_attrib_mask,
+                           state.draw_mode, line_width,
+                           mesh_renderer.vbo()->buffer_id(),
+                           draw_list.indexed[i]
+                               ? mesh_renderer.ibo()->buffer_id()
+                               : 0,
+                           draw_list.indexed[i] ? mesh_renderer.index_type()
+                                                : 0)]
+          .push_back({&draw_list, i, GLuint(chunk.scene_base + i)});
+    }
+  }
+
+  std::string commands;
+  std::vector<common::CullDraw> cull_draws;
+  data.batches.clear();
+  for (const auto& k_v : batch_draws) {
+    const std::vector<IndirectDraw>& draws = k_v.second;
+    const IndirectDraw& first = draws[0];
+    DrawIndirectBatch batch;
+    batch.state = CapturedStateCache::FromDrawState(
+        first.draw_list->states[first.index], std::get<0>(k_v.first));
+    batch.draw_mode = std::get<5>(k_v.first);
+    batch.line_width = std::get<6>(k_v.first);
+    batch.vertex_stride =
+        first.draw_list->mesh_renderers[first.index]->VertexAttribStride();
+    batch.vertex_buffer = std::get<7>(k_v.first);
+    batch.element_buffer = std::get<8>(k_v.first);
+    batch.index_type = std::get<9>(k_v.first);
+    batch.command_offset = commands.size();
+    batch.command_count = draws.size();
+
+    // Meshes are addressed inside the shared buffers like
+    // MeshRenderer::RenderSharedVertexArray does, the base instance selects
+    // the PackedObjectData.
+    for (const IndirectDraw& draw : draws) {
+      size_t command_offset = commands.size();
+      const MeshRenderer& mesh_renderer =
+          *draw.draw_list->mesh_renderers[draw.index];
+      GLuint count = draw.draw_list->counts[draw.index];
+      GLuint base_vertex = mesh_renderer.vbo()->offset() / batch.vertex_stride;
+      if (batch.element_buffer) {
+        PushCommandToBuffer(
+            DrawElementsIndirectCommand{
+                count, 1,
+                (GLuint)(mesh_renderer.ibo()->offset() /
+                         mesh_renderer.index_size()),
+                (GLint)base_vertex, draw.scene_index},
+            &commands);
+      } else {
+        PushCommandToBuffer(
+            DrawArraysIndirectCommand{count, 1, base_vertex,
+                                      draw.scene_index},
+            &commands);
+      }
+      // Culling compacts the visible commands to the start of the batch.
+      common::CullDraw cull_draw = {};
+      cull_draw.offset = batch.command_offset / sizeof(GLuint);
+      cull_draw.word_count =
+          (commands.size() - command_offset) / sizeof(GLuint);
+      cull_draw.bounds_index = draw.scene_index;
+      cull_draw.batch = data.batches.size();
+      if (batch.element_buffer) {
+        SetCullDrawLods(mesh_renderer,
+                        offsetof(DrawElementsIndirectCommand, count),
+                        offsetof(DrawElementsIndirectCommand, first_index),
+                        &cull_draw);
+      } else {
+        SetCullDrawLods(mesh_renderer,
+                        offsetof(DrawArraysIndirectCommand, count),
+                        offsetof(DrawArraysIndirectCommand, first),
+                        &cull_draw);
+      }
+      memcpy(cull_draw.words, commands.data() + command_offset,
+             commands.size() - command_offset);
+      cull_draws.push_back(cull_draw);
+    }
+    data.batches.push_back(batch);
+  }
+
+  if (!commands.empty()) {
+    UploadBufferData(&data.indirect_buffer, &data.indirect_buffer_size,
+                     commands.data(), commands.size());
+  }
+  if (gpu_culling_.valid()) {
+    gpu_culling_.SetIndirectDraws(cull_draws, data.batches.size(),
+                                  commands.size());
+  }
+  if (scene_draw_count_) {
+    std::vector<PackedObjectData> packed_object_datas;
+    packed_object_datas.reserve(scene_draw_count_);
+    for (const auto& k_v : draw_chunks_) {
+      const DrawList& draw_list = k_v.second.draw_list;
+      for (int i = 0; i < draw_list.size(); ++i) {
+        packed_object_datas.push_back(
+            PackObjectData(draw_list.worlds[i], draw_list.colors[i]));
+      }
+    }
+    UploadBufferData(&data.object_ssbo, &data.object_ssbo_size,
+                     packed_object_datas.data(),
+                     packed_object_datas.size() * sizeof(PackedObjectData));
+  }
+  data.compiled = true;
+}
+
+void CommandListSample::DrawSceneMultiDrawIndirect() {
+  CompileMultiDrawIndirect();
+  const MultiDrawIndirectData& data = multi_draw_indirect_data_;
+  if (data.batches.empty()) {
     return;
   }
+
+  // Culled batches draw the number of visible commands the culling pass
+  // wrote, read on the GPU.
+  bool gpu_culled = gpu_culling();
+  if (gpu_culled) {
+    UploadCullBounds();
+    gpu_culling_.CullIndirect(draw_view_);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu_culling_.compacted_buffer());
+    glBindBuffer(GL_PARAMETER_BUFFER, gpu_culling_.count_buffer());
+  } else {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, data.indirect_buffer);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture_[0]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_OBJECT, data.object_ssbo);
+  shared_vertex_arrays_.ResetBinding();
+
+  for (size_t i = 0; i < data.batches.size(); ++i) {
+    const DrawIndirectBatch& batch = data.batches[i];
+    gl_context_.glUseProgram(batch.state.program);
+    if (batch.state.enable_line_stipple) {
+      glEnable(GL_LINE_STIPPLE);
+      glLineStipple(batch.state.stipple_factor, batch.state.stipple_pattern);
+    } else {
+      glDisable(GL_LINE_STIPPLE);
+    }
+    glLineWidth(batch.line_width);
+    shared_vertex_arrays_.Bind(batch.state.vertex_attrib_mask,
+                               batch.vertex_stride, batch.vertex_buffer,
+                               batch.element_buffer);
+
+    const void* indirect = reinterpret_cast<const void*>(batch.command_offset);
+    GLintptr count_offset = i * sizeof(GLuint);
+    if (gpu_culled && batch.element_buffer) {
+      glMultiDrawElementsIndirectCount(batch.draw_mode, batch.index_type,
+                                       indirect, count_offset,
+                                       batch.command_count, 0);
+    } else if (gpu_culled) {
+      glMultiDrawArraysIndirectCount(batch.draw_mode, indirect, count_offset,
+                                     batch.command_count, 0);
+    } else if (batch.element_buffer) {
+      glMultiDrawElementsIndirect(batch.draw_mode, batch.index_type, indirect,
+                                  batch.command_count, 0);
+    } else {
+      glMultiDrawArraysIndirect(batch.draw_mode, indirect, batch.command_count,
+                                0);
+    }
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindBuffer(GL_PARAMETER_BUFFER, 0);
+  glDisable(GL_LINE_STIPPLE);
+  glLineWidth(1.0f);
 }
 
 void CommandListSample::ResizeCommandListRenderbuffers(int w, int h) {
@@ -1134,13 +2064,14 @@ void CommandListSample::ResizeCommandListRenderbuffers(int w, int h) {
   glMakeTextureHandleResidentARB(command_list_data_.color_texture_handle);
   glMakeTextureHandleResidentARB(
       command_list_data_.depth_stencil_texture_handle);
+
+  // The compiled list captured the old attachments.
+  command_list_data_.command_list_compiled = false;
 }
 
 void CommandListSample::InitializeCommandListResouce() {
-  glGenBuffers(1, &command_list_data_.command_stream_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, command_list_data_.command_stream_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
   glGenFramebuffers(1, &command_list_data_.fallback_framebuffer);
+  command_list_data_.token_headers = ResolveCommandTokenHeaders();
 
   ResizeCommandListRenderbuffers(width, height);
 }
@@ -1151,36 +2082,67 @@ void CommandListSample::FinalizeCommandListResouce() {
   glDeleteTextures(1, &command_list_data_.depth_stencil_texture);
 
   std::vector<GLuint> all_cached_states;
-  std::transform(state_caches_.begin(), state_caches_.end(),
-                 std::back_inserter(all_cached_states),
-                 [](const CaptureStateData& capture_state) {
-                   return capture_state.state_object;
-                 });
+  for (const auto& k_v : state_caches_) {
+    all_cached_states.push_back(k_v.second.state_object);
+  }
 
   glDeleteStatesNV(all_cached_states.size(), all_cached_states.data());
 
+  for (auto& k_v : draw_chunks_) {
+    ReleaseDrawChunk(&k_v.second);
+  }
+
+  if (command_list_data_.command_list_) {
+    glDeleteCommandListsNV(1, &command_list_data_.command_list_);
+  }
+  if (command_list_data_.command_stream_fence) {
+    glDeleteSync(command_list_data_.command_stream_fence);
+  }
+  if (command_list_data_.command_stream_buffer) {
+    glUnmapNamedBuffer(command_list_data_.command_stream_buffer);
+    glDeleteBuffers(1, &command_list_data_.command_stream_buffer);
+  }
+
   glMakeTextureHandleNonResidentARB(command_list_data_.color_texture_handle);
   glMakeTextureHandleNonResidentARB(
       command_list_data_.depth_stencil_texture_handle);
 }
 
 GLuint CommandListSample::CaptureState(const CapturedStateCache& state_cache) {
-  auto iter =
-      std::find_if(state_caches_.begin(), state_caches_.end(),
-                   [&state_cache](const CaptureStateData& capture_state) {
-                     return capture_state.state_cached == state_cache;
-                   });
+  auto iter = state_caches_.find(state_cache);
   if (iter != state_caches_.end()) {
-    return iter->state_object;
+    ++state_cache_stats_.hits;
+    return iter->second.state_object;
   }
+  ++state_cache_stats_.misses;
   GLuint state_object;
   glCreateStatesNV(1, &state_object);
+  // ApplyState sets up the vertex format of the bound vertex array, keep it
+  // off the ones used for drawing.
+  glBindVertexArray(0);
+  shared_vertex_arrays_.ResetBinding();
   state_cache.ApplyState();
   glStateCaptureNV(state_object, state_cache.base_draw_mode);
-  state_caches_.push_back(CaptureStateData{state_cache, state_object});
+  state_caches_.emplace(
+      state_cache,
+      CaptureStateData{state_cache, state_object, state_cache_generation_});
+  ++state_cache_stats_.created;
+  command_list_data_.command_list_compiled = false;
   return state_object;
 }
 
+size_t CommandListSample::CapturedStateCacheHash::operator()(
+    const CapturedStateCache& state_cache) const {
+  // FNV-1a
+  const unsigned char* bytes =
+      reinterpret_cast<const unsigned char*>(&state_cache);
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < sizeof(CapturedStateCache); ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
 void CommandListSample::CapturedStateCache::ApplyState() const {
   glUseProgram(program);
   if (enable_line_stipple) {
@@ -1193,5 +2155,18 @@ void CommandListSample::CapturedStateCache::ApplyState() const {
   MeshRenderer::SetupVertexAttribFormat(vertex_attrib_mask);
 }
 
+CommandListSample::CapturedStateCache
+CommandListSample::CapturedStateCache::FromDrawState(
+    const DrawState& draw_state, GLuint program) {
+  CapturedStateCache state_cache;
+  state_cache.base_draw_mode = GetBaseDrawMode(draw_state.draw_mode);
+  state_cache.program = program;
+  state_cache.enable_line_stipple = draw_state.line_stipple;
+  state_cache.stipple_factor = draw_state.stipple_factor;
+  state_cache.stipple_pattern = draw_state.stipple_pattern;
+  state_cache.vertex_attrib_mask = draw_state.vertex_attrib_mask;
+  return state_cache;
+}
+
 #undef min
 #undef max
@@ -2,8 +2,10 @@
 #include <map>
 #include <memory>
 #include <random>
+#include <set>
 #include <stack>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -11,13 +13,20 @@
 #include "nvgl/programmanager_gl.hpp"
 
 #include "app/common.h"
+#include "app/draw_list.h"
+#include "app/extension_command_list.h"
+#include "app/gpu_culling.h"
 #include "app/RenderObject.h"
+#include "app/map_streamer.h"
 #include "core/Texture2D.h"
 #include "core/Window.h"
+#include "core/bvh.h"
 #include "core/camera.h"
 #include "core/mesh_renderer.h"
 #include "core/shader_manager.h"
 #include "core/opengl_context.h"
+#include "core/persistent_ring_buffer.h"
+#include "core/task_scheduler.h"
 
 class CommandListSample : public Window {
  public:
@@ -35,6 +44,7 @@ class CommandListSample : public Window {
   void DrawSceneBasicUniformBuffer();
   void DrawSceneCommandToken();
   void DrawSceneCommandList();
+  void DrawSceneMultiDrawIndirect();
   
   void InitializeCommandListResouce();
   void FinalizeCommandListResouce();
@@ -46,11 +56,45 @@ class CommandListSample : public Window {
   struct CapturedStateCache;
   GLuint CaptureState(const CapturedStateCache& state_cache);
 
+  struct DrawChunk;
   void CompileDrawCommandList();
-  void CollectRenderObjectData(
-      std::vector<common::ObjectData>& object_datas,
-      std::vector<RenderObject*>& real_render_objects,
-      std::vector<CapturedStateCache>& render_object_states);
+  // Returns the mapped command stream buffer with at least |size| bytes,
+  // once the GPU no longer reads it.
+  char* MapCommandStreamBuffer(size_t size);
+  void CompileCommandList(int start, int count);
+  // Part of the token sequence to draw, all of it unless selective_draw_.
+  void TokenSequenceRange(int* start, int* count) const;
+  void CompileMultiDrawIndirect();
+  void CompileDrawChunk(DrawChunk* chunk);
+  // Orders the draws of |draw_list| by a (program, state, depth bucket) key
+  // so draws sharing a state object become contiguous token sequences.
+  void SortDrawsByState(const DrawList& draw_list,
+                        const std::vector<GLuint>& programs,
+                        const std::vector<GLuint>& states,
+                        std::vector<uint32_t>* order);
+  // Flattens chunk->objects into chunk->draw_list.
+  void FlattenDrawChunk(DrawChunk* chunk);
+  void ReleaseDrawChunk(DrawChunk* chunk);
+  // Sum of DrawChunk::unsorted_sequence_count.
+  int unsorted_sequence_count() const;
+  void UpdateMapStreaming();
+  // Fills DrawChunk::visible_draws from the frustum of scene_data_.VP.
+  void CullScene();
+  // Whether the draw commands are culled by gpu_culling_.
+  bool gpu_culling() const {
+    return gpu_culling_enabled_ && gpu_culling_.valid();
+  }
+  // Uploads the bounds of all draws to gpu_culling_ unless they are current.
+  void UploadCullBounds();
+  void BeginMeshRendering();
+  void CompactBuffers();
+  void RebuildSceneObjects();
+  // Writes the ObjectData of the objects in object_change_list_ to their
+  // slots.
+  void UpdateChangedObjectData();
+  // Program of each DrawList shader name with |suffix| appended, indexed by
+  // DrawState::shader.
+  std::vector<GLuint> ResolvePrograms(const std::string& suffix) const;
 
   common::SceneData scene_data_;
   GLuint scene_ubo_;
@@ -60,9 +104,18 @@ class CommandListSample : public Window {
   GLuint material_ubo_;
   GLuint64 material_ubo_address_;
 
-  GLuint object_ubo_;
-  GLuint64 object_ubo_address_;
-  int object_ubo_size_= 0;
+  // Per frame object data of kBasicUniformBuffer.
+  std::unique_ptr<PersistentRingBuffer> object_ring_buffer_;
+  // Object data of kBasicUniformBuffer in scene draw order, collected when
+  // the scene changes.
+  struct BasicUniformData {
+    bool valid = false;
+    std::vector<common::ObjectData> object_datas;
+    // Per ring region, the slots changed since the region was last written,
+    // all slots when full_upload is set.
+    std::vector<std::vector<int>> changed_slots;
+    std::vector<bool> full_upload;
+  } basic_uniform_data_;
 
   GLuint texture_[2];
   GLuint64 texture_address_[2];
@@ -72,6 +125,7 @@ class CommandListSample : public Window {
     kBasicUniformBuffer,
     kCommandToken,
     kCommandList,
+    kMultiDrawIndirect,
     kMethodCount,
   } draw_method_ = kCommandToken;
 
@@ -100,15 +154,35 @@ class CommandListSample : public Window {
     }
 
     void ApplyState() const;
+
+    static CapturedStateCache FromDrawState(const DrawState& draw_state,
+                                            GLuint program);
   };
 
 #pragma pack(pop)
 
+  // Hashes the packed bytes, matching the bit wise operator==.
+  struct CapturedStateCacheHash {
+    size_t operator()(const CapturedStateCache& state_cache) const;
+  };
+
   struct CaptureStateData {
     CapturedStateCache state_cached;
     GLuint state_object;
+    // Value of state_cache_generation_ when the token streams last used it.
+    uint64_t last_used_generation = 0;
+  };
+
+  struct StateCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    int created = 0;
+    int collected = 0;
   };
 
+  // Deletes state objects the token streams stopped using a while ago.
+  void CollectUnusedStates();
+
   struct CommandListExtensionData {
     // resizes
     GLuint fallback_framebuffer = 0;
@@ -122,29 +196,155 @@ class CommandListSample : public Window {
     GLuint depth_stencil_texture = 0;
     GLuint64 depth_stencil_texture_handle = 0;
 
+    CommandTokenHeaders token_headers;
     bool draw_commands_compiled = false;
+    // Persistently mapped, the concatenated chunk streams are written to it
+    // directly. command_stream_buffer_size is its capacity.
     GLuint command_stream_buffer = 0;
     uint64_t command_stream_buffer_size = 0;
-    std::string command_stream_buffer_cpu_;
+    char* command_stream_mapped = nullptr;
+    // Signaled when the last glDrawCommandsStatesNV reading it is done.
+    GLsync command_stream_fence = nullptr;
+    // Set once gpu_culling_ rewrote draw tokens of the stream, until the
+    // tokens as compiled are written again.
+    bool command_stream_culled = false;
     NVTokenSequence token_sequence;
     NVTokenSequence token_sequence_address;
 
-    GLuint command_list_;
+    // Compiled from token_sequence[command_list_start, +command_list_count),
+    // recreated when the tokens, the framebuffer or the states change.
+    GLuint command_list_ = 0;
+    bool command_list_compiled = false;
+    int command_list_start = 0;
+    int command_list_count = 0;
   } command_list_data_;
 
+  // Token stream and object UBO of one map tile, compiled on its own so that
+  // streaming a tile in or out only recompiles that tile. The token streams
+  // of all chunks are concatenated into command_stream_buffer.
+  struct DrawChunk {
+    // Roots of the object trees, owned by render_objects_ or the streamer.
+    std::vector<RenderObject*> objects;
+    DrawList draw_list;
+    // Index of the first draw of the chunk in scene draw order, the order of
+    // the indirect object data and of kBasicUniformBuffer.
+    int scene_base = 0;
+    bool compiled = false;
+    std::string token_buffer;
+    // Offsets relative to token_buffer.
+    NVTokenSequence token_sequence;
+
+    GLuint object_ubo = 0;
+    GLuint64 object_ubo_address = 0;
+    int object_ubo_size = 0;
+
+    // Vertex and index buffers the tokens hold addresses of.
+    std::set<GLuint> buffers;
+    // Sequences the chunk would need in collection order, to report what
+    // sorting the draws saves.
+    int unsorted_sequence_count = 0;
+    // Slot in object_ubo of each draw of draw_list.
+    std::vector<uint32_t> draw_slots;
+    // Draw tokens for gpu_culling_, offsets relative to token_buffer and
+    // bounds indices to draw_list.
+    std::vector<common::CullDraw> cull_draws;
+
+    // Over draw_list.bounds, refit when objects moved.
+    BoundingVolumeHierarchy bvh;
+    bool bvh_stale = false;
+    // Draws of draw_list in the frustum in draw list order, used by kBasic and
+    // kBasicUniformBuffer when frustum_culling_ is set.
+    std::vector<uint32_t> visible_draws;
+  };
+  // Holds the whole map when it is not streamed.
+  static constexpr MapTileKey kStaticDrawChunk = ~MapTileKey(0);
+  std::map<MapTileKey, DrawChunk> draw_chunks_;
+
+  // Draws sharing program, fixed function state and buffer bindings, issued
+  // with one glMultiDraw*Indirect call.
+  struct DrawIndirectBatch {
+    CapturedStateCache state;
+    GLenum draw_mode = 0;
+    float line_width = 1.0f;
+    uint32_t vertex_stride = 0;
+    GLuint vertex_buffer = 0;
+    // 0 for non indexed draws.
+    GLuint element_buffer = 0;
+    GLenum index_type = 0;
+    GLintptr command_offset = 0;
+    GLsizei command_count = 0;
+  };
+
+  struct MultiDrawIndirectData {
+    bool compiled = false;
+    std::vector<DrawIndirectBatch> batches;
+    // DrawElementsIndirectCommand / DrawArraysIndirectCommand of all batches.
+    GLuint indirect_buffer = 0;
+    int indirect_buffer_size = 0;
+    // ObjectData indexed by the base instance of the commands.
+    GLuint object_ssbo = 0;
+    int object_ssbo_size = 0;
+  } multi_draw_indirect_data_;
+
   bool command_list_supported_ = false;
 
   bool roaming_ = false;
+  // Draw kBasic and kBasicUniformBuffer through one vertex array per vertex
+  // format instead of one per mesh.
+  bool share_vertex_arrays_ = true;
+  SharedVertexArrays shared_vertex_arrays_;
+  bool sort_draws_by_state_ = true;
+  bool frustum_culling_ = true;
+  struct CullStats {
+    int visible_draws = 0;
+    float cull_ms = 0.0f;
+  } cull_stats_;
+  // Frustum and occlusion culling of kCommandToken and kMultiDrawIndirect on
+  // the GPU.
+  bool gpu_culling_enabled_ = true;
+  bool occlusion_culling_ = true;
+  GpuCulling gpu_culling_;
+  // Draw lines and stripes at the level of detail of their screen size, in
+  // kBasic and kBasicUniformBuffer and through GPU culling.
+  bool mesh_lod_ = true;
+  // Set in onUpdate.
+  GpuCulling::View draw_view_;
   bool selective_draw_ = false;
   int selective_draw_start_ = 0;
   int selective_draw_count_ = 0;
   float camera_speed_ = 100.0f;
 
+  // Where the ObjectData of each drawn object lives, so changes are written
+  // in place without recompiling token streams or indirect commands.
+  struct ObjectDataSlot {
+    DrawChunk* chunk = nullptr;
+    // In chunk->draw_list.
+    int draw_index = -1;
+  };
+  // Declared before the objects, they leave it when destroyed.
+  ObjectChangeList object_change_list_;
+  std::unordered_map<const RenderObject*, ObjectDataSlot> object_data_slots_;
+  int changed_object_count_ = 0;
+
   std::unique_ptr<BufferManager> buffer_manager_;
+  std::unique_ptr<TaskScheduler> task_scheduler_;
+  // Set when assets/map_tiles holds a tiled map, render_objects_ is empty then.
+  std::unique_ptr<MapStreamer> map_streamer_;
   OpenGLContext gl_context_;
   std::vector<std::unique_ptr<RenderObject>> render_objects_;
+  // What mesh optimization did to render_objects_.
+  MeshOptimizeStats mesh_optimize_stats_;
+  // Objects of render_objects_ or of all resident tiles.
+  std::vector<RenderObject*> scene_objects_;
+  // Sum of the draw list sizes of all chunks.
+  int scene_draw_count_ = 0;
 
-  std::vector<CaptureStateData> state_caches_;
+  std::unordered_map<CapturedStateCache, CaptureStateData,
+                     CapturedStateCacheHash>
+      state_caches_;
+  // Counts CompileDrawCommandList calls that changed the token streams.
+  uint64_t state_cache_generation_ = 0;
+  StateCacheStats state_cache_stats_;
 
   Camera camera_;
   ShaderManager shader_manager_;
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 /*
    base64.cpp and base64.h
@@ -30,4 +33,47 @@
 */
 
 std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len);
-std::string base64_decode(std::string const& encoded_string);
\ No newline at end of file
+std::string base64_decode(std::string const& encoded_string);
+
+/*
+   Table driven decoder with SSSE3/AVX2 fast paths, the variant is picked once
+   at runtime from the cpu features. Decoding stops at the first '=' or
+   non-base64 character, same as base64_decode() above.
+*/
+
+enum Base64DecoderKind {
+  kBase64Scalar = 0,
+  kBase64SSSE3,
+  kBase64AVX2,
+};
+
+Base64DecoderKind base64_best_decoder();
+
+// Upper bound of the decoded size, the SIMD paths may use all of it as
+// scratch space so output buffers must be at least this large.
+inline size_t base64_decoded_max_size(size_t in_len) {
+  return (in_len + 3) / 4 * 3;
+}
+
+// Decodes into |out| and returns the number of bytes written.
+size_t base64_decode(char const* encoded, size_t in_len, unsigned char* out);
+size_t base64_decode(char const* encoded, size_t in_len, unsigned char* out,
+                     Base64DecoderKind kind);
+
+// Decodes straight into the storage of |out|, which is resized to the number
+// of whole elements decoded.
+template <typename T>
+void base64_decode(char const* encoded, size_t in_len, std::vector<T>* out) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "base64_decode target must be trivially copyable");
+  size_t max_size = base64_decoded_max_size(in_len);
+  out->resize((max_size + sizeof(T) - 1) / sizeof(T));
+  size_t size = base64_decode(encoded, in_len,
+                              reinterpret_cast<unsigned char*>(out->data()));
+  out->resize(size / sizeof(T));
+}
+
+template <typename T>
+void base64_decode(std::string const& encoded_string, std::vector<T>* out) {
+  base64_decode(encoded_string.data(), encoded_string.size(), out);
+}
\ No newline at end of file
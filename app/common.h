@@ -9,6 +9,31 @@
 #define UBO_OBJECT 1
 #define UBO_MATERIAL 2
 
+#define SSBO_OBJECT 3
+
+// GPU culling, see cull_draws.comp.glsl, compact_draws.comp.glsl and
+// depth_pyramid.comp.glsl.
+#define SSBO_CULL_BOUNDS 4
+#define SSBO_CULL_DRAWS 5
+#define SSBO_CULL_OUTPUT 6
+#define SSBO_CULL_COUNTS 7
+#define SSBO_CULL_VISIBILITY 8
+#define SSBO_CULL_COMMANDS 9
+#define SSBO_CULL_BATCHES 10
+#define TEXTURE_CULL_DEPTH 1
+#define IMAGE_DEPTH_SOURCE 0
+#define IMAGE_DEPTH_TARGET 1
+#define CULL_GROUP_SIZE 64
+// Words of the largest command CullDraw holds.
+#define CULL_COMMAND_WORDS 8
+#define DEPTH_PYRAMID_GROUP_SIZE 8
+
+// Levels of detail of a mesh including the full one, see core/mesh_lod.h.
+#define MAX_MESH_LODS 4
+
+// PackedObjectData entries one object uniform block window holds, 64KB.
+#define PACKED_OBJECT_BLOCK_SIZE 1024
+
 #if defined(GL_core_profile) || defined(GL_compatibility_profile) || defined(GL_es_profile)
 
 #ifdef ENABLE_BINDLESS_TEXTURE
@@ -36,6 +61,53 @@ struct ObjectData {
   vec4 color;
 };
 
+// ObjectData in 64 bytes instead of 80, a quarter of the 256 byte aligned
+// stride of one ObjectData per uniform buffer range: the world matrix without
+// its constant (0, 0, 0, 1) row, stored as rows, and an RGBA8 color.
+struct PackedObjectData {
+  vec4 rows[3];
+  uint color;
+  uint padding0;
+  uint padding1;
+  uint padding2;
+};
+
+// World space bounds of a draw, w unused.
+struct CullBounds {
+  vec4 box_min;
+  vec4 box_max;
+};
+
+// A draw command the culling pass writes back, visible or not: a draw token
+// of a command stream or a command of an indirect buffer.
+struct CullDraw {
+  // In words of the buffer written, for indirect commands where the
+  // commands of their batch start.
+  uint offset;
+  uint word_count;
+  // In the CullBounds of the scene.
+  uint bounds_index;
+  // Indirect commands only, the batch whose count the command adds to.
+  uint batch;
+  // The command as compiled, word_count used.
+  uint words[CULL_COMMAND_WORDS];
+  // Levels of detail, lod_count of them: the range each level draws,
+  // relative to level 0, and the largest screen size it is drawn at. The
+  // range is written to words first_word and count_word of the command.
+  uint lod_count;
+  uint first_word;
+  uint count_word;
+  uint lod_firsts[MAX_MESH_LODS];
+  uint lod_counts[MAX_MESH_LODS];
+  float lod_screen_sizes[MAX_MESH_LODS];
+};
+
+// The draws of an indirect batch, consecutive in the CullDraw array.
+struct CullBatch {
+  uint first_draw;
+  uint draw_count;
+};
+
 struct MaterialData {
   sampler2D texture;
 };
@@ -54,13 +126,61 @@ layout(std140,binding=UBO_SCENE) uniform sceneBuffer {
   SceneData   scene;
 };
 
+#ifdef PACKED_OBJECT_DATA
+ObjectData UnpackObjectData(PackedObjectData packed) {
+  ObjectData data;
+  data.M = transpose(mat4(packed.rows[0], packed.rows[1], packed.rows[2],
+                          vec4(0.0, 0.0, 0.0, 1.0)));
+  data.color = unpackUnorm4x8(packed.color);
+  return data;
+}
+#define OBJECT_DATA PackedObjectData
+#define OBJECT_ACCESS(data) UnpackObjectData(data)
+#else
+#define OBJECT_DATA ObjectData
+#define OBJECT_ACCESS(data) data
+#endif
+
+#if defined(ENABLE_DRAW_INDIRECT) || defined(PACKED_OBJECT_DATA)
+// The object is selected by the base instance of the draw.
+#define OBJECT_INDEXED
+#ifdef _VERTEX_SHADER_
+flat out int object_index;
+#define OBJECT_INDEX gl_BaseInstance
+#else
+flat in int object_index;
+#define OBJECT_INDEX object_index
+#endif
+#endif
+
+#ifdef ENABLE_DRAW_INDIRECT
+// Multi draw indirect: the objects of all draws in one buffer.
+layout(std430,binding=SSBO_OBJECT) readonly buffer objectsBuffer {
+  OBJECT_DATA  objects[];
+};
+#define object OBJECT_ACCESS(objects[OBJECT_INDEX])
+#elif defined(PACKED_OBJECT_DATA)
+// Command tokens: a window of PACKED_OBJECT_BLOCK_SIZE objects per uniform
+// address token.
+layout(std140,binding=UBO_OBJECT) uniform objectBuffer {
+  PackedObjectData  objects[PACKED_OBJECT_BLOCK_SIZE];
+};
+#define object OBJECT_ACCESS(objects[OBJECT_INDEX])
+#else
 layout(std140,binding=UBO_OBJECT) uniform objectBuffer {
   ObjectData  object;
 };
+#endif
 
+#ifdef ENABLE_BINDLESS_TEXTURE
 layout(std140,binding=UBO_MATERIAL) uniform materialBuffer {
   MaterialData  material;
 };
+#define MATERIAL_TEXTURE material.texture
+#else
+layout(binding=0) uniform sampler2D tex0;
+#define MATERIAL_TEXTURE tex0
+#endif
 
 #endif
 
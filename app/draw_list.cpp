@@ -0,0 +1,128 @@
+#include "app/draw_list.h"
+
+#include <unordered_map>
+
+namespace {
+
+std::vector<std::string>& ShaderNames() {
+  static std::vector<std::string> names;
+  return names;
+}
+
+uint16_t InternShaderName(const std::string& name) {
+  static std::unordered_map<std::string, uint16_t> ids;
+  auto iter = ids.find(name);
+  if (iter != ids.end()) {
+    return iter->second;
+  }
+  uint16_t id = ShaderNames().size();
+  ShaderNames().push_back(name);
+  ids[name] = id;
+  return id;
+}
+
+// Color of a drawable leaf, false for objects that draw nothing themselves.
+struct ColorVisitor {
+  glm::vec4* color;
+
+  bool operator()(const LineObject* object) const {
+    *color = object->color();
+    return true;
+  }
+  bool operator()(const DashedStripeObject* object) const {
+    *color = object->color();
+    return true;
+  }
+  bool operator()(const SimpleTexturedObject* object) const {
+    *color = glm::vec4(object->alpha());
+    return true;
+  }
+  bool operator()(const RenderObject* object) const { return false; }
+};
+
+bool GetColor(const RenderObject* object, glm::vec4* color) {
+  return VisitRenderObject(object, ColorVisitor{color});
+}
+
+}  // namespace
+
+void DrawList::Append(RenderObject* root) {
+  if (root->kind() == kRoadElementObject) {
+    for (const auto& sub_mesh :
+         static_cast<const RoadElementObject*>(root)->sub_meshes()) {
+      Append(sub_mesh.get());
+    }
+    return;
+  }
+  glm::vec4 color;
+  if (!GetColor(root, &color)) {
+    return;
+  }
+  MeshRenderer* mesh_renderer =
+      const_cast<MeshRenderer*>(&root->mesh_renderer());
+  const Mesh& mesh = mesh_renderer->mesh();
+
+  DrawState state;
+  state.shader = InternShaderName(root->shader());
+  state.vertex_attrib_mask = mesh_renderer->vertex_attrib_mask();
+  state.draw_mode = mesh.draw_mode();
+  float line_width = 0.0f;
+  float command_line_width = 0.0f;
+  if (root->kind() == kLineObject) {
+    const LineStyle& line_style =
+        static_cast<const LineObject*>(root)->line_style();
+    line_width = line_style.line_width;
+    command_line_width = glm::clamp(line_width, 0.5f, 10.0f);
+    state.line_stipple = line_style.line_stipple;
+    state.stipple_factor = line_style.line_stipple_factor;
+    state.stipple_pattern = line_style.line_stipple_pattern;
+  }
+
+  objects.push_back(root);
+  worlds.push_back(root->world() * mesh_renderer->position_dequantization());
+  colors.push_back(color);
+  states.push_back(state);
+  line_widths.push_back(line_width);
+  command_line_widths.push_back(command_line_width);
+  mesh_renderers.push_back(mesh_renderer);
+  if (!mesh_renderer->initialized() || mesh.positions().empty()) {
+    counts.push_back(0);
+  } else {
+    counts.push_back(mesh.indexed_draw() ? mesh.indices().size()
+                                         : mesh.positions().size());
+  }
+  indexed.push_back(mesh.indexed_draw());
+  BoundingBox mesh_bounds;
+  for (const Mesh::PositionType& position : mesh.positions()) {
+    mesh_bounds.Extend(position);
+  }
+  local_bounds.push_back(mesh_bounds);
+  bounds.push_back(mesh_bounds.Transform(root->world()));
+}
+
+void DrawList::Update(int index) {
+  const glm::mat4& world = objects[index]->world();
+  worlds[index] = world * mesh_renderers[index]->position_dequantization();
+  GetColor(objects[index], &colors[index]);
+  bounds[index] = local_bounds[index].Transform(world);
+}
+
+void DrawList::Clear() {
+  objects.clear();
+  worlds.clear();
+  colors.clear();
+  states.clear();
+  line_widths.clear();
+  command_line_widths.clear();
+  mesh_renderers.clear();
+  counts.clear();
+  indexed.clear();
+  local_bounds.clear();
+  bounds.clear();
+}
+
+const std::string& DrawList::shader_name(uint16_t shader) {
+  return ShaderNames()[shader];
+}
+
+int DrawList::shader_count() { return ShaderNames().size(); }
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "app/RenderObject.h"
+#include "core/frustum.h"
+
+// Program and fixed function state of one draw, CapturedStateCache and the
+// indirect batch keys are built from it.
+struct DrawState {
+  // See DrawList::shader_name.
+  uint16_t shader = 0;
+  uint16_t vertex_attrib_mask = 0;
+  GLenum draw_mode = 0;
+  uint8_t line_stipple = 0;
+  GLint stipple_factor = 1;
+  GLushort stipple_pattern = 0xffff;
+};
+
+// The drawable leaves of render object trees flattened into parallel arrays,
+// one entry per draw, so the draw methods loop over contiguous records
+// instead of walking the trees through virtual Render calls and classifying
+// every object on every draw. Built on the GL thread after upload; world
+// and color are refreshed with Update when the object changes.
+struct DrawList {
+  std::vector<RenderObject*> objects;
+  // Object world times the position dequantization of the mesh, what the
+  // vertex shaders transform the vertex buffer positions with.
+  std::vector<glm::mat4> worlds;
+  // Alpha in all channels for textured objects.
+  std::vector<glm::vec4> colors;
+  std::vector<DrawState> states;
+  // Line width of line objects as styled, what the basic methods pass to
+  // glLineWidth like LineObject::Render. 0 for others.
+  std::vector<float> line_widths;
+  // The line width clamped to 0.5-10 for the compiled commands, 0 for
+  // objects other than lines.
+  std::vector<float> command_line_widths;
+  // Buffer offsets are read from here when compiling, BufferManager::Compact
+  // may move them.
+  std::vector<MeshRenderer*> mesh_renderers;
+  // Index count of indexed draws, vertex count otherwise. 0 draws nothing.
+  std::vector<GLuint> counts;
+  std::vector<uint8_t> indexed;
+  // Of the mesh positions, computed once on Append.
+  std::vector<BoundingBox> local_bounds;
+  // local_bounds transformed by the object worlds, empty for meshes without
+  // positions.
+  std::vector<BoundingBox> bounds;
+
+  // Appends the draws of |root| and its sub meshes.
+  void Append(RenderObject* root);
+  // Re-reads world and color of draw |index| from its object and moves its
+  // bounds.
+  void Update(int index);
+  void Clear();
+
+  int size() const { return objects.size(); }
+
+  // Shader names are interned process wide so DrawState stays small;
+  // programs are looked up per name and draw method.
+  static const std::string& shader_name(uint16_t shader);
+  static int shader_count();
+};
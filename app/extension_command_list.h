@@ -117,3 +117,80 @@ typedef struct {
 } FrontFaceCommandNV;
 
 #pragma pack(pop)
+
+// Maps a token struct to its GL_*_COMMAND_NV token.
+template <typename Command>
+struct CommandTokenTraits;
+
+#define DEFINE_COMMAND_TOKEN(Command, token) \
+  template <>                                \
+  struct CommandTokenTraits<Command> {       \
+    static constexpr GLenum kToken = token;  \
+  };
+
+DEFINE_COMMAND_TOKEN(TerminateSequenceCommandNV,
+                     GL_TERMINATE_SEQUENCE_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(NOPCommandNV, GL_NOP_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(DrawElementsCommandNV, GL_DRAW_ELEMENTS_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(DrawArraysCommandNV, GL_DRAW_ARRAYS_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(DrawElementsInstancedCommandNV,
+                     GL_DRAW_ELEMENTS_INSTANCED_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(DrawArraysInstancedCommandNV,
+                     GL_DRAW_ARRAYS_INSTANCED_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(ElementAddressCommandNV, GL_ELEMENT_ADDRESS_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(AttributeAddressCommandNV,
+                     GL_ATTRIBUTE_ADDRESS_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(UniformAddressCommandNV, GL_UNIFORM_ADDRESS_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(BlendColorCommandNV, GL_BLEND_COLOR_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(StencilRefCommandNV, GL_STENCIL_REF_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(LineWidthCommandNV, GL_LINE_WIDTH_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(PolygonOffsetCommandNV, GL_POLYGON_OFFSET_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(AlphaRefCommandNV, GL_ALPHA_REF_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(ViewportCommandNV, GL_VIEWPORT_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(ScissorCommandNV, GL_SCISSOR_COMMAND_NV)
+DEFINE_COMMAND_TOKEN(FrontFaceCommandNV, GL_FRONT_FACE_COMMAND_NV)
+
+#undef DEFINE_COMMAND_TOKEN
+
+// Token headers and shader stage indices are implementation defined and only
+// queryable from the GL thread; resolve them once so token streams can be
+// written by other threads.
+struct CommandTokenHeaders {
+  static constexpr int kTokenCount = GL_FRONT_FACE_COMMAND_NV + 1;
+
+  uint headers[kTokenCount] = {};
+  ushort vertex_stage = 0;
+  ushort fragment_stage = 0;
+
+  template <typename Command>
+  uint header() const {
+    return headers[CommandTokenTraits<Command>::kToken];
+  }
+};
+
+namespace internal {
+
+template <typename... Commands>
+void ResolveCommandTokenHeaders(CommandTokenHeaders* headers) {
+  ((headers->headers[CommandTokenTraits<Commands>::kToken] =
+        glGetCommandHeaderNV(CommandTokenTraits<Commands>::kToken,
+                             sizeof(Commands))),
+   ...);
+}
+
+}  // namespace internal
+
+inline CommandTokenHeaders ResolveCommandTokenHeaders() {
+  CommandTokenHeaders headers;
+  internal::ResolveCommandTokenHeaders<
+      TerminateSequenceCommandNV, NOPCommandNV, DrawElementsCommandNV,
+      DrawArraysCommandNV, DrawElementsInstancedCommandNV,
+      DrawArraysInstancedCommandNV, ElementAddressCommandNV,
+      AttributeAddressCommandNV, UniformAddressCommandNV, BlendColorCommandNV,
+      StencilRefCommandNV, LineWidthCommandNV, PolygonOffsetCommandNV,
+      AlphaRefCommandNV, ViewportCommandNV, ScissorCommandNV,
+      FrontFaceCommandNV>(&headers);
+  headers.vertex_stage = glGetStageIndexNV(GL_VERTEX_SHADER);
+  headers.fragment_stage = glGetStageIndexNV(GL_FRAGMENT_SHADER);
+  return headers;
+}
@@ -0,0 +1,228 @@
+#include "app/gpu_culling.h"
+
+#include <algorithm>
+
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+
+using CullBatch = common::CullBatch;
+using CullBounds = common::CullBounds;
+using CullDraw = common::CullDraw;
+
+// Explicit uniform locations of cull_draws.comp.glsl.
+constexpr GLint kFrustumPlanesLocation = 0;
+constexpr GLint kOcclusionViewProjectionLocation = 6;
+constexpr GLint kDepthPyramidLevelsLocation = 7;
+constexpr GLint kDrawCountLocation = 8;
+constexpr GLint kNopHeaderLocation = 9;
+constexpr GLint kEyePositionLocation = 10;
+constexpr GLint kLodScaleLocation = 11;
+
+// Creates or grows |*buffer| to hold |size| bytes, the contents are undefined
+// after growing.
+void ReserveBuffer(GLuint* buffer, int* buffer_size, int size) {
+  if (!*buffer) {
+    glCreateBuffers(1, buffer);
+  }
+  if (*buffer_size < size) {
+    glNamedBufferData(*buffer, size, nullptr, GL_DYNAMIC_DRAW);
+    *buffer_size = size;
+  }
+}
+
+template <typename T>
+void UploadBuffer(GLuint* buffer, int* buffer_size,
+                  const std::vector<T>& data) {
+  int size = data.size() * sizeof(T);
+  ReserveBuffer(buffer, buffer_size, size);
+  if (size) {
+    glNamedBufferSubData(*buffer, 0, size, data.data());
+  }
+}
+
+CullBounds ToCullBounds(const BoundingBox& box) {
+  return CullBounds{glm::vec4(box.min, 0.0f), glm::vec4(box.max, 0.0f)};
+}
+
+GLuint GroupCount(int size, int group_size) {
+  return (size + group_size - 1) / group_size;
+}
+
+}  // namespace
+
+GpuCulling::~GpuCulling() {
+  GLuint buffers[] = {bounds_buffer_, token_draws_buffer_,
+                      indirect_draws_buffer_, compacted_buffer_,
+                      count_buffer_, batches_buffer_, visibility_buffer_,
+                      culled_commands_buffer_};
+  glDeleteBuffers(sizeof(buffers) / sizeof(buffers[0]), buffers);
+  if (depth_pyramid_) {
+    glDeleteTextures(1, &depth_pyramid_);
+  }
+}
+
+void GpuCulling::Initialize(const Programs& programs,
+                            OpenGLContext* gl_context) {
+  programs_ = programs;
+  gl_context_ = gl_context;
+}
+
+void GpuCulling::UploadBounds(const std::vector<BoundingBox>& bounds) {
+  std::vector<CullBounds> cull_bounds(bounds.size());
+  std::transform(bounds.begin(), bounds.end(), cull_bounds.begin(),
+                 ToCullBounds);
+  UploadBuffer(&bounds_buffer_, &bounds_buffer_size_, cull_bounds);
+  bounds_valid_ = true;
+}
+
+void GpuCulling::UpdateBounds(int index, const BoundingBox& box) {
+  CullBounds cull_bounds = ToCullBounds(box);
+  glNamedBufferSubData(bounds_buffer_, index * sizeof(CullBounds),
+                       sizeof(CullBounds), &cull_bounds);
+}
+
+void GpuCulling::SetTokenDraws(const std::vector<CullDraw>& draws) {
+  UploadBuffer(&token_draws_buffer_, &token_draws_buffer_size_, draws);
+  token_draw_count_ = draws.size();
+}
+
+void GpuCulling::SetIndirectDraws(const std::vector<CullDraw>& draws,
+                                  int batch_count, GLsizeiptr buffer_size) {
+  UploadBuffer(&indirect_draws_buffer_, &indirect_draws_buffer_size_, draws);
+  indirect_draw_count_ = draws.size();
+  ReserveBuffer(&compacted_buffer_, &compacted_buffer_size_, buffer_size);
+  ReserveBuffer(&count_buffer_, &count_buffer_size_,
+                batch_count * sizeof(GLuint));
+
+  std::vector<CullBatch> batches(batch_count, CullBatch{0, 0});
+  for (size_t i = 0; i < draws.size(); ++i) {
+    CullBatch& batch = batches[draws[i].batch];
+    if (!batch.draw_count) {
+      batch.first_draw = i;
+    }
+    ++batch.draw_count;
+  }
+  UploadBuffer(&batches_buffer_, &batches_buffer_size_, batches);
+  batch_count_ = batch_count;
+  ReserveBuffer(&visibility_buffer_, &visibility_buffer_size_,
+                draws.size() * sizeof(GLuint));
+  ReserveBuffer(&culled_commands_buffer_, &culled_commands_buffer_size_,
+                draws.size() * CULL_COMMAND_WORDS * sizeof(GLuint));
+}
+
+void GpuCulling::CullTokens(GLuint stream_buffer, const View& view,
+                            GLuint nop_header) {
+  if (!token_draw_count_) {
+    return;
+  }
+  Dispatch(programs_.cull_tokens, token_draws_buffer_, token_draw_count_,
+           stream_buffer, view, nop_header);
+  // glDrawCommandsStatesNV reads the tokens like indirect commands.
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GpuCulling::CullIndirect(const View& view) {
+  if (!indirect_draw_count_) {
+    return;
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_VISIBILITY,
+                   visibility_buffer_);
+  Dispatch(programs_.cull_indirect, indirect_draws_buffer_,
+           indirect_draw_count_, culled_commands_buffer_, view, 0);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // One work group per batch, so a prefix sum over the visibility flags
+  // keeps the compiled order and draws at the same depth never swap.
+  gl_context_->glUseProgram(programs_.compact_indirect);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_BATCHES,
+                   batches_buffer_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_COMMANDS,
+                   culled_commands_buffer_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_OUTPUT,
+                   compacted_buffer_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_COUNTS, count_buffer_);
+  glDispatchCompute(batch_count_, 1, 1);
+  // Read as draw indirect and parameter buffer.
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GpuCulling::Dispatch(GLuint program, GLuint draws_buffer,
+                          GLuint draw_count, GLuint output_buffer,
+                          const View& view, GLuint nop_header) {
+  Frustum frustum = Frustum::FromMatrix(view.view_projection);
+  glProgramUniform4fv(program, kFrustumPlanesLocation, 6,
+                      glm::value_ptr(frustum.planes[0]));
+  glProgramUniformMatrix4fv(program, kOcclusionViewProjectionLocation, 1,
+                            GL_FALSE,
+                            glm::value_ptr(depth_pyramid_view_projection_));
+  glProgramUniform1i(program, kDepthPyramidLevelsLocation,
+                     depth_pyramid_valid_ ? depth_pyramid_levels_ : 0);
+  glProgramUniform1ui(program, kDrawCountLocation, draw_count);
+  glProgramUniform1ui(program, kNopHeaderLocation, nop_header);
+  glProgramUniform3fv(program, kEyePositionLocation, 1,
+                      glm::value_ptr(view.eye));
+  glProgramUniform1f(program, kLodScaleLocation, view.lod_scale);
+
+  gl_context_->glUseProgram(program);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_BOUNDS, bounds_buffer_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_DRAWS, draws_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SSBO_CULL_OUTPUT, output_buffer);
+  glBindTextureUnit(TEXTURE_CULL_DEPTH, depth_pyramid_);
+  glDispatchCompute(GroupCount(draw_count, CULL_GROUP_SIZE), 1, 1);
+  glBindTextureUnit(TEXTURE_CULL_DEPTH, 0);
+}
+
+void GpuCulling::BuildDepthPyramid(GLuint depth_texture, int width,
+                                   int height,
+                                   const glm::mat4& view_projection) {
+  if (width <= 0 || height <= 0) {
+    depth_pyramid_valid_ = false;
+    return;
+  }
+  if (!depth_pyramid_ || depth_pyramid_width_ != width ||
+      depth_pyramid_height_ != height) {
+    if (depth_pyramid_) {
+      glDeleteTextures(1, &depth_pyramid_);
+    }
+    depth_pyramid_levels_ = 1;
+    while (std::max(width, height) >> depth_pyramid_levels_) {
+      ++depth_pyramid_levels_;
+    }
+    glCreateTextures(GL_TEXTURE_2D, 1, &depth_pyramid_);
+    glTextureStorage2D(depth_pyramid_, depth_pyramid_levels_, GL_R32F, width,
+                       height);
+    glTextureParameteri(depth_pyramid_, GL_TEXTURE_MIN_FILTER,
+                        GL_NEAREST_MIPMAP_NEAREST);
+    glTextureParameteri(depth_pyramid_, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    depth_pyramid_width_ = width;
+    depth_pyramid_height_ = height;
+  }
+
+  // Level 0 from the depth samples, each further level from the previous.
+  gl_context_->glUseProgram(programs_.depth_resolve);
+  glBindTextureUnit(TEXTURE_CULL_DEPTH, depth_texture);
+  glBindImageTexture(IMAGE_DEPTH_TARGET, depth_pyramid_, 0, GL_FALSE, 0,
+                     GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute(GroupCount(width, DEPTH_PYRAMID_GROUP_SIZE),
+                    GroupCount(height, DEPTH_PYRAMID_GROUP_SIZE), 1);
+  glBindTextureUnit(TEXTURE_CULL_DEPTH, 0);
+
+  gl_context_->glUseProgram(programs_.depth_reduce);
+  for (int level = 1; level < depth_pyramid_levels_; ++level) {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(IMAGE_DEPTH_SOURCE, depth_pyramid_, level - 1,
+                       GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(IMAGE_DEPTH_TARGET, depth_pyramid_, level, GL_FALSE, 0,
+                       GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(
+        GroupCount(std::max(width >> level, 1), DEPTH_PYRAMID_GROUP_SIZE),
+        GroupCount(std::max(height >> level, 1), DEPTH_PYRAMID_GROUP_SIZE),
+        1);
+  }
+  // The next cull reads it with texelFetch.
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  depth_pyramid_view_projection_ = view_projection;
+  depth_pyramid_valid_ = true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "app/common.h"
+#include "core/frustum.h"
+#include "core/opengl_context.h"
+
+// Culls draw commands on the GPU, so visibility costs no CPU time and the
+// compiled commands never change. A compute pass (cull_draws.comp.glsl) tests
+// the bounds of each draw against the view frustum and, once a depth pyramid
+// was built, against the depth of the previous frame. It either rewrites the
+// draw tokens of a command stream in place, culled draws as NOP tokens, or
+// flags the visible indirect commands, which a second pass
+// (compact_draws.comp.glsl) compacts per batch into compacted_buffer() in
+// their compiled order, writing the number of each batch to count_buffer()
+// for glMultiDraw*IndirectCount. The visible draws are written at the level
+// of detail of their screen size.
+class GpuCulling {
+ public:
+  struct Programs {
+    // cull_draws.comp.glsl, with CULL_INDIRECT for the indirect commands.
+    GLuint cull_tokens = 0;
+    GLuint cull_indirect = 0;
+    // compact_draws.comp.glsl.
+    GLuint compact_indirect = 0;
+    // depth_pyramid.comp.glsl, with DEPTH_PYRAMID_RESOLVE for level 0.
+    GLuint depth_resolve = 0;
+    GLuint depth_reduce = 0;
+  };
+
+  // What the draws are culled for.
+  struct View {
+    glm::mat4 view_projection;
+    glm::vec3 eye;
+    // Pixels per unit at distance 1 for ProjectedScreenSize, 0 keeps every
+    // draw at level 0.
+    float lod_scale = 0.0f;
+  };
+
+  GpuCulling() = default;
+  ~GpuCulling();
+
+  GpuCulling(const GpuCulling&) = delete;
+  GpuCulling& operator=(const GpuCulling&) = delete;
+
+  void Initialize(const Programs& programs, OpenGLContext* gl_context);
+  // False when a program failed to build.
+  bool valid() const {
+    return programs_.cull_tokens && programs_.cull_indirect &&
+           programs_.compact_indirect && programs_.depth_resolve &&
+           programs_.depth_reduce;
+  }
+
+  // Bounds of all draws, indexed by CullDraw::bounds_index.
+  void UploadBounds(const std::vector<BoundingBox>& bounds);
+  void UpdateBounds(int index, const BoundingBox& box);
+  void InvalidateBounds() { bounds_valid_ = false; }
+  bool bounds_valid() const { return bounds_valid_; }
+
+  // Draw tokens of the stream CullTokens rewrites.
+  void SetTokenDraws(const std::vector<common::CullDraw>& draws);
+  // Commands of an indirect buffer of |buffer_size| bytes in |batch_count|
+  // batches, the draws of each batch consecutive. The visible commands of a
+  // batch are compacted in order to where its commands start in the indirect
+  // buffer.
+  void SetIndirectDraws(const std::vector<common::CullDraw>& draws,
+                        int batch_count, GLsizeiptr buffer_size);
+
+  // Writes each draw token of |stream_buffer| as compiled when visible from
+  // |view|, otherwise as |nop_header| tokens.
+  void CullTokens(GLuint stream_buffer, const View& view, GLuint nop_header);
+  // Fills compacted_buffer() and count_buffer() with the indirect commands
+  // visible from |view|.
+  void CullIndirect(const View& view);
+  GLuint compacted_buffer() const { return compacted_buffer_; }
+  // One GLuint command count per batch.
+  GLuint count_buffer() const { return count_buffer_; }
+
+  // Builds the depth pyramid from the multisampled |depth_texture| of a
+  // |width| x |height| frame drawn with |view_projection|. The next cull
+  // tests occlusion against it, until InvalidateDepthPyramid.
+  void BuildDepthPyramid(GLuint depth_texture, int width, int height,
+                         const glm::mat4& view_projection);
+  void InvalidateDepthPyramid() { depth_pyramid_valid_ = false; }
+
+ private:
+  // Runs |program| over |draw_count| draws written to |output_buffer|.
+  void Dispatch(GLuint program, GLuint draws_buffer, GLuint draw_count,
+                GLuint output_buffer, const View& view, GLuint nop_header);
+
+  Programs programs_;
+  OpenGLContext* gl_context_ = nullptr;
+
+  // common::CullBounds in scene draw order.
+  GLuint bounds_buffer_ = 0;
+  int bounds_buffer_size_ = 0;
+  bool bounds_valid_ = false;
+
+  GLuint token_draws_buffer_ = 0;
+  int token_draws_buffer_size_ = 0;
+  GLuint token_draw_count_ = 0;
+
+  GLuint indirect_draws_buffer_ = 0;
+  int indirect_draws_buffer_size_ = 0;
+  GLuint indirect_draw_count_ = 0;
+  GLuint compacted_buffer_ = 0;
+  int compacted_buffer_size_ = 0;
+  GLuint count_buffer_ = 0;
+  int count_buffer_size_ = 0;
+  // common::CullBatch per batch.
+  GLuint batches_buffer_ = 0;
+  int batches_buffer_size_ = 0;
+  GLuint batch_count_ = 0;
+  // Written by the cull pass for the compaction pass: a GLuint visibility
+  // flag and CULL_COMMAND_WORDS command words per draw.
+  GLuint visibility_buffer_ = 0;
+  int visibility_buffer_size_ = 0;
+  GLuint culled_commands_buffer_ = 0;
+  int culled_commands_buffer_size_ = 0;
+
+  // R32F, full mip chain of the frame size.
+  GLuint depth_pyramid_ = 0;
+  int depth_pyramid_width_ = 0;
+  int depth_pyramid_height_ = 0;
+  int depth_pyramid_levels_ = 0;
+  bool depth_pyramid_valid_ = false;
+  glm::mat4 depth_pyramid_view_projection_;
+};
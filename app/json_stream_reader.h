@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+// Minimal pull style JSON reader over a NUL terminated buffer. Values are
+// consumed in document order without building any DOM nodes; strings are
+// returned as views into the buffer unless they contain escapes.
+//
+//   JsonStreamReader reader(text.c_str(), text.size());
+//   reader.BeginObject();
+//   const char* key; size_t key_len;
+//   while (reader.NextKey(&key, &key_len)) {
+//     if (JsonStreamReader::KeyIs(key, key_len, "type")) ...
+//     else reader.SkipValue();
+//   }
+//
+// Errors are sticky: after the first one every call fails and ok() returns
+// false.
+class JsonStreamReader {
+ public:
+  JsonStreamReader(const char* text, size_t size)
+      : cur_(text), end_(text + size) {}
+
+  bool ok() const { return ok_; }
+
+  static bool KeyIs(const char* key, size_t key_len, const char* name) {
+    size_t i = 0;
+    for (; i < key_len; ++i) {
+      if (name[i] != key[i]) {
+        return false;
+      }
+    }
+    return name[i] == '\0';
+  }
+
+  bool PeekIsString() { return Peek() == '"'; }
+  bool PeekIsArray() { return Peek() == '['; }
+  bool PeekIsObject() { return Peek() == '{'; }
+
+  bool BeginObject() {
+    first_ = true;
+    return Expect('{');
+  }
+
+  // Returns false at the closing brace.
+  bool NextKey(const char** key, size_t* key_len) {
+    if (!ok_) {
+      return false;
+    }
+    char c = Peek();
+    if (c == '}') {
+      ++cur_;
+      first_ = false;
+      return false;
+    }
+    if (!first_ && !Expect(',')) {
+      return false;
+    }
+    first_ = false;
+    if (!ReadString(key, key_len)) {
+      return false;
+    }
+    if (!Expect(':')) {
+      return false;
+    }
+    // The value that follows may be a nested container.
+    first_ = true;
+    return true;
+  }
+
+  bool BeginArray() {
+    first_ = true;
+    return Expect('[');
+  }
+
+  // Returns false at the closing bracket.
+  bool NextElement() {
+    if (!ok_) {
+      return false;
+    }
+    char c = Peek();
+    if (c == ']') {
+      ++cur_;
+      first_ = false;
+      return false;
+    }
+    if (!first_ && !Expect(',')) {
+      return false;
+    }
+    first_ = true;
+    return true;
+  }
+
+  bool ReadString(const char** str, size_t* len) {
+    if (!Expect('"')) {
+      return false;
+    }
+    const char* begin = cur_;
+    while (cur_ < end_ && *cur_ != '"' && *cur_ != '\\') {
+      ++cur_;
+    }
+    if (cur_ < end_ && *cur_ == '"') {
+      *str = begin;
+      *len = cur_ - begin;
+      ++cur_;
+      Consumed();
+      return true;
+    }
+    // Slow path for escaped strings.
+    scratch_.assign(begin, cur_);
+    while (cur_ < end_ && *cur_ != '"') {
+      if (*cur_ != '\\') {
+        scratch_ += *cur_++;
+        continue;
+      }
+      if (++cur_ >= end_) {
+        break;
+      }
+      char c = *cur_++;
+      switch (c) {
+        case 'b': scratch_ += '\b'; break;
+        case 'f': scratch_ += '\f'; break;
+        case 'n': scratch_ += '\n'; break;
+        case 'r': scratch_ += '\r'; break;
+        case 't': scratch_ += '\t'; break;
+        case 'u': {
+          unsigned code;
+          if (!ReadHex4(&code)) {
+            return Fail();
+          }
+          if (code >= 0xdc00 && code <= 0xdfff) {
+            // Low surrogate without a high one.
+            return Fail();
+          }
+          if (code >= 0xd800 && code <= 0xdbff) {
+            // Characters outside the BMP are escaped as a surrogate pair.
+            unsigned low;
+            if (!Match("\\u") || !ReadHex4(&low) || low < 0xdc00 ||
+                low > 0xdfff) {
+              return Fail();
+            }
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          }
+          if (code < 0x80) {
+            scratch_ += char(code);
+          } else if (code < 0x800) {
+            scratch_ += char(0xc0 | (code >> 6));
+            scratch_ += char(0x80 | (code & 0x3f));
+          } else if (code < 0x10000) {
+            scratch_ += char(0xe0 | (code >> 12));
+            scratch_ += char(0x80 | ((code >> 6) & 0x3f));
+            scratch_ += char(0x80 | (code & 0x3f));
+          } else {
+            scratch_ += char(0xf0 | (code >> 18));
+            scratch_ += char(0x80 | ((code >> 12) & 0x3f));
+            scratch_ += char(0x80 | ((code >> 6) & 0x3f));
+            scratch_ += char(0x80 | (code & 0x3f));
+          }
+          break;
+        }
+        default: scratch_ += c; break;
+      }
+    }
+    if (cur_ >= end_) {
+      return Fail();
+    }
+    ++cur_;
+    *str = scratch_.data();
+    *len = scratch_.size();
+    Consumed();
+    return true;
+  }
+
+  bool ReadString(std::string* str) {
+    const char* s;
+    size_t len;
+    if (!ReadString(&s, &len)) {
+      return false;
+    }
+    str->assign(s, len);
+    return true;
+  }
+
+  bool ReadNumber(double* value) {
+    if (!ok_) {
+      return false;
+    }
+    SkipWhitespace();
+    char* number_end = nullptr;
+    *value = strtod(cur_, &number_end);
+    if (number_end == cur_ || number_end > end_) {
+      return Fail();
+    }
+    cur_ = number_end;
+    Consumed();
+    return true;
+  }
+
+  template <typename T>
+  bool ReadNumber(T* value) {
+    double number = 0;
+    if (!ReadNumber(&number)) {
+      return false;
+    }
+    *value = static_cast<T>(number);
+    return true;
+  }
+
+  bool ReadBool(bool* value) {
+    if (!ok_) {
+      return false;
+    }
+    SkipWhitespace();
+    if (Match("true")) {
+      *value = true;
+    } else if (Match("false")) {
+      *value = false;
+    } else {
+      return Fail();
+    }
+    Consumed();
+    return true;
+  }
+
+  // Reads a flat numeric array into |values|, expecting exactly |count|.
+  template <typename T>
+  bool ReadNumberArray(T* values, int count) {
+    if (!BeginArray()) {
+      return false;
+    }
+    int i = 0;
+    while (NextElement()) {
+      if (i >= count || !ReadNumber(&values[i++])) {
+        return Fail();
+      }
+    }
+    return ok_ && i == count;
+  }
+
+  bool SkipValue() {
+    if (!ok_) {
+      return false;
+    }
+    char c = Peek();
+    if (c == '{') {
+      BeginObject();
+      const char* key;
+      size_t key_len;
+      while (NextKey(&key, &key_len)) {
+        SkipValue();
+      }
+    } else if (c == '[') {
+      BeginArray();
+      while (NextElement()) {
+        SkipValue();
+      }
+    } else if (c == '"') {
+      const char* str;
+      size_t len;
+      ReadString(&str, &len);
+    } else if (c == 't' || c == 'f') {
+      bool value;
+      ReadBool(&value);
+    } else if (c == 'n') {
+      if (!Match("null")) {
+        return Fail();
+      }
+      Consumed();
+    } else {
+      double value;
+      ReadNumber(&value);
+    }
+    return ok_;
+  }
+
+ private:
+  void SkipWhitespace() {
+    while (cur_ < end_ &&
+           (*cur_ == ' ' || *cur_ == '\n' || *cur_ == '\r' || *cur_ == '\t')) {
+      ++cur_;
+    }
+  }
+
+  char Peek() {
+    SkipWhitespace();
+    return cur_ < end_ ? *cur_ : '\0';
+  }
+
+  bool Expect(char c) {
+    if (!ok_ || Peek() != c) {
+      return Fail();
+    }
+    ++cur_;
+    return true;
+  }
+
+  bool Match(const char* literal) {
+    const char* p = cur_;
+    for (; *literal; ++literal, ++p) {
+      if (p >= end_ || *p != *literal) {
+        return false;
+      }
+    }
+    cur_ = p;
+    return true;
+  }
+
+  // The four hex digits of a \u escape.
+  bool ReadHex4(unsigned* code) {
+    if (end_ - cur_ < 4) {
+      return false;
+    }
+    *code = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = *cur_++;
+      unsigned digit;
+      if (c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else {
+        return false;
+      }
+      *code = *code << 4 | digit;
+    }
+    return true;
+  }
+
+  // A scalar value was read, the next token in the parent needs a comma.
+  void Consumed() { first_ = false; }
+
+  bool Fail() {
+    ok_ = false;
+    return false;
+  }
+
+  const char* cur_;
+  const char* end_;
+  bool first_ = true;
+  bool ok_ = true;
+  std::string scratch_;
+};
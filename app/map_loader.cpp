@@ -0,0 +1,89 @@
+#include "app/map_loader.h"
+
+#include "app/render_object_parser.h"
+
+MapLoader::~MapLoader() { scheduler_->Wait(&counter_); }
+
+void MapLoader::LoadFilesAsync(const std::vector<std::string>& files) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_files_ += files.size();
+  }
+  for (const std::string& path : files) {
+    scheduler_->Submit([this, path]() { ReadFile(path); }, &counter_);
+  }
+}
+
+void MapLoader::ReadFile(const std::string& path) {
+  auto text = std::make_shared<std::string>();
+  if (!ReadRenderObjectFile(path, text.get())) {
+    FinishFile(nullptr, 0, {});
+    return;
+  }
+  // Runs next on this worker unless stolen, while the file is cache hot.
+  scheduler_->Submit([this, path, text]() { ParseFile(path, *text); },
+                     &counter_);
+}
+
+void MapLoader::ParseFile(const std::string& path, std::string& text) {
+  auto object = ParseRenderObject(text.c_str(), text.size());
+  std::string().swap(text);
+  if (!object) {
+    printf("parsing file error: %s\n", path.c_str());
+    FinishFile(nullptr, 0, {});
+    return;
+  }
+  MeshOptimizeStats stats;
+  uint64_t upload_size = object->PrepareUpload(&stats);
+  FinishFile(std::move(object), upload_size, stats);
+}
+
+void MapLoader::FinishFile(std::unique_ptr<RenderObject> object,
+                           uint64_t upload_size,
+                           const MeshOptimizeStats& stats) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (object) {
+      ready_.push_back(ReadyObject{std::move(object), upload_size});
+    }
+    mesh_optimize_stats_.Add(stats);
+    --pending_files_;
+  }
+  ready_cv_.notify_one();
+}
+
+int MapLoader::DrainUploads(BufferManager* buffer_manager,
+                            std::vector<std::unique_ptr<RenderObject>>* objects,
+                            uint64_t max_bytes) {
+  std::deque<ReadyObject> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t batch_bytes = 0;
+    while (!ready_.empty() && (batch.empty() || batch_bytes < max_bytes)) {
+      batch_bytes += ready_.front().upload_size;
+      batch.push_back(std::move(ready_.front()));
+      ready_.pop_front();
+    }
+  }
+  for (auto& ready : batch) {
+    ready.object->Initialize(buffer_manager);
+    objects->push_back(std::move(ready.object));
+  }
+  return batch.size();
+}
+
+void MapLoader::WaitForUploads() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_cv_.wait(lock,
+                 [this]() { return !ready_.empty() || pending_files_ == 0; });
+}
+
+bool MapLoader::idle() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_files_ == 0 && ready_.empty();
+}
+
+MeshOptimizeStats MapLoader::mesh_optimize_stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return mesh_optimize_stats_;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "app/RenderObject.h"
+#include "core/buffer_manager.h"
+#include "core/task_scheduler.h"
+
+// Pipelined map file loader. Every file goes through
+//   read (worker) -> parse + vertex interleave into staging (worker)
+//   -> GPU upload (GL thread, DrainUploads)
+// so uploads of finished objects overlap with parsing of the rest.
+class MapLoader {
+ public:
+  explicit MapLoader(TaskScheduler* scheduler) : scheduler_(scheduler) {}
+  // Waits for the in flight tasks, they reference the loader.
+  ~MapLoader();
+
+  MapLoader(const MapLoader&) = delete;
+  MapLoader& operator=(const MapLoader&) = delete;
+
+  void LoadFilesAsync(const std::vector<std::string>& files);
+
+  // GL thread only. Uploads ready objects until |max_bytes| is reached (at
+  // least one object per call) and appends them to |objects|. Returns the
+  // number of objects uploaded.
+  int DrainUploads(BufferManager* buffer_manager,
+                   std::vector<std::unique_ptr<RenderObject>>* objects,
+                   uint64_t max_bytes);
+
+  // Blocks until an object is ready to upload or the loader is idle.
+  void WaitForUploads();
+
+  // No file in flight and nothing left to upload.
+  bool idle();
+
+  // What mesh optimization did to the files parsed so far.
+  MeshOptimizeStats mesh_optimize_stats();
+
+ private:
+  struct ReadyObject {
+    std::unique_ptr<RenderObject> object;
+    uint64_t upload_size = 0;
+  };
+
+  void ReadFile(const std::string& path);
+  void ParseFile(const std::string& path, std::string& text);
+  void FinishFile(std::unique_ptr<RenderObject> object, uint64_t upload_size,
+                  const MeshOptimizeStats& stats);
+
+  TaskScheduler* scheduler_;
+  TaskCounter counter_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  std::deque<ReadyObject> ready_;
+  int pending_files_ = 0;
+  MeshOptimizeStats mesh_optimize_stats_;
+};
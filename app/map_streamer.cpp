@@ -0,0 +1,156 @@
+#include "app/map_streamer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include "app/json.hpp"
+#include "core/map_tile.h"
+
+namespace {
+
+int TileX(MapTileKey key) { return static_cast<int32_t>(key >> 32); }
+int TileY(MapTileKey key) { return static_cast<int32_t>(key & 0xffffffffu); }
+
+}  // namespace
+
+MapStreamer::MapStreamer(TaskScheduler* scheduler, float load_radius,
+                         float unload_radius)
+    : scheduler_(scheduler),
+      load_radius_(load_radius),
+      unload_radius_(unload_radius) {}
+
+MapStreamer::~MapStreamer() { scheduler_->Wait(&counter_); }
+
+bool MapStreamer::Initialize(const std::string& tile_directory) {
+  std::ifstream ifs(tile_directory + "/index.json");
+  if (!ifs) {
+    return false;
+  }
+  nlohmann::json index;
+  ifs >> index;
+  tile_size_ = index["tile_size"];
+  for (const auto& tile : index["tiles"]) {
+    std::string file = tile["file"];
+    tile_files_[MakeMapTileKey(tile["x"], tile["y"])] =
+        tile_directory + "/" + file;
+  }
+  printf("map streamer: %d tiles of size %.1f\n", total_tile_count(),
+         tile_size_);
+  return tile_size_ > 0.0f && !tile_files_.empty();
+}
+
+float MapStreamer::TileDistance(MapTileKey key, const glm::vec3& point) const {
+  glm::vec2 lo = glm::vec2(TileX(key), TileY(key)) * tile_size_;
+  glm::vec2 hi = lo + glm::vec2(tile_size_);
+  glm::vec2 p(point.x, point.y);
+  return glm::length(p - glm::clamp(p, lo, hi));
+}
+
+void MapStreamer::Update(const std::vector<glm::vec3>& focus_points) {
+  int range = static_cast<int>(std::ceil(load_radius_ / tile_size_));
+  for (const glm::vec3& point : focus_points) {
+    int center_x = static_cast<int>(std::floor(point.x / tile_size_));
+    int center_y = static_cast<int>(std::floor(point.y / tile_size_));
+    for (int y = center_y - range; y <= center_y + range; ++y) {
+      for (int x = center_x - range; x <= center_x + range; ++x) {
+        MapTileKey key = MakeMapTileKey(x, y);
+        auto file = tile_files_.find(key);
+        if (file == tile_files_.end() ||
+            TileDistance(key, point) > load_radius_) {
+          continue;
+        }
+        evicting_.erase(key);
+        if (resident_.count(key)) {
+          continue;
+        }
+        auto loading = loading_.find(key);
+        if (loading != loading_.end()) {
+          loading->second = true;
+          continue;
+        }
+        loading_[key] = true;
+        std::string path = file->second;
+        scheduler_->Submit([this, key, path]() { LoadTile(key, path); },
+                           &counter_);
+      }
+    }
+  }
+
+  auto far_from_all = [this, &focus_points](MapTileKey key) {
+    for (const glm::vec3& point : focus_points) {
+      if (TileDistance(key, point) <= unload_radius_) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (const auto& resident : resident_) {
+    if (far_from_all(resident.first)) {
+      evicting_.insert(resident.first);
+    }
+  }
+  for (auto& loading : loading_) {
+    if (far_from_all(loading.first)) {
+      loading.second = false;
+    }
+  }
+}
+
+void MapStreamer::LoadTile(MapTileKey key, const std::string& path) {
+  LoadedTile loaded;
+  loaded.key = key;
+  MapTile tile;
+  if (tile.Open(path)) {
+    for (uint32_t i = 0; i < tile.root_count(); ++i) {
+      auto object = CreateRenderObjectFromMapTile(tile, i);
+      if (object) {
+        loaded.upload_size +=
+            object->PrepareUpload(&loaded.mesh_optimize_stats);
+        loaded.objects.push_back(std::move(object));
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ready_.push_back(std::move(loaded));
+}
+
+void MapStreamer::DrainUploads(BufferManager* buffer_manager,
+                               uint64_t max_bytes,
+                               std::vector<MapTileKey>* loaded,
+                               std::vector<MapTileKey>* evicted) {
+  for (MapTileKey key : evicting_) {
+    resident_.erase(key);
+    evicted->push_back(key);
+  }
+  evicting_.clear();
+
+  std::deque<LoadedTile> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t batch_bytes = 0;
+    while (!ready_.empty() && (batch.empty() || batch_bytes < max_bytes)) {
+      batch_bytes += ready_.front().upload_size;
+      batch.push_back(std::move(ready_.front()));
+      ready_.pop_front();
+    }
+  }
+
+  for (auto& tile : batch) {
+    auto loading = loading_.find(tile.key);
+    bool wanted = loading != loading_.end() && loading->second;
+    if (loading != loading_.end()) {
+      loading_.erase(loading);
+    }
+    if (!wanted) {
+      // Went out of range while loading, nothing was uploaded yet.
+      continue;
+    }
+    for (auto& object : tile.objects) {
+      object->Initialize(buffer_manager);
+    }
+    mesh_optimize_stats_.Add(tile.mesh_optimize_stats);
+    resident_[tile.key] = std::move(tile.objects);
+    loaded->push_back(tile.key);
+  }
+}
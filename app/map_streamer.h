@@ -0,0 +1,98 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "app/RenderObject.h"
+#include "core/buffer_manager.h"
+#include "core/task_scheduler.h"
+
+// Keys a square tile of the xy plane, see json_to_map_tile.py --tile_size.
+using MapTileKey = uint64_t;
+
+inline MapTileKey MakeMapTileKey(int x, int y) {
+  return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+}
+
+// Streams the tiles listed in <tile_directory>/index.json in and out around a
+// set of focus points. Tiles are opened, turned into render objects and
+// staged for upload on the task scheduler; the GL thread uploads them within
+// a byte budget and destroys evicted tiles, which returns their BufferProxy
+// ranges to the BufferManager.
+class MapStreamer {
+ public:
+  // Tiles within |load_radius| of a focus point are loaded, resident tiles
+  // farther than |unload_radius| from all of them are evicted.
+  MapStreamer(TaskScheduler* scheduler, float load_radius,
+              float unload_radius);
+  // Waits for the in flight loads, they reference the streamer.
+  ~MapStreamer();
+
+  MapStreamer(const MapStreamer&) = delete;
+  MapStreamer& operator=(const MapStreamer&) = delete;
+
+  // Reads index.json, returns false when the directory holds no tiles.
+  bool Initialize(const std::string& tile_directory);
+
+  // Requests missing tiles near |focus_points| and marks far ones for
+  // eviction. Cheap enough to call every frame.
+  void Update(const std::vector<glm::vec3>& focus_points);
+
+  // GL thread only. Destroys tiles marked for eviction and uploads loaded
+  // tiles until |max_bytes| is reached (at least one tile per call). The keys
+  // of tiles that became resident or were destroyed are appended to
+  // |loaded| and |evicted|; references to objects of evicted tiles must be
+  // dropped before they are used again.
+  void DrainUploads(BufferManager* buffer_manager, uint64_t max_bytes,
+                    std::vector<MapTileKey>* loaded,
+                    std::vector<MapTileKey>* evicted);
+
+  // Objects of a resident tile.
+  const std::vector<std::unique_ptr<RenderObject>>& tile_objects(
+      MapTileKey key) const {
+    return resident_.at(key);
+  }
+
+  float tile_size() const { return tile_size_; }
+  int total_tile_count() const { return tile_files_.size(); }
+  int resident_tile_count() const { return resident_.size(); }
+  int loading_tile_count() const { return loading_.size(); }
+  // What mesh optimization did to the tiles made resident so far.
+  const MeshOptimizeStats& mesh_optimize_stats() const {
+    return mesh_optimize_stats_;
+  }
+
+ private:
+  struct LoadedTile {
+    MapTileKey key;
+    std::vector<std::unique_ptr<RenderObject>> objects;
+    uint64_t upload_size = 0;
+    MeshOptimizeStats mesh_optimize_stats;
+  };
+
+  void LoadTile(MapTileKey key, const std::string& path);
+  float TileDistance(MapTileKey key, const glm::vec3& point) const;
+
+  TaskScheduler* scheduler_;
+  TaskCounter counter_;
+  const float load_radius_;
+  const float unload_radius_;
+  float tile_size_ = 0.0f;
+
+  std::map<MapTileKey, std::string> tile_files_;
+  std::map<MapTileKey, std::vector<std::unique_ptr<RenderObject>>> resident_;
+  // Requested and not yet resident, values tell whether still wanted.
+  std::map<MapTileKey, bool> loading_;
+  std::set<MapTileKey> evicting_;
+  MeshOptimizeStats mesh_optimize_stats_;
+
+  std::mutex mutex_;
+  std::deque<LoadedTile> ready_;
+};
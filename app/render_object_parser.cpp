@@ -0,0 +1,179 @@
+#include "app/render_object_parser.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "app/base64.h"
+#include "app/json_stream_reader.h"
+
+namespace {
+
+bool KeyIs(const char* key, size_t key_len, const char* name) {
+  return JsonStreamReader::KeyIs(key, key_len, name);
+}
+
+bool ParseLineStyle(JsonStreamReader& reader, LineStyle* style) {
+  const char* key;
+  size_t key_len;
+  reader.BeginObject();
+  while (reader.NextKey(&key, &key_len)) {
+    if (KeyIs(key, key_len, "line_width")) {
+      reader.ReadNumber(&style->line_width);
+    } else if (KeyIs(key, key_len, "line_stipple")) {
+      reader.ReadBool(&style->line_stipple);
+    } else if (KeyIs(key, key_len, "line_stipple_factor")) {
+      reader.ReadNumber(&style->line_stipple_factor);
+    } else if (KeyIs(key, key_len, "line_stipple_pattern")) {
+      reader.ReadNumber(&style->line_stipple_pattern);
+    } else {
+      reader.SkipValue();
+    }
+  }
+  return reader.ok();
+}
+
+bool ParseDrawInfo(JsonStreamReader& reader, RenderObjectDesc* desc) {
+  const char* key;
+  size_t key_len;
+  reader.BeginObject();
+  while (reader.NextKey(&key, &key_len)) {
+    if (KeyIs(key, key_len, "color")) {
+      reader.ReadNumberArray(glm::value_ptr(desc->color), 4);
+    } else if (KeyIs(key, key_len, "alpha")) {
+      reader.ReadNumber(&desc->alpha);
+    } else if (KeyIs(key, key_len, "line_style")) {
+      ParseLineStyle(reader, &desc->line_style);
+    } else if (KeyIs(key, key_len, "shader")) {
+      reader.ReadString(&desc->shader);
+    } else if (KeyIs(key, key_len, "world_matrix")) {
+      int column = 0;
+      reader.BeginArray();
+      while (reader.NextElement()) {
+        if (column >= desc->world.length()) {
+          reader.SkipValue();
+          continue;
+        }
+        reader.ReadNumberArray(glm::value_ptr(desc->world[column++]), 4);
+      }
+    } else if (KeyIs(key, key_len, "draw_mode")) {
+      reader.ReadNumber(&desc->draw_mode);
+    } else {
+      reader.SkipValue();
+    }
+  }
+  return reader.ok();
+}
+
+template <typename T>
+bool ParseMeshAttribute(JsonStreamReader& reader, std::vector<T>* values) {
+  if (!reader.PeekIsString()) {
+    // Only the base64 encoded layout of dumped_map_data_compact is supported.
+    printf("mesh attribute is not base64 encoded\n");
+    reader.SkipValue();
+    return false;
+  }
+  const char* encoded;
+  size_t encoded_len;
+  if (!reader.ReadString(&encoded, &encoded_len)) {
+    return false;
+  }
+  base64_decode(encoded, encoded_len, values);
+  return true;
+}
+
+bool ParseMesh(JsonStreamReader& reader, Mesh* mesh) {
+  const char* key;
+  size_t key_len;
+  reader.BeginObject();
+  while (reader.NextKey(&key, &key_len)) {
+    if (KeyIs(key, key_len, "position")) {
+      std::vector<Mesh::PositionType> positions;
+      if (!ParseMeshAttribute(reader, &positions)) {
+        return false;
+      }
+      mesh->set_positions(std::move(positions));
+    } else if (KeyIs(key, key_len, "color")) {
+      std::vector<Mesh::ColorType> colors;
+      if (!ParseMeshAttribute(reader, &colors)) {
+        return false;
+      }
+      mesh->set_colors(std::move(colors));
+    } else if (KeyIs(key, key_len, "uv")) {
+      std::vector<Mesh::UVType> uvs;
+      if (!ParseMeshAttribute(reader, &uvs)) {
+        return false;
+      }
+      mesh->set_uvs(std::move(uvs));
+    } else {
+      reader.SkipValue();
+    }
+  }
+  return reader.ok();
+}
+
+bool ParseRenderObjectDesc(JsonStreamReader& reader, RenderObjectDesc* desc) {
+  const char* key;
+  size_t key_len;
+  reader.BeginObject();
+  while (reader.NextKey(&key, &key_len)) {
+    if (KeyIs(key, key_len, "type")) {
+      reader.ReadString(&desc->type);
+    } else if (KeyIs(key, key_len, "draw_info")) {
+      ParseDrawInfo(reader, desc);
+    } else if (KeyIs(key, key_len, "mesh")) {
+      if (!ParseMesh(reader, &desc->mesh)) {
+        return false;
+      }
+    } else if (KeyIs(key, key_len, "sub_mesh")) {
+      reader.BeginArray();
+      while (reader.NextElement()) {
+        desc->sub_meshes.emplace_back();
+        if (!ParseRenderObjectDesc(reader, &desc->sub_meshes.back())) {
+          return false;
+        }
+      }
+    } else {
+      reader.SkipValue();
+    }
+  }
+  return reader.ok();
+}
+
+}  // namespace
+
+std::unique_ptr<RenderObject> ParseRenderObject(const char* text,
+                                                size_t size) {
+  JsonStreamReader reader(text, size);
+  RenderObjectDesc desc;
+  if (!ParseRenderObjectDesc(reader, &desc)) {
+    printf("parsing render object error\n");
+    return nullptr;
+  }
+  return CreateRenderObjectFromDesc(desc);
+}
+
+bool ReadRenderObjectFile(const std::string& path, std::string* text) {
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  if (!ifs) {
+    printf("open file error: %s\n", path.c_str());
+    return false;
+  }
+  // JsonStreamReader relies on the terminating NUL of std::string.
+  text->assign(static_cast<size_t>(ifs.tellg()), '\0');
+  ifs.seekg(0);
+  ifs.read(&(*text)[0], text->size());
+  return bool(ifs);
+}
+
+std::unique_ptr<RenderObject> ParseRenderObjectFromFile(
+    const std::string& path) {
+  std::string text;
+  if (!ReadRenderObjectFile(path, &text)) {
+    return nullptr;
+  }
+  auto object = ParseRenderObject(text.c_str(), text.size());
+  if (!object) {
+    printf("parsing file error: %s\n", path.c_str());
+  }
+  return object;
+}
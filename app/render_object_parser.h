@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "app/RenderObject.h"
+
+// Single pass parser for the map file render object schema. Reads `type`,
+// `draw_info`, `mesh` and `sub_mesh` in document order and base64 decodes
+// mesh attributes straight into the mesh vectors, without building a
+// nlohmann::json DOM. Unknown keys are skipped.
+//
+// Returns nullptr and prints the reason on malformed input, mesh attributes
+// that are not base64 encoded or unknown types.
+std::unique_ptr<RenderObject> ParseRenderObject(const char* text,
+                                                size_t size);
+std::unique_ptr<RenderObject> ParseRenderObjectFromFile(
+    const std::string& path);
+
+// Reads a whole map file for ParseRenderObject, returns false on I/O error.
+bool ReadRenderObjectFile(const std::string& path, std::string* text);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdlib>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Spline the roaming camera of the sample follows, shared with the
+// benchmarks that replay its path.
+
+// 初始化Spline的控制点和对应的时间
+inline void InitSpline(const float radius, const int pointsCount,
+                       const float camera_speed_,
+                       std::vector<glm::vec3>& points,
+                       std::vector<float>& times,
+                       std::vector<glm::vec3>& tangents) {
+  srand(1000);
+  // 随机生成控制点
+  for (int i = 0; i < pointsCount; i++) {
+    float x = static_cast<float>(rand() % 200 - 100) / 100.0f;
+    float y = static_cast<float>(rand() % 200 - 100) / 100.0f;
+    float z = static_cast<float>(rand() % 200) / 200.0f;
+    glm::vec3 point = glm::normalize(glm::vec3(x, y, z)) * radius;
+    points.push_back(point);
+  }
+
+  // 计算切线向量
+  for (int i = 0; i < points.size(); i++) {
+    glm::vec3 tangent;
+    if (i == 0) {
+      tangent = glm::normalize(points[i + 1] - points[i]);
+    } else if (i == points.size() - 1) {
+      tangent = glm::normalize(points[i] - points[i - 1]);
+    } else {
+      tangent = glm::normalize((points[i + 1] - points[i - 1]) / 2.0f);
+    }
+
+    tangents.push_back(tangent);
+  }
+
+  // 计算每个控制点对应的时间值
+  float time = 0.0;
+  for (int i = 0; i < points.size() - 1; i++) {
+    times.push_back(time);
+    float distance = glm::length(points[i + 1] - points[i]);
+    time += distance / camera_speed_;
+  }
+}
+
+// 根据给定的时间值，计算摄像机的位置和方向
+inline void ComputeCameraPosition(const float time,
+                                  const std::vector<glm::vec3>& points,
+                                  const std::vector<float>& times,
+                                  const std::vector<glm::vec3>& tangents,
+                                  glm::vec3& position, glm::vec3& front) {
+  // 保证时间值在合法范围内
+  float T = glm::clamp(glm::mod(time, times.back()), 0.0f, times.back());
+
+  // 找到time对应的区间
+  int i = 0;
+  while (T > times[i]) {
+    i++;
+  }
+
+  // 根据控制点和切线向量计算插值系数
+  float t = (T - times[i - 1]) / (times[i] - times[i - 1]);
+  glm::vec3 p0 = points[i - 1];
+  glm::vec3 p1 = points[i];
+  glm::vec3 m0 = tangents[i - 1] * (times[i] - times[i - 1]);
+  glm::vec3 m1 = tangents[i] * (times[i] - times[i - 1]);
+  float t2 = t * t;
+  float t3 = t2 * t;
+  glm::vec3 A = 2.0f * p0 - 2.0f * p1 + m0 + m1;
+  glm::vec3 B = -3.0f * p0 + 3.0f * p1 - 2.0f * m0 - m1;
+  glm::vec3 C = m0;
+  glm::vec3 D = p0;
+
+  // 计算摄像机的位置和方向
+  position = A * t3 + B * t2 + C * t + D;
+  glm::vec3 dir = glm::mix(tangents[i - 1], tangents[i], t);
+  dir.z = -glm::abs(dir.z);
+  front = glm::normalize(dir);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#include "app/extension_command_list.h"
+
+// Appends packed command tokens to memory owned by the caller, typically a
+// range of a persistently mapped buffer. A writer constructed without memory
+// only counts bytes: running the same emission code through one first gives
+// the exact size to reserve, so the two passes can not disagree.
+class TokenStreamWriter {
+ public:
+  // Sizing pass.
+  explicit TokenStreamWriter(const CommandTokenHeaders* headers)
+      : headers_(headers) {}
+  // Writes at most |capacity| bytes to |buffer|.
+  TokenStreamWriter(const CommandTokenHeaders* headers, void* buffer,
+                    size_t capacity)
+      : headers_(headers),
+        buffer_(static_cast<char*>(buffer)),
+        capacity_(capacity) {}
+
+  // Typed tokens, the headers come from the resolved CommandTokenHeaders.
+  void UniformAddress(ushort index, ushort stage, GLuint64 address) {
+    Write(UniformAddressCommandNV{Header<UniformAddressCommandNV>(), index,
+                                  stage, address});
+  }
+  void AttributeAddress(uint index, GLuint64 address) {
+    Write(AttributeAddressCommandNV{Header<AttributeAddressCommandNV>(), index,
+                                    address});
+  }
+  void ElementAddress(GLuint64 address, uint type_size) {
+    Write(ElementAddressCommandNV{Header<ElementAddressCommandNV>(), address,
+                                  type_size});
+  }
+  void LineWidth(float width) {
+    Write(LineWidthCommandNV{Header<LineWidthCommandNV>(), width});
+  }
+  void DrawElementsInstanced(GLenum mode, uint count, uint instance_count,
+                             uint first_index, uint base_vertex,
+                             uint base_instance) {
+    Write(DrawElementsInstancedCommandNV{
+        Header<DrawElementsInstancedCommandNV>(), mode, count, instance_count,
+        first_index, base_vertex, base_instance});
+  }
+  void DrawArraysInstanced(GLenum mode, uint count, uint instance_count,
+                           uint first, uint base_instance) {
+    Write(DrawArraysInstancedCommandNV{Header<DrawArraysInstancedCommandNV>(),
+                                       mode, count, instance_count, first,
+                                       base_instance});
+  }
+
+  // Writes any token, |command| has its header set already.
+  template <typename Command>
+  void Write(const Command& command) {
+    static_assert(std::is_trivially_copyable<Command>::value,
+                  "tokens are copied bytewise");
+    static_assert(sizeof(Command) % 4 == 0, "tokens are 4 byte aligned");
+    if (buffer_) {
+      assert(size_ + sizeof(Command) <= capacity_);
+      memcpy(buffer_ + size_, &command, sizeof(Command));
+    }
+    size_ += sizeof(Command);
+  }
+
+  template <typename Command>
+  uint Header() const {
+    return headers_->header<Command>();
+  }
+
+  const CommandTokenHeaders& headers() const { return *headers_; }
+  bool sizing() const { return buffer_ == nullptr; }
+  // Bytes written, or counted in the sizing pass.
+  size_t size() const { return size_; }
+
+ private:
+  const CommandTokenHeaders* headers_;
+  char* buffer_ = nullptr;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+};
@@ -0,0 +1,73 @@
+#version 460 core
+
+#include "common.h"
+
+// Second pass of the indirect commands culled by cull_draws.comp.glsl with
+// CULL_INDIRECT. One work group per batch runs a prefix sum over the
+// visibility of its draws and writes the visible commands to the start of
+// the batch in their compiled order, so draws at the same depth, such as road
+// markings on a road surface, are drawn in the same order every frame.
+
+layout(local_size_x = CULL_GROUP_SIZE) in;
+
+layout(std430, binding = SSBO_CULL_DRAWS) readonly buffer drawsBuffer {
+  CullDraw draws[];
+};
+
+layout(std430, binding = SSBO_CULL_BATCHES) readonly buffer batchesBuffer {
+  CullBatch batches[];
+};
+
+layout(std430, binding = SSBO_CULL_VISIBILITY) readonly buffer
+    visibilityBuffer {
+  uint visibility[];
+};
+
+// CULL_COMMAND_WORDS per draw, as cull_draws.comp.glsl wrote them.
+layout(std430, binding = SSBO_CULL_COMMANDS) readonly buffer commandsBuffer {
+  uint commands[];
+};
+
+layout(std430, binding = SSBO_CULL_OUTPUT) writeonly buffer outputBuffer {
+  uint words[];
+};
+
+layout(std430, binding = SSBO_CULL_COUNTS) writeonly buffer countsBuffer {
+  uint counts[];
+};
+
+shared uint scan[CULL_GROUP_SIZE];
+
+void main() {
+  uint thread = gl_LocalInvocationID.x;
+  CullBatch batch = batches[gl_WorkGroupID.x];
+  uint visible_count = 0u;
+  for (uint base = 0u; base < batch.draw_count; base += CULL_GROUP_SIZE) {
+    uint index = batch.first_draw + base + thread;
+    uint visible =
+        base + thread < batch.draw_count ? visibility[index] : 0u;
+    // Inclusive scan of the visibility of this run of draws.
+    scan[thread] = visible;
+    barrier();
+    for (uint stride = 1u; stride < CULL_GROUP_SIZE; stride <<= 1u) {
+      uint value = thread >= stride ? scan[thread - stride] : 0u;
+      barrier();
+      scan[thread] += value;
+      barrier();
+    }
+    if (visible != 0u) {
+      uint word_count = draws[index].word_count;
+      uint slot = visible_count + scan[thread] - 1u;
+      uint offset = draws[index].offset + slot * word_count;
+      for (uint i = 0u; i < word_count; ++i) {
+        words[offset + i] = commands[index * CULL_COMMAND_WORDS + i];
+      }
+    }
+    visible_count += scan[CULL_GROUP_SIZE - 1];
+    // The next run overwrites scan.
+    barrier();
+  }
+  if (thread == 0u) {
+    counts[gl_WorkGroupID.x] = visible_count;
+  }
+}
@@ -0,0 +1,147 @@
+#version 460 core
+
+#include "common.h"
+
+// Tests one draw per invocation against the view frustum and the depth
+// pyramid of the previous frame, then writes its command back at the level of
+// detail of its screen size: the draw token or NOP tokens in place, or with
+// CULL_INDIRECT the visibility of the draw and the indirect command at its
+// index, for compact_draws.comp.glsl to move into its batch.
+
+layout(local_size_x = CULL_GROUP_SIZE) in;
+
+layout(std430, binding = SSBO_CULL_BOUNDS) readonly buffer boundsBuffer {
+  CullBounds bounds[];
+};
+
+layout(std430, binding = SSBO_CULL_DRAWS) readonly buffer drawsBuffer {
+  CullDraw draws[];
+};
+
+layout(std430, binding = SSBO_CULL_OUTPUT) writeonly buffer outputBuffer {
+  uint words[];
+};
+
+#ifdef CULL_INDIRECT
+layout(std430, binding = SSBO_CULL_VISIBILITY) writeonly buffer
+    visibilityBuffer {
+  uint visibility[];
+};
+#endif
+
+// Farthest depth, levels halve down to 1x1.
+layout(binding = TEXTURE_CULL_DEPTH) uniform sampler2D depth_pyramid;
+
+layout(location = 0) uniform vec4 frustum_planes[6];
+// The view projection the depth pyramid was drawn with.
+layout(location = 6) uniform mat4 occlusion_view_projection;
+// 0 without a depth pyramid.
+layout(location = 7) uniform int depth_pyramid_levels;
+layout(location = 8) uniform uint draw_count;
+layout(location = 9) uniform uint nop_header;
+layout(location = 10) uniform vec3 eye_position;
+// Pixels per unit at distance 1, 0 draws level 0 only.
+layout(location = 11) uniform float lod_scale;
+
+// Same test as Frustum::Classify, the corner farthest along each plane.
+bool OutsideFrustum(vec3 box_min, vec3 box_max) {
+  for (int i = 0; i < 6; ++i) {
+    vec4 plane = frustum_planes[i];
+    vec3 far_corner = mix(box_min, box_max, greaterThan(plane.xyz, vec3(0.0)));
+    if (dot(plane.xyz, far_corner) + plane.w < 0.0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Compares the nearest depth of the box with the farthest depth under its
+// screen rectangle, read from the level where the rectangle spans at most
+// 2x2 texels.
+bool Occluded(vec3 box_min, vec3 box_max) {
+  if (depth_pyramid_levels == 0) {
+    return false;
+  }
+  vec3 ndc_min = vec3(1.0e30);
+  vec3 ndc_max = vec3(-1.0e30);
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner = vec3((i & 1) != 0 ? box_max.x : box_min.x,
+                       (i & 2) != 0 ? box_max.y : box_min.y,
+                       (i & 4) != 0 ? box_max.z : box_min.z);
+    vec4 clip = occlusion_view_projection * vec4(corner, 1.0);
+    // Crossing the eye plane, the projection is unbounded.
+    if (clip.w <= 0.0) {
+      return false;
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    ndc_min = min(ndc_min, ndc);
+    ndc_max = max(ndc_max, ndc);
+  }
+  vec2 size = vec2(textureSize(depth_pyramid, 0));
+  vec2 pixel_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0) * size;
+  vec2 pixel_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0) * size;
+  vec2 extent = pixel_max - pixel_min;
+  int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0,
+                    depth_pyramid_levels - 1);
+  // The last texel of a level covers what odd sizes leave over.
+  ivec2 last = textureSize(depth_pyramid, level) - 1;
+  ivec2 texel_min = min(ivec2(pixel_min) >> level, last);
+  ivec2 texel_max = min(ivec2(pixel_max) >> level, last);
+  float depth = 0.0;
+  for (int i = 0; i < 4; ++i) {
+    ivec2 texel = ivec2((i & 1) != 0 ? texel_max.x : texel_min.x,
+                        (i & 2) != 0 ? texel_max.y : texel_min.y);
+    depth = max(depth, texelFetch(depth_pyramid, texel, level).r);
+  }
+  return ndc_min.z * 0.5 + 0.5 > depth;
+}
+
+// Same as SelectMeshLod with ProjectedScreenSize in core/mesh_lod.h.
+uint SelectLod(CullDraw draw, vec3 box_min, vec3 box_max) {
+  vec3 nearest = clamp(eye_position, box_min, box_max);
+  float distance = length(eye_position - nearest);
+  if (lod_scale <= 0.0 || distance <= 0.0 || draw.lod_count < 2u) {
+    return 0u;
+  }
+  float screen_size = length(box_max - box_min) * lod_scale / distance;
+  for (uint level = draw.lod_count - 1u; level > 0u; --level) {
+    if (screen_size <= draw.lod_screen_sizes[level]) {
+      return level;
+    }
+  }
+  return 0u;
+}
+
+void main() {
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= draw_count) {
+    return;
+  }
+  CullDraw draw = draws[index];
+  CullBounds box = bounds[draw.bounds_index];
+  bool visible = !OutsideFrustum(box.box_min.xyz, box.box_max.xyz) &&
+                 !Occluded(box.box_min.xyz, box.box_max.xyz);
+  uint command[CULL_COMMAND_WORDS] = draw.words;
+  uint level = visible ? SelectLod(draw, box.box_min.xyz, box.box_max.xyz)
+                       : 0u;
+  if (level > 0u) {
+    command[draw.first_word] += draw.lod_firsts[level];
+    command[draw.count_word] = draw.lod_counts[level];
+  }
+
+#ifdef CULL_INDIRECT
+  visibility[index] = visible ? 1u : 0u;
+  if (!visible) {
+    return;
+  }
+  for (uint i = 0u; i < draw.word_count; ++i) {
+    words[index * CULL_COMMAND_WORDS + i] = command[i];
+  }
+#else
+  // A NOP token is one word, a run of them has the size of the draw token
+  // so the tokens after it stay where they are.
+  for (uint i = 0u; i < draw.word_count; ++i) {
+    words[draw.offset + i] = visible ? command[i] : nop_header;
+  }
+#endif
+}
@@ -0,0 +1,45 @@
+#version 460 core
+
+#include "common.h"
+
+// Writes one level of the depth pyramid culling tests occlusion against, the
+// farthest depth of the texels below each texel. With DEPTH_PYRAMID_RESOLVE
+// level 0 from the samples of the multisampled depth buffer, otherwise a
+// level from the one above it.
+
+layout(local_size_x = DEPTH_PYRAMID_GROUP_SIZE,
+       local_size_y = DEPTH_PYRAMID_GROUP_SIZE) in;
+
+#ifdef DEPTH_PYRAMID_RESOLVE
+layout(binding = TEXTURE_CULL_DEPTH) uniform sampler2DMS depth_texture;
+#else
+layout(binding = IMAGE_DEPTH_SOURCE, r32f) readonly uniform image2D source;
+#endif
+layout(binding = IMAGE_DEPTH_TARGET, r32f) writeonly uniform image2D target;
+
+void main() {
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(target);
+  if (any(greaterThanEqual(texel, size))) {
+    return;
+  }
+  float depth = 0.0;
+#ifdef DEPTH_PYRAMID_RESOLVE
+  for (int i = 0; i < textureSamples(depth_texture); ++i) {
+    depth = max(depth, texelFetch(depth_texture, texel, i).r);
+  }
+#else
+  // The last texel of a level also covers the row or column an odd source
+  // size leaves over.
+  ivec2 source_size = imageSize(source);
+  ivec2 first = texel * 2;
+  ivec2 last = first + 1 + ivec2(equal(texel, size - 1)) * (source_size & 1);
+  last = min(last, source_size - 1);
+  for (int y = first.y; y <= last.y; ++y) {
+    for (int x = first.x; x <= last.x; ++x) {
+      depth = max(depth, imageLoad(source, ivec2(x, y)).r);
+    }
+  }
+#endif
+  imageStore(target, texel, vec4(depth));
+}
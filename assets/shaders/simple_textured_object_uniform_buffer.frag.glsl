@@ -9,8 +9,8 @@ void main() {
   float alpha = object.color.a;
   const float float_epsilon = 0.00001;
   if  (alpha > -float_epsilon && alpha < 1.0 + float_epsilon) {
-    color = vec4(vec3(texture(material.texture, texcoord)), alpha);  
+    color = vec4(vec3(texture(MATERIAL_TEXTURE, texcoord)), alpha);  
   } else {
-    color = texture(material.texture, texcoord);
+    color = texture(MATERIAL_TEXTURE, texcoord);
   }
 }
\ No newline at end of file
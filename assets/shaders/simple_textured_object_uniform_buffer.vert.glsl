@@ -8,6 +8,9 @@ layout(location=2) in vec2 in_texcoord;
 out vec2 texcoord;
 
 void main() {
+#ifdef OBJECT_INDEXED
+  object_index = OBJECT_INDEX;
+#endif
   gl_Position = scene.VP * (object.M * in_position);
   texcoord = in_texcoord;
 }
\ No newline at end of file
@@ -5,5 +5,8 @@
 layout (location = 0) in vec4 aPos;
 
 void main() {
+#ifdef OBJECT_INDEXED
+  object_index = OBJECT_INDEX;
+#endif
   gl_Position = scene.VP * (object.M * aPos);
 }
\ No newline at end of file
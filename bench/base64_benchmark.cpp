@@ -0,0 +1,165 @@
+// Decodes mesh sized base64 payloads with the original string based decoder
+// and every variant of the table driven one, checks that the outputs match
+// and prints the throughput of each.
+//
+//   make base64_benchmark && ./base64_benchmark
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "app/base64.h"
+
+namespace {
+
+using us = std::chrono::microseconds;
+
+// The decoder as it was before the table driven rewrite.
+const std::string kBase64Chars =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+bool IsBase64(unsigned char c) {
+  return (isalnum(c) || (c == '+') || (c == '/'));
+}
+
+std::string LegacyBase64Decode(std::string const& encoded_string) {
+  int in_len = encoded_string.size();
+  int i = 0;
+  int j = 0;
+  int in_ = 0;
+  unsigned char char_array_4[4], char_array_3[3];
+  std::string ret;
+
+  while (in_len-- && (encoded_string[in_] != '=') &&
+         IsBase64(encoded_string[in_])) {
+    char_array_4[i++] = encoded_string[in_];
+    in_++;
+    if (i == 4) {
+      for (i = 0; i < 4; i++)
+        char_array_4[i] = kBase64Chars.find(char_array_4[i]);
+
+      char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+      char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+      char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+      for (i = 0; (i < 3); i++) ret += char_array_3[i];
+      i = 0;
+    }
+  }
+
+  if (i) {
+    for (j = i; j < 4; j++) char_array_4[j] = 0;
+
+    for (j = 0; j < 4; j++)
+      char_array_4[j] = kBase64Chars.find(char_array_4[j]);
+
+    char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+    char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+    char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+
+    for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
+  }
+
+  return ret;
+}
+
+std::vector<std::string> MakePayloads(int count, std::mt19937& rng) {
+  // Vertex counts of typical lane lines and road polygons, 12 bytes each.
+  std::uniform_int_distribution<int> vertex_count(2, 4096);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<std::string> payloads;
+  for (int i = 0; i < count; ++i) {
+    std::vector<unsigned char> data(vertex_count(rng) * 12);
+    for (auto& c : data) {
+      c = byte(rng);
+    }
+    payloads.push_back(base64_encode(data.data(), data.size()));
+  }
+  return payloads;
+}
+
+bool CheckEdgeCases(Base64DecoderKind kind, std::mt19937& rng) {
+  std::uniform_int_distribution<int> any_char(0, 255);
+  std::vector<unsigned char> out;
+  for (int len = 0; len < 200; ++len) {
+    std::vector<unsigned char> data(len);
+    for (auto& c : data) {
+      c = any_char(rng);
+    }
+    std::string encoded = base64_encode(data.data(), data.size());
+    // Also check truncated input and garbage injected at random positions.
+    std::string variants[] = {encoded, encoded.substr(0, encoded.size() / 2),
+                              encoded};
+    if (!encoded.empty()) {
+      variants[2][any_char(rng) % encoded.size()] = char(any_char(rng));
+    }
+    for (const std::string& variant : variants) {
+      std::string expected = LegacyBase64Decode(variant);
+      out.assign(base64_decoded_max_size(variant.size()), 0);
+      size_t size = base64_decode(variant.data(), variant.size(), out.data(),
+                                  kind);
+      if (size != expected.size() ||
+          memcmp(out.data(), expected.data(), size) != 0) {
+        printf("mismatch for decoder %d, input length %d\n", kind,
+               int(variant.size()));
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Func>
+double MeasureMs(Func&& func) {
+  auto start = std::chrono::high_resolution_clock::now();
+  func();
+  auto finish = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<us>(finish - start).count() * 0.001;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  std::mt19937 rng(1000);
+  const int kPayloadCount = argc > 1 ? atoi(argv[1]) : 2000;
+  std::vector<std::string> payloads = MakePayloads(kPayloadCount, rng);
+  size_t total_chars = 0;
+  for (const auto& payload : payloads) {
+    total_chars += payload.size();
+  }
+  printf("%d payloads, %.2f MB encoded, best decoder: %d\n", kPayloadCount,
+         total_chars / 1024.0 / 1024.0, base64_best_decoder());
+
+  size_t checksum = 0;
+  double legacy_ms = MeasureMs([&]() {
+    for (const auto& payload : payloads) {
+      checksum += LegacyBase64Decode(payload).size();
+    }
+  });
+  printf("%-10s %9.2f ms %9.2f MB/s\n", "legacy", legacy_ms,
+         total_chars / 1024.0 / 1024.0 / (legacy_ms * 0.001));
+
+  const char* names[] = {"scalar", "ssse3", "avx2"};
+  std::vector<unsigned char> out;
+  for (int kind = kBase64Scalar; kind <= base64_best_decoder(); ++kind) {
+    if (!CheckEdgeCases(static_cast<Base64DecoderKind>(kind), rng)) {
+      return 1;
+    }
+    double ms = MeasureMs([&]() {
+      for (const auto& payload : payloads) {
+        out.resize(base64_decoded_max_size(payload.size()));
+        checksum += base64_decode(payload.data(), payload.size(), out.data(),
+                                  static_cast<Base64DecoderKind>(kind));
+      }
+    });
+    printf("%-10s %9.2f ms %9.2f MB/s  x%.1f\n", names[kind], ms,
+           total_chars / 1024.0 / 1024.0 / (ms * 0.001), legacy_ms / ms);
+  }
+  printf("checksum: %zu\n", checksum);
+  return 0;
+}
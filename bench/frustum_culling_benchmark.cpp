@@ -0,0 +1,171 @@
+// Flies the roaming camera of the sample along its spline and culls the map
+// against the view frustum at each step, once by testing every box and once
+// through the BVH. Checks that both agree and prints cull times and visible
+// draw counts. Boxes come from the leaf meshes of a packed map tile when one
+// is given or present, otherwise a synthetic map is generated.
+//
+//   make frustum_culling_benchmark && ./frustum_culling_benchmark [tile.nvmt]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "app/roaming_spline.h"
+#include "core/bvh.h"
+#include "core/camera.h"
+#include "core/frustum.h"
+#include "core/map_tile.h"
+
+namespace {
+
+using us = std::chrono::microseconds;
+
+constexpr const char kMapTileFile[] = "assets/dumped_map_data.nvmt";
+// Same as the sample: spline, camera speed and projection.
+constexpr float kSplineRadius = 1000.0f;
+constexpr int kSplinePointCount = 200;
+constexpr float kCameraSpeed = 100.0f;
+constexpr float kAspect = 16.0f / 9.0f;
+constexpr int kStepCount = 1000;
+
+void AppendTileBoxes(const MapTile& tile, uint32_t node_index,
+                     std::vector<BoundingBox>* boxes) {
+  const MapTileNode& node = tile.node(node_index);
+  if (node.record == kMapTileInvalidIndex) {
+    for (uint32_t i = 0; i < node.child_count; ++i) {
+      AppendTileBoxes(tile, node.first_child + i, boxes);
+    }
+    return;
+  }
+  const MapTileMeshRecord& record = tile.record(node.record);
+  const float* positions =
+      static_cast<const float*>(tile.blob(record.position_offset));
+  BoundingBox box;
+  for (uint32_t i = 0; positions && i < record.vertex_count; ++i) {
+    box.Extend(glm::vec3(positions[i * 3], positions[i * 3 + 1],
+                         positions[i * 3 + 2]));
+  }
+  glm::mat4 world;
+  memcpy(&world, record.world_matrix, sizeof(world));
+  boxes->push_back(box.Transform(world));
+}
+
+bool LoadTileBoxes(const std::string& path, std::vector<BoundingBox>* boxes) {
+  MapTile tile;
+  if (!tile.Open(path)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < tile.root_count(); ++i) {
+    AppendTileBoxes(tile, i, boxes);
+  }
+  return true;
+}
+
+// Road sized boxes scattered over the area the spline flies over.
+std::vector<BoundingBox> MakeSyntheticBoxes(int count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> position(-3.0f * kSplineRadius,
+                                                 3.0f * kSplineRadius);
+  std::uniform_real_distribution<float> height(-5.0f, 5.0f);
+  std::uniform_real_distribution<float> size(1.0f, 60.0f);
+  std::vector<BoundingBox> boxes(count);
+  for (BoundingBox& box : boxes) {
+    glm::vec3 center(position(rng), position(rng), height(rng));
+    glm::vec3 extent(size(rng), size(rng), 0.5f);
+    box.Extend(center - extent);
+    box.Extend(center + extent);
+  }
+  return boxes;
+}
+
+double ElapsedMs(std::chrono::high_resolution_clock::time_point start) {
+  auto finish = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<us>(finish - start).count() * 0.001;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  std::string path = argc > 1 ? argv[1] : kMapTileFile;
+  std::vector<BoundingBox> boxes;
+  if (LoadTileBoxes(path, &boxes)) {
+    printf("%zu boxes from %s\n", boxes.size(), path.c_str());
+  } else {
+    std::mt19937 rng(1000);
+    boxes = MakeSyntheticBoxes(200000, rng);
+    printf("%zu synthetic boxes\n", boxes.size());
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  BoundingVolumeHierarchy bvh;
+  bvh.Build(boxes);
+  printf("bvh build: %.2f ms, %d nodes\n", ElapsedMs(start), bvh.node_count());
+
+  std::vector<glm::vec3> points;
+  std::vector<float> times;
+  std::vector<glm::vec3> tangents;
+  InitSpline(kSplineRadius, kSplinePointCount, kCameraSpeed, points, times,
+             tangents);
+  glm::mat4 projection =
+      glm::perspective(glm::radians(60.0f), kAspect, 0.01f, 30000.0f);
+
+  double brute_force_ms = 0.0;
+  double bvh_ms = 0.0;
+  double max_bvh_ms = 0.0;
+  size_t total_visible = 0;
+  size_t min_visible = boxes.size();
+  size_t max_visible = 0;
+  std::vector<uint32_t> visible;
+  for (int step = 0; step < kStepCount; ++step) {
+    float time = times.back() * step / kStepCount;
+    glm::vec3 position;
+    glm::vec3 direction;
+    ComputeCameraPosition(time, points, times, tangents, position, direction);
+    Camera camera;
+    float pitch = glm::degrees(glm::asin(direction.z));
+    float yaw = glm::degrees(std::atan2(direction.x, direction.y));
+    camera.set_look_pitch_yaw({pitch, yaw});
+    camera.set_target(position + direction * camera.distance());
+    Frustum frustum = Frustum::FromMatrix(projection * camera.view());
+
+    start = std::chrono::high_resolution_clock::now();
+    size_t brute_force_visible = 0;
+    for (const BoundingBox& box : boxes) {
+      if (!box.empty() && frustum.Classify(box) != Frustum::kOutside) {
+        ++brute_force_visible;
+      }
+    }
+    brute_force_ms += ElapsedMs(start);
+
+    visible.clear();
+    start = std::chrono::high_resolution_clock::now();
+    bvh.Cull(frustum, &visible);
+    double ms = ElapsedMs(start);
+    bvh_ms += ms;
+    max_bvh_ms = std::max(max_bvh_ms, ms);
+
+    if (visible.size() != brute_force_visible) {
+      printf("mismatch at step %d: bvh %zu, brute force %zu\n", step,
+             visible.size(), brute_force_visible);
+      return 1;
+    }
+    total_visible += visible.size();
+    min_visible = std::min(min_visible, visible.size());
+    max_visible = std::max(max_visible, visible.size());
+  }
+
+  printf("%d steps along the spline\n", kStepCount);
+  printf("visible draws: avg %zu, min %zu, max %zu of %zu\n",
+         total_visible / kStepCount, min_visible, max_visible, boxes.size());
+  printf("%-12s %9.3f ms/frame\n", "brute force", brute_force_ms / kStepCount);
+  printf("%-12s %9.3f ms/frame (max %.3f)  x%.1f\n", "bvh",
+         bvh_ms / kStepCount, max_bvh_ms, brute_force_ms / bvh_ms);
+  return 0;
+}
@@ -0,0 +1,213 @@
+// Builds the levels of detail of the line and stripe meshes of the map, then
+// flies the roaming camera of the sample along its spline and counts the
+// elements drawn for the meshes inside the view frustum, at level 0 and at
+// the level SelectMeshLod picks from their screen size. Meshes come from the
+// LineObject and DashedStripeObject leaves of a packed map tile when one is
+// given or present, otherwise synthetic lane lines and dashes are generated.
+//
+//   make mesh_lod_benchmark && ./mesh_lod_benchmark [tile.nvmt]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "app/roaming_spline.h"
+#include "core/camera.h"
+#include "core/frustum.h"
+#include "core/map_tile.h"
+#include "core/mesh.h"
+#include "core/mesh_lod.h"
+
+namespace {
+
+using us = std::chrono::microseconds;
+
+constexpr const char kMapTileFile[] = "assets/dumped_map_data.nvmt";
+// Same as the sample: spline, camera speed and projection.
+constexpr float kSplineRadius = 1000.0f;
+constexpr int kSplinePointCount = 200;
+constexpr float kCameraSpeed = 100.0f;
+constexpr float kFieldOfView = 60.0f;
+constexpr float kAspect = 16.0f / 9.0f;
+constexpr int kScreenHeight = 1080;
+constexpr int kStepCount = 1000;
+
+struct LodMesh {
+  Mesh mesh;
+  glm::mat4 world;
+  MeshLods lods;
+  BoundingBox bounds;
+};
+
+void AppendTileMeshes(const MapTile& tile, uint32_t node_index,
+                      std::vector<LodMesh>* meshes) {
+  const MapTileNode& node = tile.node(node_index);
+  if (node.record == kMapTileInvalidIndex) {
+    for (uint32_t i = 0; i < node.child_count; ++i) {
+      AppendTileMeshes(tile, node.first_child + i, meshes);
+    }
+    return;
+  }
+  std::string type = tile.string(node.type);
+  if (type != "LineObject" && type != "DashedStripeObject") {
+    return;
+  }
+  const MapTileMeshRecord& record = tile.record(node.record);
+  LodMesh mesh;
+  mesh.mesh = Mesh::SerializeFromMapTile(tile, record);
+  memcpy(&mesh.world, record.world_matrix, sizeof(mesh.world));
+  meshes->push_back(std::move(mesh));
+}
+
+bool LoadTileMeshes(const std::string& path, std::vector<LodMesh>* meshes) {
+  MapTile tile;
+  if (!tile.Open(path)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < tile.root_count(); ++i) {
+    AppendTileMeshes(tile, i, meshes);
+  }
+  return true;
+}
+
+// Gently curving lane lines sampled every meter as line strips, and dashed
+// stripes along them as separate quads.
+std::vector<LodMesh> MakeSyntheticMeshes(int count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> position(-3.0f * kSplineRadius,
+                                                 3.0f * kSplineRadius);
+  std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+  std::uniform_real_distribution<float> curvature(-0.002f, 0.002f);
+  std::uniform_int_distribution<int> length(100, 1000);
+  std::vector<LodMesh> meshes(count);
+  for (int i = 0; i < count; ++i) {
+    glm::vec3 point(position(rng), position(rng), 0.0f);
+    float heading = angle(rng);
+    float turn = curvature(rng);
+    int point_count = length(rng);
+    std::vector<Mesh::PositionType> positions;
+    for (int j = 0; j < point_count; ++j) {
+      glm::vec3 direction(std::cos(heading), std::sin(heading), 0.0f);
+      if (i % 2 == 0) {
+        positions.push_back(point);
+      } else if (j % 6 < 3) {
+        // 3m dashes, 3m gaps, 0.15m wide.
+        glm::vec3 side(-direction.y, direction.x, 0.0f);
+        glm::vec3 end = point + direction * 3.0f;
+        glm::vec3 corners[4] = {point - side * 0.075f, point + side * 0.075f,
+                                end - side * 0.075f, end + side * 0.075f};
+        for (int corner : {0, 1, 2, 1, 3, 2}) {
+          positions.push_back(corners[corner]);
+        }
+        point = end;
+        heading += turn * 3.0f;
+        j += 2;
+        continue;
+      }
+      point += direction;
+      heading += turn;
+    }
+    meshes[i].mesh.set_positions(std::move(positions));
+    meshes[i].mesh.set_draw_mode(i % 2 == 0 ? GL_LINE_STRIP : GL_TRIANGLES);
+    meshes[i].world = glm::mat4(1.0f);
+  }
+  return meshes;
+}
+
+double ElapsedMs(std::chrono::high_resolution_clock::time_point start) {
+  auto finish = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<us>(finish - start).count() * 0.001;
+}
+
+}  // namespace
+
+int main(int argc, const char** argv) {
+  std::string path = argc > 1 ? argv[1] : kMapTileFile;
+  std::vector<LodMesh> meshes;
+  if (LoadTileMeshes(path, &meshes)) {
+    printf("%zu line and stripe meshes from %s\n", meshes.size(),
+           path.c_str());
+  } else {
+    std::mt19937 rng(1000);
+    meshes = MakeSyntheticMeshes(20000, rng);
+    printf("%zu synthetic line and stripe meshes\n", meshes.size());
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (LodMesh& mesh : meshes) {
+    mesh.lods = BuildMeshLods(mesh.mesh);
+  }
+  printf("lod build: %.2f ms\n", ElapsedMs(start));
+
+  size_t level_elements[MAX_MESH_LODS] = {};
+  int level_meshes[MAX_MESH_LODS] = {};
+  for (LodMesh& mesh : meshes) {
+    for (size_t level = 0; level < mesh.lods.levels.size(); ++level) {
+      level_elements[level] += mesh.lods.levels[level].count;
+      ++level_meshes[level];
+    }
+    BoundingBox bounds;
+    for (const Mesh::PositionType& position : mesh.mesh.positions()) {
+      bounds.Extend(position);
+    }
+    mesh.bounds = bounds.Transform(mesh.world);
+  }
+  for (int level = 0; level < MAX_MESH_LODS; ++level) {
+    printf("level %d: %6d meshes, %10zu elements\n", level,
+           level_meshes[level], level_elements[level]);
+  }
+
+  std::vector<glm::vec3> points;
+  std::vector<float> times;
+  std::vector<glm::vec3> tangents;
+  InitSpline(kSplineRadius, kSplinePointCount, kCameraSpeed, points, times,
+             tangents);
+  glm::mat4 projection = glm::perspective(glm::radians(kFieldOfView), kAspect,
+                                          0.01f, 30000.0f);
+  float lod_scale =
+      kScreenHeight / (2.0f * std::tan(glm::radians(kFieldOfView) * 0.5f));
+
+  size_t full_elements = 0;
+  size_t lod_elements = 0;
+  size_t visible_meshes = 0;
+  for (int step = 0; step < kStepCount; ++step) {
+    // Mid step, ComputeCameraPosition needs a time after the first point.
+    float time = times.back() * (step + 0.5f) / kStepCount;
+    glm::vec3 position;
+    glm::vec3 direction;
+    ComputeCameraPosition(time, points, times, tangents, position, direction);
+    Camera camera;
+    float pitch = glm::degrees(glm::asin(direction.z));
+    float yaw = glm::degrees(std::atan2(direction.x, direction.y));
+    camera.set_look_pitch_yaw({pitch, yaw});
+    camera.set_target(position + direction * camera.distance());
+    Frustum frustum = Frustum::FromMatrix(projection * camera.view());
+
+    for (const LodMesh& mesh : meshes) {
+      if (mesh.bounds.empty() ||
+          frustum.Classify(mesh.bounds) == Frustum::kOutside) {
+        continue;
+      }
+      int level = SelectMeshLod(
+          mesh.lods.levels,
+          ProjectedScreenSize(mesh.bounds, camera.position(), lod_scale));
+      full_elements += mesh.lods.levels[0].count;
+      lod_elements += mesh.lods.levels[level].count;
+      ++visible_meshes;
+    }
+  }
+
+  printf("%d steps along the spline, %zu visible meshes per frame\n",
+         kStepCount, visible_meshes / kStepCount);
+  printf("%-8s %10zu elements/frame\n", "full", full_elements / kStepCount);
+  printf("%-8s %10zu elements/frame  x%.1f fewer\n", "lod",
+         lod_elements / kStepCount,
+         lod_elements ? double(full_elements) / lod_elements : 0.0);
+  return 0;
+}
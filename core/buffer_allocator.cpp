@@ -0,0 +1,400 @@
+#include "core/buffer_allocator.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+// Index of the lowest set bit, |value| must not be 0.
+int FindFirstSet(uint32_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return index;
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+// Index of the highest set bit, |value| must not be 0.
+int FindLastSet(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return index;
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+int64_t AlignOffset(int64_t offset, int32_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+BufferAllocatorStats& BufferAllocatorStats::operator+=(
+    const BufferAllocatorStats& other) {
+  capacity += other.capacity;
+  used_size += other.used_size;
+  free_size += other.free_size;
+  largest_free_range = std::max(largest_free_range, other.largest_free_range);
+  free_range_count += other.free_range_count;
+  allocation_count += other.allocation_count;
+  return *this;
+}
+
+const int32_t BufferAllocator::kInvalidOffset;
+
+BufferAllocator::BufferAllocator(int32_t capacity) : capacity_(capacity) {
+  assert(capacity_ > 0);
+}
+
+std::unique_ptr<BufferAllocator> CreateBufferAllocator(BufferAllocatorType type,
+                                                       int32_t capacity) {
+  switch (type) {
+    case kFirstFitAllocator:
+      return std::make_unique<FirstFitBufferAllocator>(capacity);
+    case kSegregatedFitAllocator:
+      return std::make_unique<SegregatedFitBufferAllocator>(capacity);
+  }
+  return nullptr;
+}
+
+FirstFitBufferAllocator::FirstFitBufferAllocator(int32_t capacity) : BufferAllocator(capacity) {
+  free_ranges_.push_back({0, capacity});
+  skip_list_.insert({0, free_ranges_.begin()});
+}
+
+int32_t FirstFitBufferAllocator::Alloc(int32_t size, int32_t alignment) {
+  assert(alignment > 0);
+  // Find first range that can fit the size.
+  auto iter = std::find_if(free_ranges_.begin(), free_ranges_.end(), [size, alignment](const Range& range) {
+    return AlignOffset(range.offset, alignment) - range.offset + size <= range.size;
+  });
+
+  if (iter == free_ranges_.end()) {
+    return kInvalidOffset;
+  }
+
+  Range range = *iter;
+  iter = free_ranges_.erase(iter);
+  skip_list_.erase(range.offset);
+
+  int32_t offset = AlignOffset(range.offset, alignment);
+  // Alignment padding stays free in front of the allocation.
+  Range front = {range.offset, offset - range.offset};
+  Range back = {offset + size, range.offset + range.size - offset - size};
+
+  if (back.size > 0) {
+    iter = free_ranges_.insert(iter, back);
+    skip_list_[back.offset] = iter;
+  }
+  if (front.size > 0) {
+    iter = free_ranges_.insert(iter, front);
+    skip_list_[front.offset] = iter;
+  }
+
+  used_size_ += size;
+  ++allocation_count_;
+  return offset;
+}
+
+void FirstFitBufferAllocator::Free(int32_t offset, int32_t size) {
+  used_size_ -= size;
+  --allocation_count_;
+
+  // Find insert position.
+  std::list<Range>::iterator iter = free_ranges_.end();
+  auto skip_iter = skip_list_.lower_bound(offset);
+  if (skip_iter != skip_list_.end()) {
+    iter = skip_iter->second;
+  }
+
+  Range range = {offset, size};
+
+  if (iter != free_ranges_.begin()) {
+    auto prev_iter = std::prev(iter);
+    if (prev_iter->offset + prev_iter->size == range.offset) {
+      range.offset = prev_iter->offset;
+      range.size += prev_iter->size;
+      free_ranges_.erase(prev_iter);
+      skip_list_.erase(range.offset);
+    }
+  }
+
+  if (iter != free_ranges_.end()) {
+    if (range.offset + range.size == iter->offset) {
+      range.size += iter->size;
+      skip_list_.erase(iter->offset);
+      iter = free_ranges_.erase(iter);
+    }
+  }
+
+  iter = free_ranges_.insert(iter, range);
+  skip_list_[range.offset] = iter;
+}
+
+BufferAllocatorStats FirstFitBufferAllocator::stats() const {
+  BufferAllocatorStats stats;
+  stats.capacity = capacity();
+  stats.used_size = used_size_;
+  stats.allocation_count = allocation_count_;
+  for (const Range& range : free_ranges_) {
+    stats.free_size += range.size;
+    stats.largest_free_range =
+        std::max<int64_t>(stats.largest_free_range, range.size);
+    ++stats.free_range_count;
+  }
+  return stats;
+}
+
+constexpr int SegregatedFitBufferAllocator::kSecondLevelLog2;
+constexpr int SegregatedFitBufferAllocator::kSecondLevelCount;
+constexpr int SegregatedFitBufferAllocator::kFirstLevelCount;
+constexpr int32_t SegregatedFitBufferAllocator::kNoRange;
+
+SegregatedFitBufferAllocator::SegregatedFitBufferAllocator(int32_t capacity)
+    : BufferAllocator(capacity) {
+  std::fill(&free_heads_[0][0],
+            &free_heads_[0][0] + kFirstLevelCount * kSecondLevelCount,
+            kNoRange);
+  int32_t index = NewRange();
+  ranges_[index].offset = 0;
+  ranges_[index].size = capacity;
+  InsertFreeRange(index);
+}
+
+void SegregatedFitBufferAllocator::MappingInsert(int64_t size,
+                                                 int* first_level,
+                                                 int* second_level) {
+  if (size < kSecondLevelCount) {
+    *first_level = 0;
+    *second_level = static_cast<int>(size);
+    return;
+  }
+  int last_bit = FindLastSet(size);
+  *second_level = static_cast<int>(size >> (last_bit - kSecondLevelLog2)) -
+                  kSecondLevelCount;
+  *first_level = last_bit - kSecondLevelLog2 + 1;
+}
+
+void SegregatedFitBufferAllocator::MappingSearch(int64_t size,
+                                                 int* first_level,
+                                                 int* second_level) {
+  if (size >= kSecondLevelCount) {
+    size += (int64_t(1) << (FindLastSet(size) - kSecondLevelLog2)) - 1;
+  }
+  MappingInsert(size, first_level, second_level);
+}
+
+int32_t SegregatedFitBufferAllocator::FindFreeRange(int64_t size) const {
+  int first_level;
+  int second_level;
+  MappingSearch(size, &first_level, &second_level);
+  if (first_level >= kFirstLevelCount) {
+    return kNoRange;
+  }
+
+  uint32_t second_level_map =
+      second_level_bitmap_[first_level] & (~0u << second_level);
+  if (!second_level_map) {
+    uint32_t first_level_map =
+        first_level + 1 < 32 ? first_level_bitmap_ & (~0u << (first_level + 1))
+                             : 0;
+    if (!first_level_map) {
+      return kNoRange;
+    }
+    first_level = FindFirstSet(first_level_map);
+    second_level_map = second_level_bitmap_[first_level];
+  }
+  second_level = FindFirstSet(second_level_map);
+  return free_heads_[first_level][second_level];
+}
+
+int32_t SegregatedFitBufferAllocator::FindFreeRangeInClass(
+    int32_t size, int32_t alignment) const {
+  int first_level;
+  int second_level;
+  MappingInsert(size, &first_level, &second_level);
+  for (int32_t index = free_heads_[first_level][second_level];
+       index != kNoRange; index = ranges_[index].next_free) {
+    const Range& range = ranges_[index];
+    if (AlignOffset(range.offset, alignment) - range.offset + size <=
+        range.size) {
+      return index;
+    }
+  }
+  return kNoRange;
+}
+
+void SegregatedFitBufferAllocator::InsertFreeRange(int32_t index) {
+  int first_level;
+  int second_level;
+  MappingInsert(ranges_[index].size, &first_level, &second_level);
+
+  Range& range = ranges_[index];
+  int32_t& head = free_heads_[first_level][second_level];
+  range.free = true;
+  range.prev_free = kNoRange;
+  range.next_free = head;
+  if (head != kNoRange) {
+    ranges_[head].prev_free = index;
+  }
+  head = index;
+  first_level_bitmap_ |= 1u << first_level;
+  second_level_bitmap_[first_level] |= 1u << second_level;
+  ++free_range_count_;
+}
+
+void SegregatedFitBufferAllocator::RemoveFreeRange(int32_t index) {
+  int first_level;
+  int second_level;
+  MappingInsert(ranges_[index].size, &first_level, &second_level);
+
+  Range& range = ranges_[index];
+  if (range.prev_free != kNoRange) {
+    ranges_[range.prev_free].next_free = range.next_free;
+  }
+  if (range.next_free != kNoRange) {
+    ranges_[range.next_free].prev_free = range.prev_free;
+  }
+  int32_t& head = free_heads_[first_level][second_level];
+  if (head == index) {
+    head = range.next_free;
+    if (head == kNoRange) {
+      second_level_bitmap_[first_level] &= ~(1u << second_level);
+      if (!second_level_bitmap_[first_level]) {
+        first_level_bitmap_ &= ~(1u << first_level);
+      }
+    }
+  }
+  range.free = false;
+  range.prev_free = kNoRange;
+  range.next_free = kNoRange;
+  --free_range_count_;
+}
+
+int32_t SegregatedFitBufferAllocator::SplitBack(int32_t index, int32_t size) {
+  int32_t back = NewRange();
+  Range& range = ranges_[index];
+  Range& back_range = ranges_[back];
+  back_range.offset = range.offset + size;
+  back_range.size = range.size - size;
+  back_range.prev_physical = index;
+  back_range.next_physical = range.next_physical;
+  if (range.next_physical != kNoRange) {
+    ranges_[range.next_physical].prev_physical = back;
+  }
+  range.next_physical = back;
+  range.size = size;
+  return back;
+}
+
+void SegregatedFitBufferAllocator::MergeNext(int32_t index) {
+  int32_t next = ranges_[index].next_physical;
+  Range& range = ranges_[index];
+  range.size += ranges_[next].size;
+  range.next_physical = ranges_[next].next_physical;
+  if (range.next_physical != kNoRange) {
+    ranges_[range.next_physical].prev_physical = index;
+  }
+  DeleteRange(next);
+}
+
+int32_t SegregatedFitBufferAllocator::NewRange() {
+  if (!unused_ranges_.empty()) {
+    int32_t index = unused_ranges_.back();
+    unused_ranges_.pop_back();
+    ranges_[index] = Range();
+    return index;
+  }
+  ranges_.emplace_back();
+  return ranges_.size() - 1;
+}
+
+void SegregatedFitBufferAllocator::DeleteRange(int32_t index) {
+  unused_ranges_.push_back(index);
+}
+
+int32_t SegregatedFitBufferAllocator::Alloc(int32_t size, int32_t alignment) {
+  assert(alignment > 0);
+  // Zero sized allocations still need a distinct offset to be freed by.
+  size = std::max(size, 1);
+  // Any range of the found class fits |size| at any alignment.
+  int32_t index = FindFreeRange(int64_t(size) + alignment - 1);
+  if (index == kNoRange) {
+    // Rounding up to the next class skips ranges of the class itself that
+    // may still fit, e.g. the whole block of a fresh allocator.
+    index = FindFreeRangeInClass(size, alignment);
+  }
+  if (index == kNoRange) {
+    return kInvalidOffset;
+  }
+  RemoveFreeRange(index);
+
+  int32_t padding =
+      AlignOffset(ranges_[index].offset, alignment) - ranges_[index].offset;
+  if (padding > 0) {
+    int32_t aligned = SplitBack(index, padding);
+    InsertFreeRange(index);
+    index = aligned;
+  }
+  if (ranges_[index].size > size) {
+    int32_t rest = SplitBack(index, size);
+    InsertFreeRange(rest);
+  }
+
+  allocations_[ranges_[index].offset] = index;
+  used_size_ += size;
+  return ranges_[index].offset;
+}
+
+void SegregatedFitBufferAllocator::Free(int32_t offset, int32_t /*size*/) {
+  auto iter = allocations_.find(offset);
+  if (iter == allocations_.end()) {
+    assert(false && "freeing an offset that is not allocated");
+    return;
+  }
+  int32_t index = iter->second;
+  allocations_.erase(iter);
+  used_size_ -= ranges_[index].size;
+
+  int32_t next = ranges_[index].next_physical;
+  if (next != kNoRange && ranges_[next].free) {
+    RemoveFreeRange(next);
+    MergeNext(index);
+  }
+  int32_t prev = ranges_[index].prev_physical;
+  if (prev != kNoRange && ranges_[prev].free) {
+    RemoveFreeRange(prev);
+    MergeNext(prev);
+    index = prev;
+  }
+  InsertFreeRange(index);
+}
+
+BufferAllocatorStats SegregatedFitBufferAllocator::stats() const {
+  BufferAllocatorStats stats;
+  stats.capacity = capacity();
+  stats.used_size = used_size_;
+  stats.free_size = capacity() - used_size_;
+  stats.free_range_count = free_range_count_;
+  stats.allocation_count = allocations_.size();
+  if (first_level_bitmap_) {
+    // The largest range is in the highest non empty class.
+    int first_level = FindLastSet(first_level_bitmap_);
+    int second_level = FindLastSet(second_level_bitmap_[first_level]);
+    for (int32_t index = free_heads_[first_level][second_level];
+         index != kNoRange; index = ranges_[index].next_free) {
+      stats.largest_free_range =
+          std::max<int64_t>(stats.largest_free_range, ranges_[index].size);
+    }
+  }
+  return stats;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Sub allocators for the ranges of one buffer block. They only do offset
+// book keeping and never touch GL, so they can be exercised on the CPU.
+
+struct BufferAllocatorStats {
+  int64_t capacity = 0;
+  int64_t used_size = 0;
+  int64_t free_size = 0;
+  int64_t largest_free_range = 0;
+  int32_t free_range_count = 0;
+  int32_t allocation_count = 0;
+
+  // 0 when all free space is one range, approaching 1 when it is scattered
+  // over many small ranges.
+  float fragmentation() const {
+    return free_size ? 1.0f - float(largest_free_range) / float(free_size)
+                     : 0.0f;
+  }
+
+  BufferAllocatorStats& operator+=(const BufferAllocatorStats& other);
+};
+
+class BufferAllocator {
+ public:
+  static const int32_t kInvalidOffset = -1;
+  explicit BufferAllocator(int32_t capacity);
+  virtual ~BufferAllocator() = default;
+
+  // Returns an offset in the buffer that is a multiple of |alignment| (any
+  // positive value, e.g. a vertex stride) if allocation succeeds, otherwise
+  // returns kInvalidOffset.
+  virtual int32_t Alloc(int32_t size, int32_t alignment) = 0;
+  int32_t Alloc(int32_t size) { return Alloc(size, 1); }
+  // Frees the buffer usage at the given offset.
+  virtual void Free(int32_t offset, int32_t size) = 0;
+
+  virtual BufferAllocatorStats stats() const = 0;
+
+  int32_t capacity() const { return capacity_; }
+
+ private:
+  const int32_t capacity_;
+};
+
+enum BufferAllocatorType {
+  kFirstFitAllocator = 0,
+  kSegregatedFitAllocator,
+};
+
+std::unique_ptr<BufferAllocator> CreateBufferAllocator(BufferAllocatorType type,
+                                                       int32_t capacity);
+
+class FirstFitBufferAllocator : public BufferAllocator {
+ public:
+  explicit FirstFitBufferAllocator(int32_t capacity);
+  ~FirstFitBufferAllocator() override = default;
+
+  using BufferAllocator::Alloc;
+  int32_t Alloc(int32_t size, int32_t alignment) override;
+  void Free(int32_t offset, int32_t size) override;
+
+  BufferAllocatorStats stats() const override;
+
+ private:
+  struct Range {
+    int32_t offset = 0;
+    int32_t size = 0;
+  };
+
+  std::list<Range> free_ranges_;
+  std::map<int32_t, std::list<Range>::iterator> skip_list_;
+  int64_t used_size_ = 0;
+  int32_t allocation_count_ = 0;
+};
+
+// Two level segregated fit allocator (TLSF). Free ranges are kept in lists
+// per size class, a first level class per power of two split linearly into
+// kSecondLevelCount second level classes, with a bitmap over the non empty
+// lists. Alloc and Free are O(1): a couple of bit scans plus list and hash
+// map updates; freed ranges are merged with their free neighbours at once.
+class SegregatedFitBufferAllocator : public BufferAllocator {
+ public:
+  explicit SegregatedFitBufferAllocator(int32_t capacity);
+  ~SegregatedFitBufferAllocator() override = default;
+
+  using BufferAllocator::Alloc;
+  int32_t Alloc(int32_t size, int32_t alignment) override;
+  // |size| is not needed, the allocation is looked up by offset.
+  void Free(int32_t offset, int32_t size) override;
+
+  BufferAllocatorStats stats() const override;
+
+ private:
+  static constexpr int kSecondLevelLog2 = 5;
+  static constexpr int kSecondLevelCount = 1 << kSecondLevelLog2;
+  // Sizes below kSecondLevelCount share first level 0, one class per byte.
+  static constexpr int kFirstLevelCount = 32 - kSecondLevelLog2;
+  static constexpr int32_t kNoRange = -1;
+
+  // A range of the buffer, either allocated or free. Ranges are linked in
+  // address order and free ones also in their size class list.
+  struct Range {
+    int32_t offset = 0;
+    int32_t size = 0;
+    bool free = false;
+    int32_t prev_physical = kNoRange;
+    int32_t next_physical = kNoRange;
+    int32_t prev_free = kNoRange;
+    int32_t next_free = kNoRange;
+  };
+
+  static void MappingInsert(int64_t size, int* first_level, int* second_level);
+  // Rounds |size| up to the next class so every range found fits.
+  static void MappingSearch(int64_t size, int* first_level, int* second_level);
+
+  int32_t FindFreeRange(int64_t size) const;
+  // Linear search of the class |size| maps to, the slow path of Alloc.
+  int32_t FindFreeRangeInClass(int32_t size, int32_t alignment) const;
+  void InsertFreeRange(int32_t index);
+  void RemoveFreeRange(int32_t index);
+  // Shrinks range |index| to |size| bytes and returns a new range holding the
+  // rest, placed right after it.
+  int32_t SplitBack(int32_t index, int32_t size);
+  // Absorbs the physical successor of |index|.
+  void MergeNext(int32_t index);
+
+  int32_t NewRange();
+  void DeleteRange(int32_t index);
+
+  uint32_t first_level_bitmap_ = 0;
+  uint32_t second_level_bitmap_[kFirstLevelCount] = {};
+  int32_t free_heads_[kFirstLevelCount][kSecondLevelCount];
+
+  std::vector<Range> ranges_;
+  std::vector<int32_t> unused_ranges_;
+  // offset -> range index of live allocations.
+  std::unordered_map<int32_t, int32_t> allocations_;
+
+  int64_t used_size_ = 0;
+  int32_t free_range_count_ = 0;
+};
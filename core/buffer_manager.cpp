@@ -1,76 +1,124 @@
 #include "core/buffer_manager.h"
 
-#include <assert.h>
+namespace {
 
-BufferProxy::~BufferProxy() {
-  manager_->ReleaseBuffer(allocator_, buffer_id_, offset_, size_);
-}
+// A block is only evacuated while the live ranges of all blocks fit into one
+// block less at this fill rate, so the moved ranges have room to stay.
+constexpr float kCompactionFillRate = 0.75f;
 
-const int32_t BufferAllocator::kInvalidOffset;
+}  // namespace
 
-BufferAllocator::BufferAllocator(int32_t capacity) : capacity_(capacity) {
-  assert(capacity_ > 0);
-}
+BufferProxy::~BufferProxy() { manager_->ReleaseBuffer(this); }
 
-FirstFitBufferAllocator::FirstFitBufferAllocator(int32_t capacity) : BufferAllocator(capacity) {
-  free_ranges_.push_back({0, capacity});
-  skip_list_.insert({0, free_ranges_.begin()});
+void BufferManager::DeleteBuffer(GLuint buffer_id) {
+  auto address_iter = buffers_address_.find(buffer_id);
+  if (address_iter != buffers_address_.end()) {
+    glMakeNamedBufferNonResidentNV(buffer_id);
+    buffers_address_.erase(address_iter);
+  }
+  glDeleteBuffers(1, &buffer_id);
+  deleted_buffers_.insert(buffer_id);
+  if (buffers_.erase(buffer_id)) {
+    ++released_block_count_;
+  }
+  if (compaction_source_ == buffer_id) {
+    compaction_source_ = 0;
+  }
 }
 
-int32_t FirstFitBufferAllocator::Alloc(int32_t size) {
-  // Find first range that can fit the size.
-  auto iter = std::find_if(free_ranges_.begin(), free_ranges_.end(), [size](const Range& range) {
-    return range.size >= size;
-  });
-
-  if (iter == free_ranges_.end()) {
-    return kInvalidOffset;
+GLuint BufferManager::ChooseCompactionSource() const {
+  if (buffers_.size() < 2) {
+    return 0;
   }
-
-  Range range = *iter;
-  iter = free_ranges_.erase(iter);
-  skip_list_.erase(range.offset);
-
-  int32_t offset = range.offset;
-  range.offset += size;
-  range.size -= size;
-
-  if (range.size > 0) {
-    iter = free_ranges_.insert(iter, range);
-    skip_list_[range.offset] = iter;
+  int64_t used_size = 0;
+  GLuint source = 0;
+  int64_t source_used_size = 0;
+  for (auto& pair : buffers_) {
+    int64_t block_used_size = pair.second.allocator->stats().used_size;
+    used_size += block_used_size;
+    if (!source || block_used_size < source_used_size) {
+      source = pair.first;
+      source_used_size = block_used_size;
+    }
   }
-
-  return offset;
+  if (used_size >
+      int64_t(buffers_.size() - 1) * block_size_ * kCompactionFillRate) {
+    return 0;
+  }
+  return source;
 }
 
-void FirstFitBufferAllocator::Free(int32_t offset, int32_t size) {
-  // Find insert position.
-  std::list<Range>::iterator iter = free_ranges_.end();
-  auto skip_iter = skip_list_.lower_bound(offset);
-  if (skip_iter != skip_list_.end()) {
-    iter = skip_iter->second;
+uint64_t BufferManager::Compact(uint64_t max_bytes,
+                                std::set<GLuint>* relocated_buffers) {
+  // Empty blocks go back to the driver, one is kept to allocate from.
+  for (auto iter = buffers_.begin();
+       iter != buffers_.end() && buffers_.size() > 1;) {
+    GLuint buffer_id = iter->first;
+    bool empty = iter->second.proxies.empty();
+    ++iter;
+    if (empty) {
+      DeleteBuffer(buffer_id);
+    }
   }
 
-  Range range = {offset, size};
-
-  if (iter != free_ranges_.begin()) {
-    auto prev_iter = std::prev(iter);
-    if (prev_iter->offset + prev_iter->size == range.offset) {
-      range.offset = prev_iter->offset;
-      range.size += prev_iter->size;
-      free_ranges_.erase(prev_iter);
-      skip_list_.erase(range.offset);
-    }
+  if (!compaction_source_) {
+    compaction_source_ = ChooseCompactionSource();
+  }
+  uint64_t moved_bytes = 0;
+  if (compaction_source_) {
+    moved_bytes = EvacuateCompactionSource(max_bytes, relocated_buffers);
   }
 
-  if (iter != free_ranges_.end()) {
-    if (range.offset + range.size == iter->offset) {
-      range.size += iter->size;
-      skip_list_.erase(iter->offset);
-      iter = free_ranges_.erase(iter);
+  relocated_buffers->insert(deleted_buffers_.begin(), deleted_buffers_.end());
+  deleted_buffers_.clear();
+  return moved_bytes;
+}
+
+uint64_t BufferManager::EvacuateCompactionSource(
+    uint64_t max_bytes, std::set<GLuint>* relocated_buffers) {
+  GLuint source_id = compaction_source_;
+  BufferBlock& source = buffers_[source_id];
+  uint64_t moved_bytes = 0;
+  while (!source.proxies.empty() && moved_bytes < max_bytes) {
+    BufferProxy* proxy = source.proxies.begin()->second;
+    GLuint target_id = 0;
+    int32_t target_offset = BufferAllocator::kInvalidOffset;
+    for (auto& pair : buffers_) {
+      if (pair.first == source_id) {
+        continue;
+      }
+      target_offset =
+          pair.second.allocator->Alloc(proxy->size_, proxy->alignment_);
+      if (target_offset != BufferAllocator::kInvalidOffset) {
+        target_id = pair.first;
+        break;
+      }
+    }
+    if (!target_id) {
+      // The other blocks filled up meanwhile, pick again later.
+      compaction_source_ = 0;
+      break;
     }
+
+    glCopyNamedBufferSubData(source_id, target_id, proxy->offset_,
+                             target_offset, proxy->size_);
+    source.allocator->Free(proxy->offset_, proxy->size_);
+    source.proxies.erase(source.proxies.begin());
+
+    BufferBlock& target = buffers_[target_id];
+    proxy->buffer_id_ = target_id;
+    proxy->offset_ = target_offset;
+    proxy->allocator_ = target.allocator.get();
+    target.proxies[target_offset] = proxy;
+    moved_bytes += proxy->size_;
   }
 
-  iter = free_ranges_.insert(iter, range);
-  skip_list_[range.offset] = iter;
+  if (moved_bytes) {
+    relocated_buffers->insert(source_id);
+    compacted_bytes_ += moved_bytes;
+  }
+  if (source.proxies.empty()) {
+    DeleteBuffer(source_id);
+  }
+  return moved_bytes;
 }
@@ -3,11 +3,12 @@
 #include <GL/glew.h>
 
 #include <algorithm>
-#include <list>
 #include <map>
 #include <memory>
+#include <set>
+
+#include "core/buffer_allocator.h"
 
-class BufferAllocator ;
 class BufferManager;
 class BufferProxy {
  public:
@@ -28,77 +29,55 @@ class BufferProxy {
   void Unmap() { glUnmapNamedBuffer(buffer_id_); };
 
  private:
-  BufferProxy(GLuint buffer_id, int offset, int size)
-      : buffer_id_(buffer_id), offset_(offset), size_(size) {}
+  BufferProxy(GLuint buffer_id, int offset, int size, int alignment)
+      : buffer_id_(buffer_id),
+        offset_(offset),
+        size_(size),
+        alignment_(alignment) {}
 
+  // buffer_id_ and offset_ change when BufferManager::Compact moves the range.
   GLuint buffer_id_;
   int offset_;
   int size_;
+  int alignment_;
   friend class BufferManager;
 
   BufferAllocator* allocator_ = nullptr;
   BufferManager* manager_ = nullptr;
 };
 
-class BufferAllocator {
- public:
-  static const int32_t kInvalidOffset = -1;
-  explicit BufferAllocator(int32_t capacity);
-  virtual ~BufferAllocator() = default;
-
-  // Returns an offset in the buffer if allocation succeeds, otherwise returns kInvalidOffset.
-  virtual int32_t Alloc(int32_t size) = 0;
-  // Frees the buffer usage at the given offset.
-  virtual void Free(int32_t offset, int32_t size) = 0;
-
-  int32_t capacity() const { return capacity_; }
-
- private:
-  const int32_t capacity_;
-};
-
-class FirstFitBufferAllocator : public BufferAllocator {
- public:
-  explicit FirstFitBufferAllocator(int32_t capacity);
-  ~FirstFitBufferAllocator() override = default;
-
-  int32_t Alloc(int32_t size) override;
-  void Free(int32_t offset, int32_t size) override;
-
- private:
-  struct Range {
-    int32_t offset = 0;
-    int32_t size = 0;
-  };
-
-  std::list<Range> free_ranges_;
-  std::map<int32_t, std::list<Range>::iterator> skip_list_;
-};
-
 class BufferManager {
  public:
-  BufferManager(int block_size) : block_size_(block_size) {}
+  BufferManager(int block_size,
+                BufferAllocatorType allocator_type = kSegregatedFitAllocator)
+      : block_size_(block_size), allocator_type_(allocator_type) {}
   ~BufferManager() = default;
 
-  std::unique_ptr<BufferProxy> AllocateBuffer(int size) {
+  // The offset of the range is a multiple of |alignment|.
+  std::unique_ptr<BufferProxy> AllocateBuffer(int size, int alignment = 1) {
     if (size > block_size_) {
       GLuint buffer_id;
       glCreateBuffers(1, &buffer_id);
       glNamedBufferStorage(buffer_id, size, nullptr,
                            GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_DYNAMIC_STORAGE_BIT);
-      auto proxy =
-          std::unique_ptr<BufferProxy>(new BufferProxy(buffer_id, 0, size));
+      auto proxy = std::unique_ptr<BufferProxy>(
+          new BufferProxy(buffer_id, 0, size, alignment));
       proxy->manager_ = this;
       return proxy;
     }
 
     for (auto& pair : buffers_) {
-      auto offset = pair.second->Alloc(size);
+      // The block being evacuated is not refilled.
+      if (pair.first == compaction_source_) {
+        continue;
+      }
+      auto offset = pair.second.allocator->Alloc(size, alignment);
       if (offset != -1) {
         auto proxy = std::unique_ptr<BufferProxy>(
-            new BufferProxy(pair.first, offset, size));
-        proxy->allocator_ = pair.second.get();
+            new BufferProxy(pair.first, offset, size, alignment));
+        proxy->allocator_ = pair.second.allocator.get();
         proxy->manager_ = this;
+        pair.second.proxies[offset] = proxy.get();
         return proxy;
       }
     }
@@ -107,20 +86,31 @@ class BufferManager {
     glCreateBuffers(1, &buffer_id);
     glNamedBufferStorage(buffer_id, block_size_, nullptr,
                          GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_DYNAMIC_STORAGE_BIT);
-    buffers_.emplace(buffer_id, std::make_unique<FirstFitBufferAllocator>(block_size_));
+    buffers_[buffer_id].allocator =
+        CreateBufferAllocator(allocator_type_, block_size_);
 
-    return AllocateBuffer(size);
+    return AllocateBuffer(size, alignment);
   }
 
-  void ReleaseBuffer(BufferAllocator* allocator, GLuint buffer_id, int offset,
-                     int size) {
-    if (allocator) {
-      allocator->Free(offset, size);
+  void ReleaseBuffer(BufferProxy* proxy) {
+    if (proxy->allocator_) {
+      proxy->allocator_->Free(proxy->offset_, proxy->size_);
+      buffers_[proxy->buffer_id_].proxies.erase(proxy->offset_);
     } else {
-      glDeleteBuffers(1, &buffer_id);
+      DeleteBuffer(proxy->buffer_id_);
     }
   }
 
+  // Incrementally evacuates the emptiest block into the other blocks, moving
+  // at most |max_bytes| of live ranges per call with glCopyNamedBufferSubData,
+  // and deletes blocks once they are empty. Ids of buffers that ranges were
+  // moved out of are added to |relocated_buffers|: GPU addresses and command
+  // tokens built from proxies in them are stale. So are the ids of all
+  // buffers deleted since the last call, which glCreateBuffers hands out
+  // again: vertex array bindings cached by buffer id must be dropped for
+  // them. Returns the bytes moved.
+  uint64_t Compact(uint64_t max_bytes, std::set<GLuint>* relocated_buffers);
+
   GLuint64 GetBufferAddress(GLuint buffer_id) {
     if (buffers_address_.find(buffer_id) != buffers_address_.end()) {
       return buffers_address_[buffer_id];
@@ -133,8 +123,41 @@ class BufferManager {
     return address;
   }
 
+  // Summed over the blocks, buffers larger than a block are not included.
+  BufferAllocatorStats stats() const {
+    BufferAllocatorStats stats;
+    for (auto& pair : buffers_) {
+      stats += pair.second.allocator->stats();
+    }
+    return stats;
+  }
+
+  int block_count() const { return buffers_.size(); }
+  uint64_t compacted_bytes() const { return compacted_bytes_; }
+  int released_block_count() const { return released_block_count_; }
+
  private:
+  struct BufferBlock {
+    std::unique_ptr<BufferAllocator> allocator;
+    // Live proxies by offset.
+    std::map<int32_t, BufferProxy*> proxies;
+  };
+
+  // Picks the block to evacuate, 0 when compacting would not free a block.
+  GLuint ChooseCompactionSource() const;
+  // Moves ranges out of compaction_source_, see Compact.
+  uint64_t EvacuateCompactionSource(uint64_t max_bytes,
+                                    std::set<GLuint>* relocated_buffers);
+  void DeleteBuffer(GLuint buffer_id);
+
   const int block_size_;
+  const BufferAllocatorType allocator_type_;
   std::map<GLuint, GLuint64> buffers_address_;
-  std::map<GLuint, std::unique_ptr<BufferAllocator>> buffers_;
+  std::map<GLuint, BufferBlock> buffers_;
+  // Deleted since the last Compact, reported by it.
+  std::set<GLuint> deleted_buffers_;
+
+  GLuint compaction_source_ = 0;
+  uint64_t compacted_bytes_ = 0;
+  int released_block_count_ = 0;
 };
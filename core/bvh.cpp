@@ -0,0 +1,237 @@
+#include "core/bvh.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Deep enough for any tree built by median splits of 2^32 items.
+constexpr int kMaxTraversalDepth = 64;
+
+struct SoaBounds {
+  const float* min[3];
+  const float* max[3];
+};
+
+// OutsideMask tests the four boxes starting at |index| of the SoA bounds
+// against the far corner of each plane and returns a bit per box outside.
+#ifdef BVH_SSE
+struct SimdPlane {
+  __m128 normal[3];
+  __m128 offset;
+  // Per axis whether the far corner takes max or min.
+  bool positive[3];
+};
+
+void LoadSimdPlanes(const Frustum& frustum, SimdPlane* planes) {
+  for (int i = 0; i < 6; ++i) {
+    const glm::vec4& plane = frustum.planes[i];
+    for (int axis = 0; axis < 3; ++axis) {
+      planes[i].normal[axis] = _mm_set1_ps(plane[axis]);
+      planes[i].positive[axis] = plane[axis] > 0.0f;
+    }
+    planes[i].offset = _mm_set1_ps(plane.w);
+  }
+}
+
+int OutsideMask(const SimdPlane* planes, const SoaBounds& bounds,
+                uint32_t index) {
+  const __m128 zero = _mm_setzero_ps();
+  __m128 min[3];
+  __m128 max[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    min[axis] = _mm_loadu_ps(bounds.min[axis] + index);
+    max[axis] = _mm_loadu_ps(bounds.max[axis] + index);
+  }
+  __m128 outside = zero;
+  for (int i = 0; i < 6; ++i) {
+    const SimdPlane& plane = planes[i];
+    __m128 distance = plane.offset;
+    for (int axis = 0; axis < 3; ++axis) {
+      __m128 corner = plane.positive[axis] ? max[axis] : min[axis];
+      distance = _mm_add_ps(distance, _mm_mul_ps(corner, plane.normal[axis]));
+    }
+    outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+  }
+  return _mm_movemask_ps(outside);
+}
+#else
+using SimdPlane = glm::vec4;
+
+void LoadSimdPlanes(const Frustum& frustum, SimdPlane* planes) {
+  std::copy(frustum.planes, frustum.planes + 6, planes);
+}
+
+int OutsideMask(const SimdPlane* planes, const SoaBounds& bounds,
+                uint32_t index) {
+  int mask = 0;
+  for (int lane = 0; lane < 4; ++lane) {
+    for (int i = 0; i < 6; ++i) {
+      const glm::vec4& plane = planes[i];
+      float distance = plane.w;
+      for (int axis = 0; axis < 3; ++axis) {
+        float corner = plane[axis] > 0.0f ? bounds.max[axis][index + lane]
+                                          : bounds.min[axis][index + lane];
+        distance += corner * plane[axis];
+      }
+      if (distance < 0.0f) {
+        mask |= 1 << lane;
+        break;
+      }
+    }
+  }
+  return mask;
+}
+#endif
+
+}  // namespace
+
+void BoundingVolumeHierarchy::Build(const std::vector<BoundingBox>& boxes) {
+  nodes_.clear();
+  items_.clear();
+  std::vector<glm::vec3> centers(boxes.size());
+  for (uint32_t i = 0; i < boxes.size(); ++i) {
+    if (!boxes[i].empty()) {
+      items_.push_back(i);
+      centers[i] = boxes[i].center();
+    }
+  }
+  if (!items_.empty()) {
+    nodes_.reserve(2 * items_.size() / kLeafSize + 1);
+    BuildNode(boxes, centers, 0, items_.size());
+  }
+  StoreItemBounds(boxes);
+}
+
+uint32_t BoundingVolumeHierarchy::BuildNode(
+    const std::vector<BoundingBox>& boxes,
+    const std::vector<glm::vec3>& centers, uint32_t first, uint32_t count) {
+  uint32_t index = nodes_.size();
+  nodes_.emplace_back();
+  BoundingBox bounds;
+  BoundingBox center_bounds;
+  for (uint32_t i = first; i < first + count; ++i) {
+    bounds.Extend(boxes[items_[i]]);
+    center_bounds.Extend(centers[items_[i]]);
+  }
+  nodes_[index].bounds = bounds;
+  nodes_[index].first_item = first;
+  nodes_[index].item_count = count;
+  if (count <= kLeafSize) {
+    return index;
+  }
+
+  glm::vec3 extent = center_bounds.max - center_bounds.min;
+  int axis = 0;
+  if (extent.y > extent[axis]) {
+    axis = 1;
+  }
+  if (extent.z > extent[axis]) {
+    axis = 2;
+  }
+  uint32_t half = count / 2;
+  std::nth_element(items_.begin() + first, items_.begin() + first + half,
+                   items_.begin() + first + count,
+                   [&centers, axis](uint32_t a, uint32_t b) {
+                     return centers[a][axis] < centers[b][axis];
+                   });
+  BuildNode(boxes, centers, first, half);
+  uint32_t right_child =
+      BuildNode(boxes, centers, first + half, count - half);
+  nodes_[index].right_child = right_child;
+  return index;
+}
+
+void BoundingVolumeHierarchy::Refit(const std::vector<BoundingBox>& boxes) {
+  StoreItemBounds(boxes);
+  // Children are stored after their parent.
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    Node& node = nodes_[i];
+    BoundingBox bounds;
+    if (node.right_child) {
+      bounds = nodes_[i + 1].bounds;
+      bounds.Extend(nodes_[node.right_child].bounds);
+    } else {
+      for (uint32_t item = node.first_item;
+           item < node.first_item + node.item_count; ++item) {
+        bounds.Extend(boxes[items_[item]]);
+      }
+    }
+    node.bounds = bounds;
+  }
+}
+
+void BoundingVolumeHierarchy::StoreItemBounds(
+    const std::vector<BoundingBox>& boxes) {
+  // Padded lanes hold empty boxes, their results are masked off.
+  size_t padded_size = (items_.size() + 3) / 4 * 4;
+  std::vector<float>* bounds[] = {&min_x_, &min_y_, &min_z_,
+                                  &max_x_, &max_y_, &max_z_};
+  for (int i = 0; i < 6; ++i) {
+    bounds[i]->assign(padded_size, i < 3 ? FLT_MAX : -FLT_MAX);
+  }
+  for (size_t i = 0; i < items_.size(); ++i) {
+    const BoundingBox& box = boxes[items_[i]];
+    min_x_[i] = box.min.x;
+    min_y_[i] = box.min.y;
+    min_z_[i] = box.min.z;
+    max_x_[i] = box.max.x;
+    max_y_[i] = box.max.y;
+    max_z_[i] = box.max.z;
+  }
+}
+
+void BoundingVolumeHierarchy::AppendItems(
+    const Node& node, std::vector<uint32_t>* visible) const {
+  visible->insert(visible->end(), items_.begin() + node.first_item,
+                  items_.begin() + node.first_item + node.item_count);
+}
+
+void BoundingVolumeHierarchy::Cull(const Frustum& frustum,
+                                   std::vector<uint32_t>* visible) const {
+  if (nodes_.empty()) {
+    return;
+  }
+  SimdPlane planes[6];
+  LoadSimdPlanes(frustum, planes);
+  SoaBounds bounds = {{min_x_.data(), min_y_.data(), min_z_.data()},
+                      {max_x_.data(), max_y_.data(), max_z_.data()}};
+
+  uint32_t stack[kMaxTraversalDepth];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size) {
+    uint32_t index = stack[--stack_size];
+    const Node& node = nodes_[index];
+    Frustum::Result result = frustum.Classify(node.bounds);
+    if (result == Frustum::kOutside) {
+      continue;
+    }
+    if (result == Frustum::kInside) {
+      AppendItems(node, visible);
+      continue;
+    }
+    if (node.right_child) {
+      stack[stack_size++] = node.right_child;
+      stack[stack_size++] = index + 1;
+      continue;
+    }
+    // Leaves are tested from a multiple of four so the loads never pass the
+    // padded end, lanes outside the leaf are masked off.
+    uint32_t begin = node.first_item;
+    uint32_t end = node.first_item + node.item_count;
+    for (uint32_t group = begin & ~3u; group < end; group += 4) {
+      int inside = ~OutsideMask(planes, bounds, group);
+      for (uint32_t lane = 0; lane < 4; ++lane) {
+        uint32_t item = group + lane;
+        if (item >= begin && item < end && (inside & (1 << lane))) {
+          visible->push_back(items_[item]);
+        }
+      }
+    }
+  }
+}
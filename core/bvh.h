@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/frustum.h"
+
+// Bounding volume hierarchy over a set of boxes, for frustum culling. Built
+// top down by median splits along the longest axis of the box centers, nodes
+// are stored depth first so the items below any node are one contiguous
+// range. Leaf items keep their bounds in SoA arrays and are tested four at a
+// time with SSE; nodes fully inside the frustum add their items untested.
+class BoundingVolumeHierarchy {
+ public:
+  static constexpr int kLeafSize = 8;
+
+  BoundingVolumeHierarchy() = default;
+
+  // Empty boxes are left out, they are never visible.
+  void Build(const std::vector<BoundingBox>& boxes);
+  // Updates the bounds after boxes moved, keeping the tree shape. |boxes|
+  // must have the size and order passed to Build, and the same boxes empty.
+  void Refit(const std::vector<BoundingBox>& boxes);
+
+  // Appends the indices of the boxes not outside |frustum| to |visible|, in
+  // tree order.
+  void Cull(const Frustum& frustum, std::vector<uint32_t>* visible) const;
+
+  // Empty when built from no boxes.
+  BoundingBox bounds() const {
+    return nodes_.empty() ? BoundingBox() : nodes_[0].bounds;
+  }
+  // Non empty boxes in the tree.
+  int size() const { return items_.size(); }
+  int node_count() const { return nodes_.size(); }
+
+ private:
+  struct Node {
+    BoundingBox bounds;
+    // Range in items_ of all items below the node.
+    uint32_t first_item = 0;
+    uint32_t item_count = 0;
+    // The left child directly follows its parent. 0 for leaves, the root is
+    // never a right child.
+    uint32_t right_child = 0;
+  };
+
+  // Builds the subtree of items_[first, first + count) and returns its node.
+  // |centers| are the box centers.
+  uint32_t BuildNode(const std::vector<BoundingBox>& boxes,
+                     const std::vector<glm::vec3>& centers, uint32_t first,
+                     uint32_t count);
+  void StoreItemBounds(const std::vector<BoundingBox>& boxes);
+  void AppendItems(const Node& node, std::vector<uint32_t>* visible) const;
+
+  std::vector<Node> nodes_;
+  // Box index of each tree position.
+  std::vector<uint32_t> items_;
+  // Bounds of items_ by tree position, padded to a multiple of four.
+  std::vector<float> min_x_;
+  std::vector<float> min_y_;
+  std::vector<float> min_z_;
+  std::vector<float> max_x_;
+  std::vector<float> max_y_;
+  std::vector<float> max_z_;
+};
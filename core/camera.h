@@ -32,9 +32,10 @@ class Camera {
     return glm::normalize(up);
   }
 
+  glm::vec3 position() const { return target_ - distance_ * forward(); }
+
   glm::mat4 view() const {
-    return glm::lookAt(target_ - distance_ * forward(), target_,
-                       glm::vec3(0, 0, 1));
+    return glm::lookAt(position(), target_, glm::vec3(0, 0, 1));
   }
 
  private:
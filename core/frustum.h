@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+// Axis aligned box, empty (min above max) until extended.
+struct BoundingBox {
+  glm::vec3 min{FLT_MAX};
+  glm::vec3 max{-FLT_MAX};
+
+  bool empty() const { return min.x > max.x; }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+
+  void Extend(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+  void Extend(const BoundingBox& box) {
+    if (!box.empty()) {
+      min = glm::min(min, box.min);
+      max = glm::max(max, box.max);
+    }
+  }
+
+  // Box around this one transformed by the affine |matrix|, from the
+  // extremes of each matrix term instead of transforming eight corners.
+  BoundingBox Transform(const glm::mat4& matrix) const {
+    if (empty()) {
+      return *this;
+    }
+    BoundingBox box;
+    box.min = box.max = glm::vec3(matrix[3]);
+    for (int column = 0; column < 3; ++column) {
+      for (int row = 0; row < 3; ++row) {
+        float a = matrix[column][row] * min[column];
+        float b = matrix[column][row] * max[column];
+        box.min[row] += std::min(a, b);
+        box.max[row] += std::max(a, b);
+      }
+    }
+    return box;
+  }
+};
+
+// Planes of a view frustum facing inwards, a point p is inside all of them
+// when dot(plane.xyz, p) + plane.w >= 0. Not normalized, only signs are used.
+struct Frustum {
+  enum Result {
+    kOutside = 0,
+    kIntersecting,
+    kInside,
+  };
+
+  glm::vec4 planes[6];
+
+  // Extracts the planes from the rows of a GL |view_projection| matrix.
+  static Frustum FromMatrix(const glm::mat4& view_projection) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+      rows[i] = glm::vec4(view_projection[0][i], view_projection[1][i],
+                          view_projection[2][i], view_projection[3][i]);
+    }
+    Frustum frustum;
+    for (int i = 0; i < 3; ++i) {
+      frustum.planes[i * 2] = rows[3] + rows[i];
+      frustum.planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+    return frustum;
+  }
+
+  // Tests the box corners farthest along and against each plane normal.
+  Result Classify(const BoundingBox& box) const {
+    Result result = kInside;
+    for (const glm::vec4& plane : planes) {
+      glm::vec3 far_corner;
+      glm::vec3 near_corner;
+      for (int i = 0; i < 3; ++i) {
+        far_corner[i] = plane[i] > 0.0f ? box.max[i] : box.min[i];
+        near_corner[i] = plane[i] > 0.0f ? box.min[i] : box.max[i];
+      }
+      if (glm::dot(glm::vec3(plane), far_corner) + plane.w < 0.0f) {
+        return kOutside;
+      }
+      if (glm::dot(glm::vec3(plane), near_corner) + plane.w < 0.0f) {
+        result = kIntersecting;
+      }
+    }
+    return result;
+  }
+};
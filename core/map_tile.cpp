@@ -0,0 +1,189 @@
+#include "core/map_tile.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool RangeInside(uint64_t offset, uint64_t size, uint64_t capacity) {
+  return offset <= capacity && size <= capacity - offset;
+}
+
+}  // namespace
+
+bool MapTile::Open(const std::string& path) {
+  Close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    printf("open map tile error: %s\n", path.c_str());
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping) {
+    data_ = static_cast<const uint8_t*>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    // The view keeps the file mapped after the handles are closed.
+    CloseHandle(mapping);
+  }
+  CloseHandle(file);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    printf("open map tile error: %s\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      data_ = static_cast<const uint8_t*>(ptr);
+      size_ = st.st_size;
+      madvise(ptr, size_, MADV_WILLNEED);
+    }
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+#endif
+
+  if (!data_) {
+    printf("map map tile error: %s\n", path.c_str());
+    return false;
+  }
+
+  if (!Validate()) {
+    printf("invalid map tile: %s\n", path.c_str());
+    Close();
+    return false;
+  }
+
+  const MapTileHeader& tile_header = header();
+  strings_ =
+      reinterpret_cast<const char*>(data_ + tile_header.string_table_offset);
+  nodes_ = reinterpret_cast<const MapTileNode*>(data_ +
+                                                tile_header.node_table_offset);
+  records_ = reinterpret_cast<const MapTileMeshRecord*>(
+      data_ + tile_header.record_table_offset);
+  blob_ = data_ + tile_header.blob_offset;
+  return true;
+}
+
+void MapTile::Close() {
+  if (data_) {
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+  }
+  data_ = nullptr;
+  size_ = 0;
+  strings_ = nullptr;
+  nodes_ = nullptr;
+  records_ = nullptr;
+  blob_ = nullptr;
+}
+
+bool MapTile::Validate() const {
+  if (size_ < sizeof(MapTileHeader)) {
+    return false;
+  }
+  const MapTileHeader& tile_header = header();
+  if (memcmp(tile_header.magic, kMapTileMagic, sizeof(kMapTileMagic)) != 0 ||
+      tile_header.version != kMapTileVersion) {
+    return false;
+  }
+  if (!RangeInside(tile_header.string_table_offset,
+                   uint64_t(tile_header.string_count) * kMapTileStringSize,
+                   size_) ||
+      !RangeInside(tile_header.node_table_offset,
+                   uint64_t(tile_header.node_count) * sizeof(MapTileNode),
+                   size_) ||
+      !RangeInside(tile_header.record_table_offset,
+                   uint64_t(tile_header.record_count) *
+                       sizeof(MapTileMeshRecord),
+                   size_) ||
+      !RangeInside(tile_header.blob_offset, tile_header.blob_size, size_) ||
+      tile_header.root_count > tile_header.node_count) {
+    return false;
+  }
+
+  const char* strings =
+      reinterpret_cast<const char*>(data_ + tile_header.string_table_offset);
+  for (uint32_t i = 0; i < tile_header.string_count; ++i) {
+    if (!memchr(strings + size_t(i) * kMapTileStringSize, '\0',
+                kMapTileStringSize)) {
+      return false;
+    }
+  }
+
+  const MapTileNode* nodes = reinterpret_cast<const MapTileNode*>(
+      data_ + tile_header.node_table_offset);
+  for (uint32_t i = 0; i < tile_header.node_count; ++i) {
+    const MapTileNode& node = nodes[i];
+    if (node.type >= tile_header.string_count) {
+      return false;
+    }
+    if (node.record != kMapTileInvalidIndex &&
+        node.record >= tile_header.record_count) {
+      return false;
+    }
+    // Leaves draw their record, a node without either draws nothing and
+    // would send the leaf object types to record kMapTileInvalidIndex.
+    if (!node.child_count && node.record == kMapTileInvalidIndex) {
+      return false;
+    }
+    if (!RangeInside(node.first_child, node.child_count,
+                     tile_header.node_count)) {
+      return false;
+    }
+    // Children come after their parent, as json_to_map_tile.py lays them out
+    // breadth first, so the nodes cannot form a cycle that the recursive
+    // object creation would follow until the stack overflows.
+    if (node.child_count && node.first_child <= i) {
+      return false;
+    }
+  }
+
+  const MapTileMeshRecord* records =
+      reinterpret_cast<const MapTileMeshRecord*>(
+          data_ + tile_header.record_table_offset);
+  for (uint32_t i = 0; i < tile_header.record_count; ++i) {
+    const MapTileMeshRecord& record = records[i];
+    if (record.shader >= tile_header.string_count) {
+      return false;
+    }
+    const struct {
+      uint64_t offset;
+      uint64_t size;
+    } blobs[] = {
+        {record.position_offset, uint64_t(record.vertex_count) * 12},
+        {record.color_offset, uint64_t(record.vertex_count) * 4},
+        {record.uv_offset, uint64_t(record.vertex_count) * 8},
+        {record.index_offset, uint64_t(record.index_count) * 4},
+    };
+    for (const auto& blob : blobs) {
+      if (blob.offset != kMapTileNoBlob &&
+          !RangeInside(blob.offset, blob.size, tile_header.blob_size)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
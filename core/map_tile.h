@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Packed binary map tile, produced offline by json_to_map_tile.py.
+//
+// Layout (little endian, every table and blob 16 byte aligned):
+//   MapTileHeader
+//   string table  : string_count entries of kMapTileStringSize chars
+//   node table    : node_count MapTileNode, roots are [0, root_count)
+//   record table  : record_count MapTileMeshRecord
+//   blob          : raw position/color/uv/index arrays referenced by records,
+//                   stored as float3, ubyte4, float2 and uint32 respectively
+//
+// The file is memory mapped and read in place, there is no parsing or
+// decoding involved when creating render objects from it.
+
+constexpr char kMapTileMagic[4] = {'N', 'V', 'M', 'T'};
+constexpr uint32_t kMapTileVersion = 1;
+constexpr uint32_t kMapTileStringSize = 64;
+constexpr uint32_t kMapTileInvalidIndex = 0xffffffffu;
+constexpr uint64_t kMapTileNoBlob = 0xffffffffffffffffull;
+
+struct MapTileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t string_count;
+  uint32_t node_count;
+  uint32_t root_count;
+  uint32_t record_count;
+  uint64_t string_table_offset;
+  uint64_t node_table_offset;
+  uint64_t record_table_offset;
+  uint64_t blob_offset;
+  uint64_t blob_size;
+};
+static_assert(sizeof(MapTileHeader) == 64, "MapTileHeader layout changed");
+
+struct MapTileNode {
+  // String table index of the registered render object type name.
+  uint32_t type;
+  // Leaf nodes reference a mesh record, group nodes use kMapTileInvalidIndex
+  // and have at least one child.
+  uint32_t record;
+  // Children of a group node are stored contiguously in the node table,
+  // after the group node itself.
+  uint32_t first_child;
+  uint32_t child_count;
+};
+static_assert(sizeof(MapTileNode) == 16, "MapTileNode layout changed");
+
+struct MapTileMeshRecord {
+  // Byte offsets relative to the blob start, kMapTileNoBlob when absent.
+  uint64_t position_offset;
+  uint64_t color_offset;
+  uint64_t uv_offset;
+  uint64_t index_offset;
+  // Column major, same as draw_info.world_matrix.
+  float world_matrix[16];
+  float color[4];
+  float alpha;
+  float line_width;
+  int32_t line_stipple;
+  int32_t line_stipple_factor;
+  int32_t line_stipple_pattern;
+  uint32_t shader;
+  uint32_t draw_mode;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t reserved;
+};
+static_assert(sizeof(MapTileMeshRecord) == 152,
+              "MapTileMeshRecord layout changed");
+
+class MapTile {
+ public:
+  MapTile() = default;
+  ~MapTile() { Close(); }
+
+  MapTile(const MapTile&) = delete;
+  MapTile& operator=(const MapTile&) = delete;
+
+  // Maps the file and validates its tables, returns false on error.
+  bool Open(const std::string& path);
+  void Close();
+
+  bool is_open() const { return data_ != nullptr; }
+  const MapTileHeader& header() const {
+    return *reinterpret_cast<const MapTileHeader*>(data_);
+  }
+
+  uint32_t root_count() const { return header().root_count; }
+  const MapTileNode& node(uint32_t index) const { return nodes_[index]; }
+  const MapTileMeshRecord& record(uint32_t index) const {
+    return records_[index];
+  }
+  const char* string(uint32_t index) const {
+    return strings_ + static_cast<size_t>(index) * kMapTileStringSize;
+  }
+
+  // Returns nullptr for kMapTileNoBlob.
+  const void* blob(uint64_t offset) const {
+    return offset == kMapTileNoBlob ? nullptr : blob_ + offset;
+  }
+
+ private:
+  bool Validate() const;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+
+  const char* strings_ = nullptr;
+  const MapTileNode* nodes_ = nullptr;
+  const MapTileMeshRecord* records_ = nullptr;
+  const uint8_t* blob_ = nullptr;
+};
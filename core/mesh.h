@@ -8,6 +8,7 @@
 #include "app/common.h"
 #include "app/json.hpp"
 #include "app/base64.h"
+#include "core/map_tile.h"
 
 template <typename VecType>
 inline VecType VecFromJson(const nlohmann::json& json) {
@@ -31,17 +32,27 @@ class Mesh {
   void set_positions(const std::vector<PositionType>& positions) {
     positions_ = positions;
   }
+  void set_positions(std::vector<PositionType>&& positions) {
+    positions_ = std::move(positions);
+  }
 
   const std::vector<ColorType>& colors() const { return colors_; }
   void set_colors(const std::vector<ColorType>& colors) { colors_ = colors; }
+  void set_colors(std::vector<ColorType>&& colors) {
+    colors_ = std::move(colors);
+  }
 
   const std::vector<UVType>& uvs() const { return uvs_; }
   void set_uvs(const std::vector<UVType>& uvs) { uvs_ = uvs; }
+  void set_uvs(std::vector<UVType>&& uvs) { uvs_ = std::move(uvs); }
 
-  const std::vector<IndexType> indices() const { return indices_; }
+  const std::vector<IndexType>& indices() const { return indices_; }
   void set_indices(const std::vector<IndexType>& indices) {
     indices_ = indices;
   }
+  void set_indices(std::vector<IndexType>&& indices) {
+    indices_ = std::move(indices);
+  }
 
   bool indexed_draw() const {
     return indices_.size();
@@ -52,29 +63,16 @@ class Mesh {
 
   static Mesh SerializeFromJson(const nlohmann::json& mesh_json) {
     Mesh mesh;
-    std::vector<PositionType> positions;
-    std::vector<IndexType> indices;
-    std::string position_data = base64_decode(mesh_json["position"]);
-    int position_count = position_data.size() / sizeof(PositionType);
-    positions.resize(position_count);
-    memcpy(positions.data(), position_data.data(), position_data.size());
-    mesh.set_positions(positions);
+    base64_decode(mesh_json["position"].get_ref<const std::string&>(),
+                  &mesh.positions_);
 
     if (mesh_json.find("uv") != mesh_json.end()) {
-      std::vector<UVType> uvs;
-      std::string uv_data = base64_decode(mesh_json["uv"]);
-      int uv_count = uv_data.size() / sizeof(UVType);
-      uvs.resize(uv_count);
-      memcpy(uvs.data(), uv_data.data(), uv_data.size());
-      mesh.set_uvs(uvs);
+      base64_decode(mesh_json["uv"].get_ref<const std::string&>(),
+                    &mesh.uvs_);
     }
     if (mesh_json.find("color") != mesh_json.end()) {
-      std::vector<ColorType> colors;
-      std::string color_data = base64_decode(mesh_json["color"]);
-      int color_count = color_data.size() / sizeof(ColorType);
-      colors.resize(color_count);
-      memcpy(colors.data(), color_data.data(), color_data.size());
-      mesh.set_colors(colors);
+      base64_decode(mesh_json["color"].get_ref<const std::string&>(),
+                    &mesh.colors_);
     }
 
     // indices.resize(positions.size());
@@ -86,6 +84,36 @@ class Mesh {
     return mesh;
   }
 
+  static Mesh SerializeFromMapTile(const MapTile& tile,
+                                   const MapTileMeshRecord& record) {
+    static_assert(sizeof(PositionType) == 12 && sizeof(ColorType) == 4 &&
+                      sizeof(UVType) == 8 && sizeof(IndexType) == 4,
+                  "Mesh attribute types must match the map tile layout");
+    Mesh mesh;
+    int vertex_count = record.vertex_count;
+    auto positions = static_cast<const PositionType*>(
+        tile.blob(record.position_offset));
+    if (positions) {
+      mesh.positions_.assign(positions, positions + vertex_count);
+    }
+    auto colors =
+        static_cast<const ColorType*>(tile.blob(record.color_offset));
+    if (colors) {
+      mesh.colors_.assign(colors, colors + vertex_count);
+    }
+    auto uvs = static_cast<const UVType*>(tile.blob(record.uv_offset));
+    if (uvs) {
+      mesh.uvs_.assign(uvs, uvs + vertex_count);
+    }
+    auto indices =
+        static_cast<const IndexType*>(tile.blob(record.index_offset));
+    if (indices) {
+      mesh.indices_.assign(indices, indices + record.index_count);
+    }
+    mesh.set_draw_mode(record.draw_mode);
+    return mesh;
+  }
+
  private:
   std::vector<PositionType> positions_;
   std::vector<ColorType> colors_;
@@ -0,0 +1,260 @@
+#include "core/mesh_lod.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Screen sizes up to which the polyline levels are drawn, the tolerance of a
+// level is the mesh diagonal over its screen size.
+constexpr float kPolylineScreenSizes[MAX_MESH_LODS] = {FLT_MAX, 512.0f, 128.0f,
+                                                       32.0f};
+// A level draws at most this share of the elements of the previous one.
+constexpr float kMinLevelReduction = 0.75f;
+
+float SegmentDistance(const glm::vec3& point, const glm::vec3& a,
+                      const glm::vec3& b) {
+  glm::vec3 ab = b - a;
+  float length2 = glm::dot(ab, ab);
+  float t = length2 > 0.0f
+                ? glm::clamp(glm::dot(point - a, ab) / length2, 0.0f, 1.0f)
+                : 0.0f;
+  return glm::length(point - (a + ab * t));
+}
+
+// Runs Douglas-Peucker on |points| down to single segments and returns the
+// largest tolerance each point is kept at: simplifying with a tolerance keeps
+// exactly the points whose value is above it. A point is split off at its
+// distance to the segment it splits, capped by the value of the point that
+// opened the segment. The first and last are always kept. Splitting stops at
+// |min_tolerance|, points below it are never kept and get 0.
+std::vector<float> PolylineTolerances(const std::vector<glm::vec3>& points,
+                                      float min_tolerance) {
+  std::vector<float> tolerances(points.size(), 0.0f);
+  if (points.empty()) {
+    return tolerances;
+  }
+  tolerances.front() = FLT_MAX;
+  tolerances.back() = FLT_MAX;
+  struct Range {
+    uint32_t first;
+    uint32_t last;
+    float tolerance;
+  };
+  std::vector<Range> ranges{{0, uint32_t(points.size() - 1), FLT_MAX}};
+  while (!ranges.empty()) {
+    Range range = ranges.back();
+    ranges.pop_back();
+    float max_distance = -1.0f;
+    uint32_t farthest = range.first;
+    for (uint32_t i = range.first + 1; i < range.last; ++i) {
+      float distance = SegmentDistance(points[i], points[range.first],
+                                       points[range.last]);
+      if (distance > max_distance) {
+        max_distance = distance;
+        farthest = i;
+      }
+    }
+    float tolerance = std::min(max_distance, range.tolerance);
+    if (farthest == range.first || tolerance <= min_tolerance) {
+      continue;
+    }
+    tolerances[farthest] = tolerance;
+    ranges.push_back({range.first, farthest, tolerance});
+    ranges.push_back({farthest, range.last, tolerance});
+  }
+  return tolerances;
+}
+
+// A polyline through vertex indices, simplified to any tolerance.
+struct Polyline {
+  std::vector<uint32_t> elements;
+  std::vector<float> tolerances;
+
+  Polyline(const Mesh& mesh, std::vector<uint32_t> polyline_elements,
+           float min_tolerance)
+      : elements(std::move(polyline_elements)) {
+    std::vector<glm::vec3> points(elements.size());
+    for (size_t i = 0; i < elements.size(); ++i) {
+      points[i] = mesh.positions()[elements[i]];
+    }
+    tolerances = PolylineTolerances(points, min_tolerance);
+  }
+
+  // Indices into elements of the points kept at |tolerance|.
+  std::vector<uint32_t> Simplify(float tolerance) const {
+    std::vector<uint32_t> kept;
+    for (uint32_t i = 0; i < tolerances.size(); ++i) {
+      if (tolerances[i] > tolerance) {
+        kept.push_back(i);
+      }
+    }
+    return kept;
+  }
+};
+
+// Joins consecutive segments sharing an end point into polylines, each
+// through the start of its first segment and the end of every segment.
+std::vector<Polyline> LinePolylines(const Mesh& mesh,
+                                    const std::vector<uint32_t>& elements,
+                                    float min_tolerance) {
+  const std::vector<Mesh::PositionType>& positions = mesh.positions();
+  std::vector<Polyline> polylines;
+  size_t segment_count = elements.size() / 2;
+  for (size_t begin = 0; begin < segment_count;) {
+    size_t end = begin + 1;
+    while (end < segment_count &&
+           positions[elements[end * 2]] == positions[elements[end * 2 - 1]]) {
+      ++end;
+    }
+    std::vector<uint32_t> chain{elements[begin * 2]};
+    for (size_t segment = begin; segment < end; ++segment) {
+      chain.push_back(elements[segment * 2 + 1]);
+    }
+    polylines.emplace_back(mesh, std::move(chain), min_tolerance);
+    begin = end;
+  }
+  return polylines;
+}
+
+// Tolerances of a ribbon of (left, right) vertex pairs along the midpoints of
+// the pairs, empty when |elements| are no such ribbon.
+std::vector<float> RibbonTolerances(const Mesh& mesh,
+                                    const std::vector<uint32_t>& elements,
+                                    float min_tolerance) {
+  if (elements.size() < 6 || elements.size() % 2) {
+    return {};
+  }
+  const std::vector<Mesh::PositionType>& positions = mesh.positions();
+  std::vector<glm::vec3> centers(elements.size() / 2);
+  for (size_t i = 0; i < centers.size(); ++i) {
+    centers[i] =
+        (positions[elements[i * 2]] + positions[elements[i * 2 + 1]]) * 0.5f;
+  }
+  return PolylineTolerances(centers, min_tolerance);
+}
+
+// Keeps every |keep_every|th island of triangles, islands being runs of
+// consecutive triangles sharing a vertex position with the previous one.
+std::vector<uint32_t> DecimateIslands(const Mesh& mesh,
+                                      const std::vector<uint32_t>& elements,
+                                      int keep_every, int* island_count) {
+  const std::vector<Mesh::PositionType>& positions = mesh.positions();
+  std::vector<uint32_t> simplified;
+  int island = -1;
+  for (size_t triangle = 0; triangle + 2 < elements.size(); triangle += 3) {
+    bool connected = false;
+    for (size_t i = 0; triangle && i < 3 && !connected; ++i) {
+      for (size_t j = 0; j < 3; ++j) {
+        if (positions[elements[triangle + i]] ==
+            positions[elements[triangle - 3 + j]]) {
+          connected = true;
+          break;
+        }
+      }
+    }
+    if (!connected) {
+      ++island;
+    }
+    if (island % keep_every == 0) {
+      simplified.insert(simplified.end(), elements.begin() + triangle,
+                        elements.begin() + triangle + 3);
+    }
+  }
+  *island_count = island + 1;
+  return simplified;
+}
+
+}  // namespace
+
+MeshLods BuildMeshLods(const Mesh& mesh) {
+  MeshLods lods;
+  std::vector<uint32_t> elements;
+  if (mesh.indexed_draw()) {
+    elements.assign(mesh.indices().begin(), mesh.indices().end());
+  } else {
+    elements.resize(mesh.positions().size());
+    std::iota(elements.begin(), elements.end(), 0);
+  }
+  lods.levels.push_back({0, uint32_t(elements.size()), FLT_MAX});
+
+  BoundingBox bounds;
+  for (const Mesh::PositionType& position : mesh.positions()) {
+    bounds.Extend(position);
+  }
+  float diagonal = bounds.empty() ? 0.0f : glm::length(bounds.max - bounds.min);
+  if (diagonal <= 0.0f) {
+    return lods;
+  }
+
+  // Whatever the levels share is computed once, down to the tolerance of the
+  // finest level.
+  float min_tolerance = diagonal * kMeshLodPixelError / kPolylineScreenSizes[1];
+  GLenum draw_mode = mesh.draw_mode();
+  std::vector<Polyline> polylines;
+  std::vector<float> ribbon_tolerances;
+  switch (draw_mode) {
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+      polylines.emplace_back(mesh, elements, min_tolerance);
+      break;
+    case GL_LINES:
+      polylines = LinePolylines(mesh, elements, min_tolerance);
+      break;
+    case GL_TRIANGLE_STRIP:
+      ribbon_tolerances = RibbonTolerances(mesh, elements, min_tolerance);
+      if (ribbon_tolerances.empty()) {
+        return lods;
+      }
+      break;
+    case GL_TRIANGLES:
+      break;
+    default:
+      return lods;
+  }
+
+  size_t previous_count = elements.size();
+  for (int level = 1; level < MAX_MESH_LODS; ++level) {
+    float tolerance =
+        diagonal * kMeshLodPixelError / kPolylineScreenSizes[level];
+    float screen_size = kPolylineScreenSizes[level];
+    std::vector<uint32_t> simplified;
+    if (draw_mode == GL_LINES) {
+      for (const Polyline& polyline : polylines) {
+        std::vector<uint32_t> kept = polyline.Simplify(tolerance);
+        for (size_t i = 1; i < kept.size(); ++i) {
+          simplified.push_back(polyline.elements[kept[i - 1]]);
+          simplified.push_back(polyline.elements[kept[i]]);
+        }
+      }
+    } else if (!polylines.empty()) {
+      for (uint32_t i : polylines[0].Simplify(tolerance)) {
+        simplified.push_back(polylines[0].elements[i]);
+      }
+    } else if (draw_mode == GL_TRIANGLE_STRIP) {
+      for (uint32_t i = 0; i < ribbon_tolerances.size(); ++i) {
+        if (ribbon_tolerances[i] > tolerance) {
+          simplified.push_back(elements[i * 2]);
+          simplified.push_back(elements[i * 2 + 1]);
+        }
+      }
+    } else {
+      // Dropping all but one in |keep_every| islands opens gaps of about that
+      // many islands, drawn once they shrink below the pixel error.
+      int keep_every = 1 << level;
+      int island_count = 0;
+      simplified = DecimateIslands(mesh, elements, keep_every, &island_count);
+      screen_size = island_count * kMeshLodPixelError / keep_every;
+    }
+    if (simplified.empty() ||
+        simplified.size() > previous_count * kMinLevelReduction) {
+      continue;
+    }
+    lods.levels.push_back({uint32_t(elements.size() + lods.elements.size()),
+                           uint32_t(simplified.size()), screen_size});
+    lods.elements.insert(lods.elements.end(), simplified.begin(),
+                         simplified.end());
+    previous_count = simplified.size();
+  }
+  return lods;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "core/frustum.h"
+#include "core/mesh.h"
+
+// Simplification error allowed on screen, in pixels.
+constexpr float kMeshLodPixelError = 1.0f;
+
+// A level of detail of a mesh, a range of its elements: of the vertices of a
+// non indexed mesh, of the indices of an indexed one.
+struct MeshLod {
+  uint32_t first = 0;
+  uint32_t count = 0;
+  // Largest projected size of the mesh bounds in pixels the level is drawn
+  // at, its error stays below kMeshLodPixelError up to there.
+  float max_screen_size = FLT_MAX;
+};
+
+struct MeshLods {
+  // Level 0 draws the mesh as it is, the others follow with decreasing
+  // max_screen_size.
+  std::vector<MeshLod> levels;
+  // Vertex indices the simplified levels draw, appended after the mesh
+  // elements: after the indices of an indexed mesh, as copies of the
+  // vertices after the vertices otherwise.
+  std::vector<uint32_t> elements;
+};
+
+// Builds up to MAX_MESH_LODS levels of |mesh|. Line strips, loops and lists
+// are simplified with Douglas-Peucker, triangle strips as ribbons along their
+// center line, triangle lists made of separate islands such as the dashes of
+// a stripe drop islands. Levels drawing more than three quarters of the
+// previous level are left out, other draw modes only get level 0.
+MeshLods BuildMeshLods(const Mesh& mesh);
+
+// Size in pixels of |bounds| projected from |eye|, from its diagonal at the
+// distance of its nearest point. |lod_scale| is the pixels per unit at
+// distance 1, FLT_MAX when |eye| is inside.
+inline float ProjectedScreenSize(const BoundingBox& bounds,
+                                 const glm::vec3& eye, float lod_scale) {
+  float distance = glm::length(eye - glm::clamp(eye, bounds.min, bounds.max));
+  if (distance <= 0.0f) {
+    return FLT_MAX;
+  }
+  return glm::length(bounds.max - bounds.min) * lod_scale / distance;
+}
+
+// Coarsest level of |levels| drawn at |screen_size|.
+inline int SelectMeshLod(const std::vector<MeshLod>& levels,
+                         float screen_size) {
+  for (int level = levels.size() - 1; level > 0; --level) {
+    if (screen_size <= levels[level].max_screen_size) {
+      return level;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,303 @@
+#include "core/mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+// Vertex cache optimization after Tom Forsyth, "Linear-Speed Vertex Cache
+// Optimisation": vertices are scored by their position in a simulated LRU
+// cache and by how many triangles still use them, the next triangle is the
+// best scored one using a cached vertex.
+constexpr int kScoreCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+float VertexScore(int cache_position, uint32_t remaining_triangles) {
+  if (!remaining_triangles) {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    // The vertices of the last triangle score the same whatever their
+    // order, so the next one is not biased to either of its edges.
+    if (cache_position < 3) {
+      score = kLastTriangleScore;
+    } else {
+      float scale = 1.0f / (kScoreCacheSize - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scale, kCacheDecayPower);
+    }
+  }
+  // Vertices with few triangles left are finished first, not to be reloaded
+  // for them later.
+  return score + kValenceBoostScale *
+                     std::pow(float(remaining_triangles), -kValenceBoostPower);
+}
+
+std::vector<uint32_t> OptimizeVertexCache(const std::vector<uint32_t>& indices,
+                                          uint32_t vertex_count) {
+  uint32_t triangle_count = indices.size() / 3;
+  // Triangles of each vertex, the first remaining_triangles[v] of its range
+  // are the ones not emitted yet.
+  std::vector<uint32_t> remaining_triangles(vertex_count, 0);
+  for (uint32_t index : indices) {
+    ++remaining_triangles[index];
+  }
+  std::vector<uint32_t> first_triangle(vertex_count + 1, 0);
+  for (uint32_t v = 0; v < vertex_count; ++v) {
+    first_triangle[v + 1] = first_triangle[v] + remaining_triangles[v];
+  }
+  std::vector<uint32_t> vertex_triangles(indices.size());
+  std::vector<uint32_t> filled(first_triangle);
+  for (uint32_t i = 0; i < indices.size(); ++i) {
+    vertex_triangles[filled[indices[i]]++] = i / 3;
+  }
+
+  std::vector<float> vertex_scores(vertex_count);
+  for (uint32_t v = 0; v < vertex_count; ++v) {
+    vertex_scores[v] = VertexScore(-1, remaining_triangles[v]);
+  }
+  std::vector<float> triangle_scores(triangle_count);
+  for (uint32_t t = 0; t < triangle_count; ++t) {
+    triangle_scores[t] = vertex_scores[indices[t * 3]] +
+                         vertex_scores[indices[t * 3 + 1]] +
+                         vertex_scores[indices[t * 3 + 2]];
+  }
+
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> next_cache;
+  std::vector<uint32_t> optimized;
+  optimized.reserve(indices.size());
+  uint32_t next_in_order = 0;
+  for (uint32_t n = 0; n < triangle_count; ++n) {
+    int best = -1;
+    float best_score = -1.0f;
+    for (uint32_t v : cache) {
+      for (uint32_t i = 0; i < remaining_triangles[v]; ++i) {
+        uint32_t t = vertex_triangles[first_triangle[v] + i];
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    }
+    // Nothing cached is left to draw, continue in input order.
+    if (best < 0) {
+      while (emitted[next_in_order]) {
+        ++next_in_order;
+      }
+      best = next_in_order;
+    }
+    emitted[best] = true;
+
+    next_cache.clear();
+    for (int corner = 0; corner < 3; ++corner) {
+      uint32_t v = indices[best * 3 + corner];
+      optimized.push_back(v);
+      uint32_t* triangles = &vertex_triangles[first_triangle[v]];
+      uint32_t* last = triangles + remaining_triangles[v] - 1;
+      std::swap(*std::find(triangles, last, uint32_t(best)), *last);
+      --remaining_triangles[v];
+      if (std::find(next_cache.begin(), next_cache.end(), v) ==
+          next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+    for (uint32_t v : cache) {
+      if (std::find(next_cache.begin(), next_cache.end(), v) ==
+          next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+    // Rescore the vertices whose cache position or triangles changed, and
+    // the triangles using them.
+    for (uint32_t i = 0; i < next_cache.size(); ++i) {
+      uint32_t v = next_cache[i];
+      int cache_position = i < kScoreCacheSize ? i : -1;
+      vertex_scores[v] = VertexScore(cache_position, remaining_triangles[v]);
+    }
+    for (uint32_t v : next_cache) {
+      for (uint32_t i = 0; i < remaining_triangles[v]; ++i) {
+        uint32_t t = vertex_triangles[first_triangle[v] + i];
+        triangle_scores[t] = vertex_scores[indices[t * 3]] +
+                             vertex_scores[indices[t * 3 + 1]] +
+                             vertex_scores[indices[t * 3 + 2]];
+      }
+    }
+    if (next_cache.size() > kScoreCacheSize) {
+      next_cache.resize(kScoreCacheSize);
+    }
+    cache.swap(next_cache);
+  }
+  return optimized;
+}
+
+// Renumbers the vertices in the order |indices| first use them, unused ones
+// are dropped. Returns the new index of each vertex, UINT32_MAX for dropped
+// ones, and the number of vertices kept in |*kept_count|.
+std::vector<uint32_t> OptimizeVertexFetch(std::vector<uint32_t>* indices,
+                                          uint32_t vertex_count,
+                                          uint32_t* kept_count) {
+  std::vector<uint32_t> remap(vertex_count, UINT32_MAX);
+  uint32_t next = 0;
+  for (uint32_t& index : *indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+  *kept_count = next;
+  return remap;
+}
+
+template <typename T>
+std::vector<T> RemapAttribute(const std::vector<T>& attribute,
+                              const std::vector<uint32_t>& remap,
+                              uint32_t kept_count) {
+  if (attribute.empty()) {
+    return {};
+  }
+  std::vector<T> remapped(kept_count);
+  for (uint32_t v = 0; v < remap.size(); ++v) {
+    if (remap[v] != UINT32_MAX) {
+      remapped[remap[v]] = attribute[v];
+    }
+  }
+  return remapped;
+}
+
+// Hashes and compares vertices by the bytes of all their attributes.
+struct VertexKey {
+  const Mesh* mesh;
+
+  template <typename T>
+  static bool Equal(const std::vector<T>& attribute, uint32_t a, uint32_t b) {
+    return attribute.empty() ||
+           !memcmp(&attribute[a], &attribute[b], sizeof(T));
+  }
+
+  template <typename T>
+  static void Hash(const std::vector<T>& attribute, uint32_t v,
+                   uint64_t* hash) {
+    if (attribute.empty()) {
+      return;
+    }
+    // FNV-1a
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(&attribute[v]);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      *hash = (*hash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+
+  size_t operator()(uint32_t v) const {
+    uint64_t hash = 14695981039346656037ull;
+    Hash(mesh->positions(), v, &hash);
+    Hash(mesh->colors(), v, &hash);
+    Hash(mesh->uvs(), v, &hash);
+    return hash;
+  }
+  bool operator()(uint32_t a, uint32_t b) const {
+    return Equal(mesh->positions(), a, b) && Equal(mesh->colors(), a, b) &&
+           Equal(mesh->uvs(), a, b);
+  }
+};
+
+}  // namespace
+
+uint64_t CountCacheMisses(const std::vector<uint32_t>& indices,
+                          uint32_t vertex_count) {
+  // Time each vertex entered the cache, it is cached while fewer than
+  // kAcmrCacheSize misses followed.
+  std::vector<uint64_t> entered(vertex_count, 0);
+  uint64_t misses = 0;
+  for (uint32_t index : indices) {
+    if (!entered[index] || misses - entered[index] >= kAcmrCacheSize) {
+      ++misses;
+      entered[index] = misses;
+    }
+  }
+  return misses;
+}
+
+void MeshOptimizeStats::Print(const char* name) const {
+  printf("%s: %d meshes, vertex memory %.2f MB -> %.2f MB (%.2f MB saved), "
+         "ACMR %.3f -> %.3f, compressed vertices %.2f MB -> %.2f MB\n",
+         name, mesh_count, buffer_bytes_before / (1024.0 * 1024.0),
+         buffer_bytes_after / (1024.0 * 1024.0),
+         (double(buffer_bytes_before) - double(buffer_bytes_after)) /
+             (1024.0 * 1024.0),
+         acmr_before(), acmr_after(),
+         vertex_bytes_uncompressed / (1024.0 * 1024.0),
+         vertex_bytes_compressed / (1024.0 * 1024.0));
+}
+
+MeshOptimizeStats OptimizeMesh(Mesh* mesh, uint32_t vertex_stride) {
+  MeshOptimizeStats stats;
+  uint32_t vertex_count = mesh->positions().size();
+  if (!vertex_count) {
+    return stats;
+  }
+  std::vector<uint32_t> indices;
+  if (mesh->indexed_draw()) {
+    indices = mesh->indices();
+  } else {
+    indices.resize(vertex_count);
+    std::iota(indices.begin(), indices.end(), 0);
+  }
+  stats.mesh_count = 1;
+  stats.buffer_bytes_before = uint64_t(vertex_count) * vertex_stride +
+                              sizeof(Mesh::IndexType) * mesh->indices().size();
+  bool triangle_list =
+      mesh->draw_mode() == GL_TRIANGLES && indices.size() % 3 == 0;
+  if (triangle_list) {
+    stats.triangle_count = indices.size() / 3;
+    stats.cache_misses_before = CountCacheMisses(indices, vertex_count);
+  }
+
+  // Each vertex to the first one equal to it.
+  std::unordered_map<uint32_t, uint32_t, VertexKey, VertexKey> first_equal(
+      vertex_count, VertexKey{mesh}, VertexKey{mesh});
+  std::vector<uint32_t> weld(vertex_count);
+  for (uint32_t v = 0; v < vertex_count; ++v) {
+    weld[v] = first_equal.emplace(v, v).first->second;
+  }
+  uint32_t welded_count = first_equal.size();
+  for (uint32_t& index : indices) {
+    index = weld[index];
+  }
+
+  uint64_t indexed_bytes = uint64_t(welded_count) * vertex_stride +
+                           uint64_t(ElementIndexSize(welded_count)) *
+                               indices.size();
+  if (!mesh->indexed_draw() && indexed_bytes >= stats.buffer_bytes_before) {
+    stats.buffer_bytes_after = stats.buffer_bytes_before;
+    stats.cache_misses_after = stats.cache_misses_before;
+    return stats;
+  }
+
+  if (triangle_list) {
+    indices = OptimizeVertexCache(indices, vertex_count);
+  }
+  uint32_t kept_count = 0;
+  std::vector<uint32_t> remap =
+      OptimizeVertexFetch(&indices, vertex_count, &kept_count);
+  mesh->set_positions(RemapAttribute(mesh->positions(), remap, kept_count));
+  mesh->set_colors(RemapAttribute(mesh->colors(), remap, kept_count));
+  mesh->set_uvs(RemapAttribute(mesh->uvs(), remap, kept_count));
+  if (triangle_list) {
+    stats.cache_misses_after = CountCacheMisses(indices, kept_count);
+  }
+  stats.buffer_bytes_after = uint64_t(kept_count) * vertex_stride +
+                             uint64_t(ElementIndexSize(kept_count)) *
+                                 indices.size();
+  mesh->set_indices(std::move(indices));
+  return stats;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "core/mesh.h"
+
+// Entries of the FIFO post-transform cache ACMR is measured with.
+constexpr int kAcmrCacheSize = 16;
+
+// Bytes per index of an element buffer addressing |vertex_count| vertices,
+// 16-bit indices when they fit.
+inline uint32_t ElementIndexSize(size_t vertex_count) {
+  return vertex_count <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// What OptimizeMesh did, summed over meshes with Add.
+struct MeshOptimizeStats {
+  int mesh_count = 0;
+  // Vertex and index buffer bytes.
+  uint64_t buffer_bytes_before = 0;
+  uint64_t buffer_bytes_after = 0;
+  // Triangle lists only, for the average cache miss ratio.
+  uint64_t triangle_count = 0;
+  uint64_t cache_misses_before = 0;
+  uint64_t cache_misses_after = 0;
+  // Vertex buffer bytes in the float layout and in the compressed formats
+  // MeshRenderer picked, equal when vertices are not compressed.
+  uint64_t vertex_bytes_uncompressed = 0;
+  uint64_t vertex_bytes_compressed = 0;
+
+  void Add(const MeshOptimizeStats& other) {
+    mesh_count += other.mesh_count;
+    buffer_bytes_before += other.buffer_bytes_before;
+    buffer_bytes_after += other.buffer_bytes_after;
+    triangle_count += other.triangle_count;
+    cache_misses_before += other.cache_misses_before;
+    cache_misses_after += other.cache_misses_after;
+    vertex_bytes_uncompressed += other.vertex_bytes_uncompressed;
+    vertex_bytes_compressed += other.vertex_bytes_compressed;
+  }
+  float acmr_before() const {
+    return triangle_count ? float(cache_misses_before) / triangle_count : 0.0f;
+  }
+  float acmr_after() const {
+    return triangle_count ? float(cache_misses_after) / triangle_count : 0.0f;
+  }
+  // Prints one line, |name| being what the stats were summed over.
+  void Print(const char* name) const;
+};
+
+// Welds the vertices of |mesh| with equal attributes and draws it through
+// indices, when that takes less memory than the vertices it drops, and
+// reorders the indices of triangle lists for the post-transform cache and
+// then the vertices in the order the indices first use them. Triangle order
+// is kept where the mesh has no shared vertices, so separate islands such as
+// the dashes of a stripe stay in sequence. |vertex_stride| is the bytes per
+// interleaved vertex.
+MeshOptimizeStats OptimizeMesh(Mesh* mesh, uint32_t vertex_stride);
+
+// Vertices a FIFO cache of kAcmrCacheSize entries transforms to draw the
+// triangle list |indices|.
+uint64_t CountCacheMisses(const std::vector<uint32_t>& indices,
+                          uint32_t vertex_count);
@@ -1,69 +1,203 @@
 #pragma once
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <vector>
 
+#include <glm/gtc/packing.hpp>
+
 #include "core/buffer_manager.h"
 #include "core/mesh.h"
+#include "core/mesh_lod.h"
+#include "core/mesh_optimizer.h"
+
+class SharedVertexArrays;
+
+// Bits of a vertex attrib mask selecting the compressed format of an
+// attribute, next to the 1 << POSITION, COLOR and UV bits of the attributes
+// present.
+enum VertexFormatBits : uint16_t {
+  // unorm16 over MeshRenderer::position_bounds(), padded to 8 bytes.
+  kQuantizedPositionBit = 1 << 8,
+  // unorm16, all UVs in [0, 1].
+  kUnorm16UVBit = 1 << 9,
+  kHalfFloatUVBit = 1 << 10,
+};
+
+// Largest step between quantized positions, in local units (meters of the
+// map), so positions move by at most half of it.
+constexpr float kMaxPositionQuantizationStep = 0.01f;
+// Half floats step by at most 1/1024 below this.
+constexpr float kMaxHalfFloatUV = 2.0f;
+constexpr uint32_t kQuantizedPositionSize = 4 * sizeof(uint16_t);
+constexpr uint32_t kCompressedUVSize = 2 * sizeof(uint16_t);
 
 class MeshRenderer {
  public:
   MeshRenderer() = default;
-  ~MeshRenderer() { glDeleteVertexArrays(1, &vao_); }
-  void set_mesh(Mesh&& mesh) { mesh_ = mesh; }
+  ~MeshRenderer() {
+    if (vao_) {
+      glDeleteVertexArrays(1, &vao_);
+    }
+  }
+  void set_mesh(Mesh&& mesh) { mesh_ = std::move(mesh); }
   const Mesh& mesh() const { return mesh_; }
 
-  bool initialized() const { return vao_; }
+  bool initialized() const { return vbo_proxy_ != nullptr; }
+
+  // Builds the levels of detail of BuildMeshLods in PrepareUpload, otherwise
+  // the mesh only has level 0.
+  void set_build_lods(bool build_lods) { build_lods_ = build_lods; }
+  // Ranges of the levels in the element buffer, or in the vertex buffer of
+  // non indexed meshes. Filled by PrepareUpload.
+  const std::vector<MeshLod>& lods() const { return lods_; }
+  int SelectLod(float screen_size) const {
+    return SelectMeshLod(lods_, screen_size);
+  }
+
+  // When set, Render draws through the vertex array shared by all meshes of
+  // the same vertex format instead of creating one per mesh.
+  static void set_shared_vertex_arrays(SharedVertexArrays* vertex_arrays) {
+    shared_vertex_arrays_ = vertex_arrays;
+  }
+
+  // When set before loading, PrepareUpload stores positions and UVs in the
+  // formats of VertexFormatBits where they keep their precision.
+  static void set_compress_vertices(bool compress_vertices) {
+    compress_vertices_ = compress_vertices;
+  }
+
+  // Optimizes the mesh with OptimizeMesh, compresses the vertex format when
+  // set_compress_vertices is on, adding what both did to |*stats| unless
+  // null, and interleaves the vertex data into CPU staging memory ahead of
+  // Initialize. Needs no GL context so loader threads can run it. Returns
+  // staged bytes.
+  uint64_t PrepareUpload(MeshOptimizeStats* stats = nullptr) {
+    if (mesh_.positions().empty()) {
+      return 0;
+    }
+    vertex_format_ = 0;
+    MeshOptimizeStats optimize_stats =
+        OptimizeMesh(&mesh_, VertexAttribStride());
+    optimize_stats.vertex_bytes_uncompressed = VertexAttribSize();
+    if (compress_vertices_) {
+      vertex_format_ = SelectVertexFormat();
+    }
+    optimize_stats.vertex_bytes_compressed = VertexAttribSize();
+    if (stats) {
+      stats->Add(optimize_stats);
+    }
+    MeshLods lods;
+    if (build_lods_) {
+      lods = BuildMeshLods(mesh_);
+    } else {
+      lods.levels.push_back({0, uint32_t(mesh_.indexed_draw()
+                                             ? mesh_.indices().size()
+                                             : mesh_.positions().size())});
+    }
+    lods_ = std::move(lods.levels);
+
+    uint64_t vertex_size = VertexAttribSize();
+    if (mesh_.indexed_draw()) {
+      staging_.resize(vertex_size);
+      FillVertexBufferInterleaved(staging_.data());
+      // The indices of the levels of detail follow the mesh indices.
+      const std::vector<Mesh::IndexType>& indices = mesh_.indices();
+      index_staging_.resize(index_size() *
+                            (indices.size() + lods.elements.size()));
+      if (index_size() == sizeof(uint16_t)) {
+        uint16_t* staged = reinterpret_cast<uint16_t*>(index_staging_.data());
+        staged = std::copy(indices.begin(), indices.end(), staged);
+        std::copy(lods.elements.begin(), lods.elements.end(), staged);
+      } else {
+        uint32_t* staged = reinterpret_cast<uint32_t*>(index_staging_.data());
+        staged = std::copy(indices.begin(), indices.end(), staged);
+        std::copy(lods.elements.begin(), lods.elements.end(), staged);
+      }
+    } else {
+      // The levels of non indexed meshes draw copies of their vertices after
+      // the mesh vertices.
+      uint32_t stride = VertexAttribStride();
+      staging_.resize(vertex_size + stride * lods.elements.size());
+      FillVertexBufferInterleaved(staging_.data());
+      for (size_t i = 0; i < lods.elements.size(); ++i) {
+        memcpy(&staging_[vertex_size + i * stride],
+               &staging_[lods.elements[i] * stride], stride);
+      }
+    }
+    return staging_.size() + index_staging_.size();
+  }
+
   void Initialize(BufferManager* buffer_manager) {
     if (mesh_.positions().empty()) {
       return;
     }
-    if (!vao_) {
-      glGenVertexArrays(1, &vao_);
+    if (staging_.empty()) {
+      PrepareUpload();
     }
-
-    glBindVertexArray(vao_);
-    uint64_t total_size = VertexAttribSize();
-    vbo_proxy_ = buffer_manager->AllocateBuffer(total_size);
+    uint64_t total_size = staging_.size();
+    // Aligned to the stride so that the mesh starts at a whole vertex of
+    // the block, see RenderSharedVertexArray.
+    vbo_proxy_ = buffer_manager->AllocateBuffer(total_size,
+                                                VertexAttribStride());
     if (vbo_proxy_) {
-      std::vector<unsigned char> buffer(total_size);
-      FillVertexBufferInterleaved(buffer.data());
-      vbo_proxy_->SetData(buffer.data(), 0, total_size);
+      vbo_proxy_->SetData(staging_.data(), 0, total_size);
+      std::vector<unsigned char>().swap(staging_);
       // void* buffer = vbo_proxy_->Map(GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
       // FillVertexBufferInterleaved(buffer);
       // vbo_proxy_->Unmap();
     }
-    SetupVertexAttribFormat();
-    glBindVertexBuffer(0, 0, 0, VertexAttribStride());
 
     if (mesh_.indexed_draw()) {
-      ibo_proxy_ = buffer_manager->AllocateBuffer(sizeof(Mesh::IndexType) *
-                                                  mesh_.indices().size());
+      // Aligned so that the first index can be addressed in indices.
+      ibo_proxy_ = buffer_manager->AllocateBuffer(index_staging_.size(),
+                                                  index_size());
 
       if (ibo_proxy_) {
-        ibo_proxy_->SetData(mesh_.indices().data(), 0,
-                            sizeof(Mesh::IndexType) * mesh_.indices().size());
+        ibo_proxy_->SetData(index_staging_.data(), 0, index_staging_.size());
       }
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_proxy_->buffer_id());
+      std::vector<unsigned char>().swap(index_staging_);
     }
+  }
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  // Of the element buffer, 16-bit indices when the vertices allow.
+  uint32_t index_size() const {
+    return ElementIndexSize(mesh_.positions().size());
+  }
+  GLenum index_type() const {
+    return index_size() == sizeof(uint16_t) ? GL_UNSIGNED_SHORT
+                                            : GL_UNSIGNED_INT;
   }
 
-  void Render() {
+  // Draws level of detail |lod| of lods().
+  void Render(int lod = 0) {
     if (!initialized()) {
       return;
     }
+    const MeshLod& level = lods_[lod];
+    if (shared_vertex_arrays_) {
+      RenderSharedVertexArray(level);
+      return;
+    }
+    if (!vao_) {
+      CreateVertexArray();
+    }
     glBindVertexArray(vao_);
     glBindVertexBuffer(0, vbo_proxy_->buffer_id(), vbo_proxy_->offset(),
                        VertexAttribStride());
 
     if (mesh_.indexed_draw()) {
-      glDrawElements(mesh_.draw_mode(), mesh_.indices().size(), GL_UNSIGNED_INT,
-                     reinterpret_cast<const void*>(ibo_proxy_->offset()));
+      // BufferManager::Compact may have moved the indices to another buffer.
+      if (bound_ibo_ != ibo_proxy_->buffer_id()) {
+        bound_ibo_ = ibo_proxy_->buffer_id();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bound_ibo_);
+      }
+      glDrawElements(mesh_.draw_mode(), level.count, index_type(),
+                     reinterpret_cast<const void*>(ibo_proxy_->offset() +
+                                                   index_size() * level.first));
     } else {
-      glDrawArrays(mesh_.draw_mode(), 0, mesh_.positions().size());
+      glDrawArrays(mesh_.draw_mode(), level.first, level.count);
     }
   }
 
@@ -75,10 +209,16 @@ class MeshRenderer {
     int offset = 0;
     if (vertex_attrib_mask & (1 << POSITION)) {
       glEnableVertexAttribArray(POSITION);
-      glVertexAttribFormat(POSITION, Mesh::PositionType::length(), GL_FLOAT,
-                           GL_FALSE, offset);
+      if (vertex_attrib_mask & kQuantizedPositionBit) {
+        glVertexAttribFormat(POSITION, Mesh::PositionType::length(),
+                             GL_UNSIGNED_SHORT, GL_TRUE, offset);
+        offset += kQuantizedPositionSize;
+      } else {
+        glVertexAttribFormat(POSITION, Mesh::PositionType::length(), GL_FLOAT,
+                             GL_FALSE, offset);
+        offset += sizeof(Mesh::PositionType);
+      }
       glVertexAttribBinding(POSITION, 0);
-      offset += sizeof(Mesh::PositionType);
     }
 
     if (vertex_attrib_mask & (1 << COLOR)) {
@@ -90,26 +230,43 @@ class MeshRenderer {
     }
     if (vertex_attrib_mask & (1 << UV)) {
       glEnableVertexAttribArray(UV);
-      glVertexAttribFormat(UV, Mesh::UVType::length(), GL_FLOAT, GL_FALSE,
-                           offset);
+      if (vertex_attrib_mask & kUnorm16UVBit) {
+        glVertexAttribFormat(UV, Mesh::UVType::length(), GL_UNSIGNED_SHORT,
+                             GL_TRUE, offset);
+        offset += kCompressedUVSize;
+      } else if (vertex_attrib_mask & kHalfFloatUVBit) {
+        glVertexAttribFormat(UV, Mesh::UVType::length(), GL_HALF_FLOAT,
+                             GL_FALSE, offset);
+        offset += kCompressedUVSize;
+      } else {
+        glVertexAttribFormat(UV, Mesh::UVType::length(), GL_FLOAT, GL_FALSE,
+                             offset);
+        offset += sizeof(Mesh::UVType);
+      }
       glVertexAttribBinding(UV, 0);
-      offset += sizeof(Mesh::UVType);
     }
     glBindVertexBuffer(0, 0, 0, offset);
     glVertexBindingDivisor(0, 0);
   }
 
   uint32_t VertexAttribStride() const {
-    int16_t vam = vertex_attrib_mask();
-    int stride = 0;
-    if (vam & (1 << POSITION)) {
-      stride += sizeof(Mesh::PositionType);
+    return VertexAttribStride(vertex_attrib_mask());
+  }
+
+  static uint32_t VertexAttribStride(uint16_t vertex_attrib_mask) {
+    uint32_t stride = 0;
+    if (vertex_attrib_mask & (1 << POSITION)) {
+      stride += vertex_attrib_mask & kQuantizedPositionBit
+                    ? kQuantizedPositionSize
+                    : sizeof(Mesh::PositionType);
     }
-    if (vam & (1 << COLOR)) {
+    if (vertex_attrib_mask & (1 << COLOR)) {
       stride += sizeof(Mesh::ColorType);
     }
-    if (vam & (1 << UV)) {
-      stride += sizeof(Mesh::UVType);
+    if (vertex_attrib_mask & (1 << UV)) {
+      stride += vertex_attrib_mask & (kUnorm16UVBit | kHalfFloatUVBit)
+                    ? kCompressedUVSize
+                    : sizeof(Mesh::UVType);
     }
     return stride;
   }
@@ -122,8 +279,23 @@ class MeshRenderer {
     int16_t vam = vertex_attrib_mask();
     int vertex_count = mesh_.positions().size();
     unsigned char* buffer_ptr = (unsigned char*)buffer;
+    // Flat axes quantize to 0.
+    glm::vec3 position_size = position_bounds_.max - position_bounds_.min;
+    glm::vec3 position_scale(0.0f);
+    for (int axis = 0; axis < 3; ++axis) {
+      if (position_size[axis] > 0.0f) {
+        position_scale[axis] = 65535.0f / position_size[axis];
+      }
+    }
     for (int i = 0; i < vertex_count; ++i) {
-      if (vam & (1 << POSITION)) {
+      if (vam & kQuantizedPositionBit) {
+        glm::vec3 quantized = glm::round(
+            (mesh_.positions()[i] - position_bounds_.min) * position_scale);
+        uint16_t packed[4] = {uint16_t(quantized.x), uint16_t(quantized.y),
+                              uint16_t(quantized.z), 0};
+        memcpy(buffer_ptr, packed, kQuantizedPositionSize);
+        buffer_ptr += kQuantizedPositionSize;
+      } else if (vam & (1 << POSITION)) {
         memcpy(buffer_ptr, &mesh_.positions()[i], sizeof(Mesh::PositionType));
         buffer_ptr += sizeof(Mesh::PositionType);
       }
@@ -131,13 +303,33 @@ class MeshRenderer {
         memcpy(buffer_ptr, &mesh_.colors()[i], sizeof(Mesh::ColorType));
         buffer_ptr += sizeof(Mesh::ColorType);
       }
-      if (vam & (1 << UV)) {
+      if (vam & (kUnorm16UVBit | kHalfFloatUVBit)) {
+        uint32_t packed = vam & kUnorm16UVBit
+                              ? glm::packUnorm2x16(mesh_.uvs()[i])
+                              : glm::packHalf2x16(mesh_.uvs()[i]);
+        memcpy(buffer_ptr, &packed, kCompressedUVSize);
+        buffer_ptr += kCompressedUVSize;
+      } else if (vam & (1 << UV)) {
         memcpy(buffer_ptr, &mesh_.uvs()[i], sizeof(Mesh::UVType));
         buffer_ptr += sizeof(Mesh::UVType);
       }
     }
   }
 
+  // Maps quantized positions back to the mesh space, the world matrix of
+  // the mesh is applied after it. Identity when positions are not quantized.
+  glm::mat4 position_dequantization() const {
+    glm::mat4 dequantization(1.0f);
+    if (vertex_format_ & kQuantizedPositionBit) {
+      glm::vec3 size = position_bounds_.max - position_bounds_.min;
+      dequantization[0][0] = size.x;
+      dequantization[1][1] = size.y;
+      dequantization[2][2] = size.z;
+      dequantization[3] = glm::vec4(position_bounds_.min, 1.0f);
+    }
+    return dequantization;
+  }
+
   uint16_t vertex_attrib_mask() const {
     uint16_t mask = 0;
     if (mesh_.positions().size()) {
@@ -149,15 +341,170 @@ class MeshRenderer {
     if (mesh_.uvs().size()) {
       mask |= 1 << UV;
     }
-    return mask;
+    return mask | vertex_format_;
   }
 
   const BufferProxy* vbo() const { return vbo_proxy_.get(); }
   const BufferProxy* ibo() const { return ibo_proxy_.get(); }
 
+  // Drops the element buffer recorded for vao_ when it is one of the deleted
+  // or relocated |buffers|, whose ids may name a new buffer now.
+  void ForgetBuffers(const std::set<GLuint>& buffers) {
+    if (buffers.count(bound_ibo_)) {
+      bound_ibo_ = 0;
+    }
+  }
+
  private:
+  void CreateVertexArray() {
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    SetupVertexAttribFormat();
+    if (ibo_proxy_) {
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_proxy_->buffer_id());
+      bound_ibo_ = ibo_proxy_->buffer_id();
+    }
+  }
+
+  inline void RenderSharedVertexArray(const MeshLod& level);
+
+  // VertexFormatBits of the attributes of mesh_ that keep their precision
+  // compressed, sets position_bounds_.
+  uint16_t SelectVertexFormat() {
+    uint16_t format = 0;
+    position_bounds_ = BoundingBox();
+    for (const Mesh::PositionType& position : mesh_.positions()) {
+      position_bounds_.Extend(position);
+    }
+    glm::vec3 size = position_bounds_.max - position_bounds_.min;
+    if (glm::max(size.x, glm::max(size.y, size.z)) <=
+        kMaxPositionQuantizationStep * 65535.0f) {
+      format |= kQuantizedPositionBit;
+    }
+    if (!mesh_.uvs().empty()) {
+      float min_uv = FLT_MAX;
+      float max_uv = -FLT_MAX;
+      for (const Mesh::UVType& uv : mesh_.uvs()) {
+        min_uv = std::min({min_uv, uv.x, uv.y});
+        max_uv = std::max({max_uv, uv.x, uv.y});
+      }
+      if (min_uv >= 0.0f && max_uv <= 1.0f) {
+        format |= kUnorm16UVBit;
+      } else if (min_uv >= -kMaxHalfFloatUV && max_uv <= kMaxHalfFloatUV) {
+        format |= kHalfFloatUVBit;
+      }
+    }
+    return format;
+  }
+
+  inline static SharedVertexArrays* shared_vertex_arrays_ = nullptr;
+  // Set on the GL thread before loading starts, read by loader threads.
+  inline static bool compress_vertices_ = false;
+
   std::unique_ptr<BufferProxy> vbo_proxy_;
   std::unique_ptr<BufferProxy> ibo_proxy_;
+  std::vector<unsigned char> staging_;
+  // Indices of index_size() bytes, staged until Initialize uploads them.
+  std::vector<unsigned char> index_staging_;
+  bool build_lods_ = false;
+  std::vector<MeshLod> lods_;
+  // VertexFormatBits picked by PrepareUpload.
+  uint16_t vertex_format_ = 0;
+  // Of the positions, the range quantized positions cover.
+  BoundingBox position_bounds_;
   GLuint vao_ = 0;
+  // Element buffer recorded in vao_.
+  GLuint bound_ibo_ = 0;
   Mesh mesh_;
-};
\ No newline at end of file
+};
+
+// One vertex array per vertex format for all meshes of that format. Vertex
+// buffers are allocated at a multiple of their stride, so every mesh is bound
+// at the start of the block holding it and drawn with a base vertex (and
+// first index), switching between meshes only rebinds when the block changes.
+// Bindings are tracked to skip redundant GL calls.
+class SharedVertexArrays {
+ public:
+  SharedVertexArrays() = default;
+  ~SharedVertexArrays() {
+    for (auto& pair : vertex_arrays_) {
+      glDeleteVertexArrays(1, &pair.second.vao);
+    }
+  }
+
+  SharedVertexArrays(const SharedVertexArrays&) = delete;
+  SharedVertexArrays& operator=(const SharedVertexArrays&) = delete;
+
+  // Binds the vertex array of |vertex_attrib_mask| with vertex buffer binding
+  // 0 at the start of |vertex_buffer| and, unless 0, |element_buffer|.
+  void Bind(uint16_t vertex_attrib_mask, uint32_t stride, GLuint vertex_buffer,
+            GLuint element_buffer) {
+    VertexArray& vertex_array = vertex_arrays_[vertex_attrib_mask];
+    if (!vertex_array.vao) {
+      glGenVertexArrays(1, &vertex_array.vao);
+      glBindVertexArray(vertex_array.vao);
+      MeshRenderer::SetupVertexAttribFormat(vertex_attrib_mask);
+      bound_vao_ = vertex_array.vao;
+    }
+    if (vertex_array.vertex_buffer != vertex_buffer) {
+      glVertexArrayVertexBuffer(vertex_array.vao, 0, vertex_buffer, 0, stride);
+      vertex_array.vertex_buffer = vertex_buffer;
+    }
+    if (element_buffer && vertex_array.element_buffer != element_buffer) {
+      glVertexArrayElementBuffer(vertex_array.vao, element_buffer);
+      vertex_array.element_buffer = element_buffer;
+    }
+    if (bound_vao_ != vertex_array.vao) {
+      glBindVertexArray(vertex_array.vao);
+      bound_vao_ = vertex_array.vao;
+    }
+  }
+
+  // Call after anything else bound a vertex array.
+  void ResetBinding() { bound_vao_ = 0; }
+
+  // Drops the bindings of the deleted or relocated |buffers|, so a new buffer
+  // created with one of their ids is bound again.
+  void ForgetBuffers(const std::set<GLuint>& buffers) {
+    for (auto& pair : vertex_arrays_) {
+      VertexArray& vertex_array = pair.second;
+      if (buffers.count(vertex_array.vertex_buffer)) {
+        vertex_array.vertex_buffer = 0;
+      }
+      if (buffers.count(vertex_array.element_buffer)) {
+        vertex_array.element_buffer = 0;
+      }
+    }
+  }
+
+  int vertex_array_count() const { return vertex_arrays_.size(); }
+
+ private:
+  struct VertexArray {
+    GLuint vao = 0;
+    GLuint vertex_buffer = 0;
+    GLuint element_buffer = 0;
+  };
+
+  std::map<uint16_t, VertexArray> vertex_arrays_;
+  GLuint bound_vao_ = 0;
+};
+
+void MeshRenderer::RenderSharedVertexArray(const MeshLod& level) {
+  // The binding is at the start of the block, which all meshes of the block
+  // share, and the mesh is reached through the base vertex.
+  uint32_t stride = VertexAttribStride();
+  GLint base_vertex = vbo_proxy_->offset() / stride;
+  shared_vertex_arrays_->Bind(vertex_attrib_mask(), stride,
+                              vbo_proxy_->buffer_id(),
+                              ibo_proxy_ ? ibo_proxy_->buffer_id() : 0);
+  if (mesh_.indexed_draw()) {
+    glDrawElementsBaseVertex(
+        mesh_.draw_mode(), level.count, index_type(),
+        reinterpret_cast<const void*>(ibo_proxy_->offset() +
+                                      index_size() * level.first),
+        base_vertex);
+  } else {
+    glDrawArrays(mesh_.draw_mode(), base_vertex + level.first, level.count);
+  }
+}
@@ -0,0 +1,76 @@
+#include "core/persistent_ring_buffer.h"
+
+namespace {
+
+constexpr GLbitfield kMapFlags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+// A fence not signaled after this long means the GPU is lost, stop waiting.
+constexpr GLuint64 kFenceTimeout = 1000000000;  // 1s in ns
+
+}  // namespace
+
+PersistentRingBuffer::PersistentRingBuffer(int frame_count, int alignment)
+    : alignment_(alignment), fences_(frame_count, nullptr) {}
+
+PersistentRingBuffer::~PersistentRingBuffer() {
+  for (GLsync fence : fences_) {
+    if (fence) {
+      glDeleteSync(fence);
+    }
+  }
+  if (buffer_id_) {
+    glUnmapNamedBuffer(buffer_id_);
+    glDeleteBuffers(1, &buffer_id_);
+  }
+}
+
+void* PersistentRingBuffer::BeginFrame(GLsizeiptr size) {
+  frame_index_ = (frame_index_ + 1) % fences_.size();
+  if (size > region_size_) {
+    Allocate(size + size / 2);
+  }
+  WaitFence(frame_index_);
+  return mapped_ + frame_offset();
+}
+
+void PersistentRingBuffer::EndFrame() {
+  GLsync& fence = fences_[frame_index_];
+  if (fence) {
+    glDeleteSync(fence);
+  }
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void PersistentRingBuffer::Allocate(GLsizeiptr region_size) {
+  // The old buffer may still be read by the GPU, GL keeps its storage alive
+  // until then, so its fences are not needed any more.
+  for (GLsync& fence : fences_) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+  if (buffer_id_) {
+    glUnmapNamedBuffer(buffer_id_);
+    glDeleteBuffers(1, &buffer_id_);
+  }
+  region_size_ = (region_size + alignment_ - 1) / alignment_ * alignment_;
+  ++allocation_count_;
+  glCreateBuffers(1, &buffer_id_);
+  glNamedBufferStorage(buffer_id_, size(), nullptr, kMapFlags);
+  mapped_ = static_cast<char*>(
+      glMapNamedBufferRange(buffer_id_, 0, size(), kMapFlags));
+}
+
+void PersistentRingBuffer::WaitFence(int index) {
+  GLsync& fence = fences_[index];
+  if (!fence) {
+    return;
+  }
+  GLenum result = glClientWaitSync(fence, 0, 0);
+  if (result == GL_TIMEOUT_EXPIRED) {
+    glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kFenceTimeout);
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
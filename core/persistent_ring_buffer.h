@@ -0,0 +1,51 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+
+// A buffer split into |frame_count| regions that stay persistently and
+// coherently mapped. Each frame writes its data into the next region through
+// the mapping and fences it once the draws reading it are issued; a region is
+// only written again when its fence from |frame_count| frames ago has
+// signaled, which normally is long done, so uploads never synchronize with
+// the driver.
+class PersistentRingBuffer {
+ public:
+  // Region sizes are rounded up to |alignment|, e.g. the uniform buffer
+  // offset alignment so regions can be bound as uniform buffers.
+  explicit PersistentRingBuffer(int frame_count = 3, int alignment = 256);
+  ~PersistentRingBuffer();
+
+  PersistentRingBuffer(const PersistentRingBuffer&) = delete;
+  PersistentRingBuffer& operator=(const PersistentRingBuffer&) = delete;
+
+  // Moves to the next region, grown to hold at least |size| bytes, and
+  // returns its mapping. Growing replaces the buffer.
+  void* BeginFrame(GLsizeiptr size);
+  // Fences the region written since BeginFrame, call after the draws that
+  // read it.
+  void EndFrame();
+
+  GLuint buffer_id() const { return buffer_id_; }
+  // Of the current region in the buffer.
+  GLintptr frame_offset() const { return frame_index_ * region_size_; }
+  GLsizeiptr region_size() const { return region_size_; }
+  GLsizeiptr size() const { return region_size_ * fences_.size(); }
+  int frame_index() const { return frame_index_; }
+  int frame_count() const { return fences_.size(); }
+  // Incremented whenever growing replaced the buffer and its contents.
+  int allocation_count() const { return allocation_count_; }
+
+ private:
+  void Allocate(GLsizeiptr region_size);
+  void WaitFence(int index);
+
+  const int alignment_;
+  GLuint buffer_id_ = 0;
+  char* mapped_ = nullptr;
+  GLsizeiptr region_size_ = 0;
+  int frame_index_ = 0;
+  int allocation_count_ = 0;
+  std::vector<GLsync> fences_;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Stable LSD radix sort of the indices of |keys|, 8 bits per pass. Passes
+// over bytes that are equal in all keys are skipped, so keys that only use a
+// few of their bits sort in a few passes. On return |order| holds the indices
+// of |keys| in ascending key order, equal keys keep their relative order.
+inline void RadixSortIndices(const std::vector<uint64_t>& keys,
+                             std::vector<uint32_t>* order) {
+  constexpr int kRadixBits = 8;
+  constexpr int kRadixSize = 1 << kRadixBits;
+  constexpr int kPassCount = 64 / kRadixBits;
+
+  order->resize(keys.size());
+  std::iota(order->begin(), order->end(), 0);
+  if (keys.size() < 2) {
+    return;
+  }
+
+  uint32_t histograms[kPassCount][kRadixSize] = {};
+  for (uint64_t key : keys) {
+    for (int pass = 0; pass < kPassCount; ++pass) {
+      ++histograms[pass][(key >> (pass * kRadixBits)) & (kRadixSize - 1)];
+    }
+  }
+
+  std::vector<uint32_t> scratch(keys.size());
+  for (int pass = 0; pass < kPassCount; ++pass) {
+    uint32_t* histogram = histograms[pass];
+    int shift = pass * kRadixBits;
+    if (histogram[(keys[0] >> shift) & (kRadixSize - 1)] == keys.size()) {
+      continue;
+    }
+    uint32_t offset = 0;
+    for (int i = 0; i < kRadixSize; ++i) {
+      uint32_t count = histogram[i];
+      histogram[i] = offset;
+      offset += count;
+    }
+    for (uint32_t index : *order) {
+      scratch[histogram[(keys[index] >> shift) & (kRadixSize - 1)]++] = index;
+    }
+    order->swap(scratch);
+  }
+}
@@ -6,8 +6,31 @@
 #include <map>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// Locations of the uniforms the non command list draw paths set, named after
+// the GLSL uniforms, -1 when the program does not use one.
+struct ProgramUniformLocations {
+  GLint vp = -1;
+  GLint m = -1;
+  GLint color = -1;
+  GLint in_alpha = -1;
+  GLint tex0 = -1;
+
+  static ProgramUniformLocations Query(GLuint program) {
+    ProgramUniformLocations locations;
+    if (program) {
+      locations.vp = glGetUniformLocation(program, "VP");
+      locations.m = glGetUniformLocation(program, "M");
+      locations.color = glGetUniformLocation(program, "color");
+      locations.in_alpha = glGetUniformLocation(program, "in_alpha");
+      locations.tex0 = glGetUniformLocation(program, "tex0");
+    }
+    return locations;
+  }
+};
+
 class ShaderManager {
  public:
   ShaderManager() = default;
@@ -22,6 +45,7 @@ class ShaderManager {
 
   void RegisterShaderForName(const std::string& shader_name, GLuint program) {
     loaded_programs_[shader_name] = program;
+    uniform_locations_[program] = ProgramUniformLocations::Query(program);
   }
 
   void LoadShaderForName(const std::string& shader_name,
@@ -50,13 +74,16 @@ class ShaderManager {
     }
 
     if (loaded_programs_.find(shader_name) == loaded_programs_.end()) {
-      loaded_programs_[shader_name] = LinkShaderProgram(
-          {loaded_shaders_[vert_src_path], loaded_shaders_[frag_src_path]});
+      RegisterShaderForName(
+          shader_name, LinkShaderProgram({loaded_shaders_[vert_src_path],
+                                          loaded_shaders_[frag_src_path]}));
     } else {
       if (reload) {
+        uniform_locations_.erase(loaded_programs_[shader_name]);
         glDeleteProgram(loaded_programs_[shader_name]);
-        loaded_programs_[shader_name] = LinkShaderProgram(
-            {loaded_shaders_[vert_src_path], loaded_shaders_[frag_src_path]});
+        RegisterShaderForName(
+            shader_name, LinkShaderProgram({loaded_shaders_[vert_src_path],
+                                            loaded_shaders_[frag_src_path]}));
       }
     }
   }
@@ -68,10 +95,17 @@ class ShaderManager {
     return 0;
   }
 
-  std::map<std::string, GLuint> loaded_programs() const {
+  const std::map<std::string, GLuint>& loaded_programs() const {
     return loaded_programs_;
   }
 
+  // Queried once when the program is registered or relinked.
+  const ProgramUniformLocations& uniform_locations(GLuint program) const {
+    static const ProgramUniformLocations kNoLocations;
+    auto iter = uniform_locations_.find(program);
+    return iter != uniform_locations_.end() ? iter->second : kNoLocations;
+  }
+
  private:
   std::string ReadFileToString(const char* file) {
     std::ifstream f(file);  // taking file as inputstream
@@ -131,4 +165,5 @@ class ShaderManager {
 
   std::map<std::string, GLuint> loaded_programs_;
   std::map<std::string, GLuint> loaded_shaders_;
+  std::unordered_map<GLuint, ProgramUniformLocations> uniform_locations_;
 };
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "core/task_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+// Worker index of the current thread in the scheduler that owns it.
+thread_local const TaskScheduler* current_scheduler = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(int worker_count) {
+  if (worker_count <= 0) {
+    worker_count =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+  for (int i = 0; i < worker_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (int i = 0; i < worker_count; ++i) {
+    workers_[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+void TaskScheduler::Submit(Task task, TaskCounter* counter) {
+  if (counter) {
+    counter->count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  int index = current_scheduler == this
+                  ? current_worker
+                  : next_worker_++ % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->entries.push_back(Entry{std::move(task), counter});
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  // Taking the lock orders the increment with a worker about to sleep.
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_one();
+}
+
+void TaskScheduler::Wait(TaskCounter* counter) {
+  int index = current_scheduler == this ? current_worker : -1;
+  while (!counter->done()) {
+    if (!TryRunOne(index)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TaskScheduler::WorkerLoop(int index) {
+  current_scheduler = this;
+  current_worker = index;
+  while (true) {
+    if (TryRunOne(index)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this]() {
+      return stop_ || queued_.load(std::memory_order_acquire) > 0;
+    });
+    if (stop_ && queued_.load(std::memory_order_acquire) == 0) {
+      return;
+    }
+  }
+}
+
+bool TaskScheduler::PopLocal(int index, Entry* entry) {
+  Worker& worker = *workers_[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.entries.empty()) {
+    return false;
+  }
+  *entry = std::move(worker.entries.back());
+  worker.entries.pop_back();
+  return true;
+}
+
+bool TaskScheduler::Steal(int thief, Entry* entry) {
+  int count = static_cast<int>(workers_.size());
+  int start = thief < 0 ? 0 : thief + 1;
+  for (int i = 0; i < count; ++i) {
+    int victim = (start + i) % count;
+    if (victim == thief) {
+      continue;
+    }
+    Worker& worker = *workers_[victim];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.entries.empty()) {
+      *entry = std::move(worker.entries.front());
+      worker.entries.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TaskScheduler::TryRunOne(int index) {
+  Entry entry;
+  if ((index >= 0 && PopLocal(index, &entry)) || Steal(index, &entry)) {
+    queued_.fetch_sub(1, std::memory_order_acq_rel);
+    Run(entry);
+    return true;
+  }
+  return false;
+}
+
+void TaskScheduler::Run(Entry& entry) {
+  entry.task();
+  if (entry.counter) {
+    entry.counter->count_.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
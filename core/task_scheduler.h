@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the outstanding tasks submitted with it, see TaskScheduler::Wait.
+class TaskCounter {
+ public:
+  TaskCounter() = default;
+  TaskCounter(const TaskCounter&) = delete;
+  TaskCounter& operator=(const TaskCounter&) = delete;
+
+  bool done() const { return count_.load(std::memory_order_acquire) == 0; }
+
+ private:
+  friend class TaskScheduler;
+  std::atomic<int> count_{0};
+};
+
+// Fixed pool of worker threads, each owning a deque of tasks. Workers pop
+// their own deque from the back (LIFO, tasks spawned by a task run while its
+// data is hot) and steal from the front of the others when they run dry.
+// Tasks submitted from outside the pool are spread round robin.
+class TaskScheduler {
+ public:
+  using Task = std::function<void()>;
+
+  // |worker_count| <= 0 sizes the pool to the hardware concurrency, leaving
+  // one core to the calling (GL) thread.
+  explicit TaskScheduler(int worker_count = 0);
+  // Runs every queued task before joining the workers.
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  void Submit(Task task, TaskCounter* counter = nullptr);
+
+  // Blocks until every task submitted with |counter| has finished, running
+  // queued tasks on the calling thread in the meantime.
+  void Wait(TaskCounter* counter);
+
+  int worker_count() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  struct Entry {
+    Task task;
+    TaskCounter* counter = nullptr;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Entry> entries;
+    std::thread thread;
+  };
+
+  void WorkerLoop(int index);
+  bool PopLocal(int index, Entry* entry);
+  bool Steal(int thief, Entry* entry);
+  bool TryRunOne(int index);
+  void Run(Entry& entry);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<int> queued_{0};
+  std::atomic<unsigned> next_worker_{0};
+  std::atomic<bool> stop_{false};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+};
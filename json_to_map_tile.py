@@ -0,0 +1,232 @@
+import argparse
+import json
+import math
+import struct
+from base64 import b64decode
+import os
+from tqdm import tqdm
+
+# Must match core/map_tile.h
+MAGIC = b"NVMT"
+VERSION = 1
+STRING_SIZE = 64
+INVALID_INDEX = 0xffffffff
+NO_BLOB = 0xffffffffffffffff
+ALIGNMENT = 16
+
+HEADER_FORMAT = "<4sIIIIIQQQQQ"
+NODE_FORMAT = "<IIII"
+RECORD_FORMAT = "<QQQQ16f4fffiiiIIIII"
+
+def align(size):
+  return (size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+def has_mesh(json_obj):
+  """Whether an object or one of its sub meshes is a leaf."""
+  if "sub_mesh" not in json_obj:
+    return True
+  return any(has_mesh(s) for s in json_obj["sub_mesh"])
+
+class MapTileWriter:
+  def __init__(self):
+    self.strings = []
+    self.string_indices = {}
+    self.nodes = []
+    self.records = []
+    self.blob = bytearray()
+
+  def string_index(self, s):
+    if s not in self.string_indices:
+      if len(s.encode("utf-8")) >= STRING_SIZE:
+        raise ValueError(f"string too long: {s}")
+      self.string_indices[s] = len(self.strings)
+      self.strings.append(s)
+    return self.string_indices[s]
+
+  def add_blob(self, key, value):
+    """Appends an attribute array, returns (offset, size in bytes)."""
+    if value is None:
+      return NO_BLOB, 0
+    if isinstance(value, str):
+      data = b64decode(value)
+    else:
+      flat = []
+      for e in value:
+        flat += e
+      if key == "color":
+        data = struct.pack(f"<{len(flat)}B", *flat)
+      else:
+        data = struct.pack(f"<{len(flat)}f", *flat)
+    offset = len(self.blob)
+    self.blob += data
+    self.blob += bytes(align(len(self.blob)) - len(self.blob))
+    return offset, len(data)
+
+  def add_record(self, json_obj):
+    draw_info = json_obj["draw_info"]
+    mesh = json_obj["mesh"]
+    line_style = draw_info.get("line_style", {})
+    world = [v for col in draw_info["world_matrix"] for v in col]
+    color = draw_info.get("color", [1.0, 1.0, 1.0, 1.0])
+
+    position_offset, position_size = self.add_blob("position",
+                                                   mesh.get("position"))
+    color_offset, _ = self.add_blob("color", mesh.get("color"))
+    uv_offset, _ = self.add_blob("uv", mesh.get("uv"))
+
+    record = struct.pack(
+        RECORD_FORMAT,
+        position_offset,
+        color_offset,
+        uv_offset,
+        NO_BLOB,
+        *world,
+        *color,
+        draw_info.get("alpha", 1.0),
+        line_style.get("line_width", 1.0),
+        int(line_style.get("line_stipple", False)),
+        line_style.get("line_stipple_factor", 1),
+        line_style.get("line_stipple_pattern", 0x00FF),
+        self.string_index(draw_info["shader"]),
+        draw_info["draw_mode"],
+        position_size // 12,
+        0,
+        0)
+    self.records.append(record)
+    return len(self.records) - 1
+
+  def add_objects(self, json_objs):
+    # Nodes are laid out breadth first so that the children of every group
+    # are contiguous, roots occupy [0, len(json_objs)).
+    queue = []
+    for json_obj in json_objs:
+      self.nodes.append(None)
+      queue.append((len(self.nodes) - 1, json_obj))
+
+    while queue:
+      node_index, json_obj = queue.pop(0)
+      type_index = self.string_index(json_obj["type"])
+      if "sub_mesh" in json_obj:
+        # MapTile::Validate rejects groups without children.
+        sub_meshes = [s for s in json_obj["sub_mesh"] if has_mesh(s)]
+        first_child = len(self.nodes)
+        for sub_mesh in sub_meshes:
+          self.nodes.append(None)
+          queue.append((len(self.nodes) - 1, sub_mesh))
+        self.nodes[node_index] = struct.pack(
+            NODE_FORMAT, type_index, INVALID_INDEX, first_child,
+            len(sub_meshes))
+      else:
+        self.nodes[node_index] = struct.pack(
+            NODE_FORMAT, type_index, self.add_record(json_obj), 0, 0)
+
+  def write(self, output_fn, root_count):
+    header_size = struct.calcsize(HEADER_FORMAT)
+    string_table_offset = align(header_size)
+    node_table_offset = align(string_table_offset +
+                              len(self.strings) * STRING_SIZE)
+    record_table_offset = align(node_table_offset +
+                                len(self.nodes) * struct.calcsize(NODE_FORMAT))
+    blob_offset = align(record_table_offset +
+                        len(self.records) * struct.calcsize(RECORD_FORMAT))
+
+    with open(output_fn, "wb") as f:
+      f.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(self.strings),
+                          len(self.nodes), root_count, len(self.records),
+                          string_table_offset, node_table_offset,
+                          record_table_offset, blob_offset, len(self.blob)))
+      f.write(bytes(string_table_offset - f.tell()))
+      for s in self.strings:
+        f.write(s.encode("utf-8").ljust(STRING_SIZE, b"\0"))
+      f.write(bytes(node_table_offset - f.tell()))
+      for node in self.nodes:
+        f.write(node)
+      f.write(bytes(record_table_offset - f.tell()))
+      for record in self.records:
+        f.write(record)
+      f.write(bytes(blob_offset - f.tell()))
+      f.write(self.blob)
+
+def decode_floats(value):
+  if isinstance(value, str):
+    data = b64decode(value)
+    return struct.unpack(f"<{len(data) // 4}f", data)
+  flat = []
+  for e in value:
+    flat += e
+  return flat
+
+def object_center(json_obj):
+  """World space xy center of the bounds of all meshes of an object."""
+  lo = [math.inf, math.inf]
+  hi = [-math.inf, -math.inf]
+  stack = [json_obj]
+  while stack:
+    obj = stack.pop()
+    stack += obj.get("sub_mesh", [])
+    if "mesh" not in obj or "position" not in obj["mesh"]:
+      continue
+    m = obj["draw_info"]["world_matrix"]
+    p = decode_floats(obj["mesh"]["position"])
+    for i in range(0, len(p) - 2, 3):
+      for axis in range(2):
+        v = (m[0][axis] * p[i] + m[1][axis] * p[i + 1] +
+             m[2][axis] * p[i + 2] + m[3][axis])
+        lo[axis] = min(lo[axis], v)
+        hi[axis] = max(hi[axis], v)
+  if lo[0] > hi[0]:
+    return None
+  return [(lo[0] + hi[0]) * 0.5, (lo[1] + hi[1]) * 0.5]
+
+def write_tiles(json_objs, dst_dir, tile_size):
+  """Buckets objects into square tiles by the center of their bounds and
+  writes one map tile per bucket plus index.json, see app/map_streamer.h."""
+  if not os.path.exists(dst_dir):
+    os.makedirs(dst_dir)
+  buckets = {}
+  for json_obj in tqdm(json_objs):
+    center = object_center(json_obj)
+    if center is None:
+      continue
+    key = (math.floor(center[0] / tile_size),
+           math.floor(center[1] / tile_size))
+    buckets.setdefault(key, []).append(json_obj)
+
+  tiles = []
+  for (x, y), objs in sorted(buckets.items()):
+    file_name = f"tile_{x}_{y}.nvmt"
+    writer = MapTileWriter()
+    writer.add_objects(objs)
+    writer.write(os.path.join(dst_dir, file_name), len(objs))
+    tiles.append({"x": x, "y": y, "file": file_name})
+  json.dump({"tile_size": tile_size, "tiles": tiles},
+            open(os.path.join(dst_dir, "index.json"), "w"), indent=2)
+  print(f"{len(json_objs)} objects in {len(tiles)} tiles -> {dst_dir}")
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--src_dir", default="assets/dumped_map_data_compact")
+  parser.add_argument("--output", default="assets/dumped_map_data.nvmt")
+  parser.add_argument("--tile_size", type=float, default=0,
+                      help="split into streamable tiles of this size")
+  parser.add_argument("--tile_dir", default="assets/map_tiles")
+  args = parser.parse_args()
+
+  files = os.listdir(args.src_dir)
+  json_objs = []
+  for f in tqdm(files):
+    input_fn = os.path.join(args.src_dir, f)
+    json_objs.append(json.load(open(input_fn)))
+
+  if args.tile_size > 0:
+    write_tiles(json_objs, args.tile_dir, args.tile_size)
+    return
+
+  writer = MapTileWriter()
+  writer.add_objects(json_objs)
+  writer.write(args.output, len(json_objs))
+  print(f"{len(json_objs)} objects, {len(writer.records)} meshes, "
+        f"{len(writer.blob) / 1024 / 1024:.2f}MB vertex data -> {args.output}")
+
+if __name__ == "__main__":
+  main()
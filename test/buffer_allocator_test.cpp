@@ -0,0 +1,163 @@
+// CPU tests of the buffer allocators: allocation, free, coalescing of free
+// neighbours, alignment and a randomized run checked against a byte map of
+// the block. Prints the failed checks and exits with 1 if there are any.
+//
+//   make buffer_allocator_test && ./buffer_allocator_test
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "core/buffer_allocator.h"
+
+namespace {
+
+int failure_count = 0;
+
+#define CHECK(condition)                                               \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition);    \
+      ++failure_count;                                                 \
+    }                                                                  \
+  } while (0)
+
+constexpr int32_t kCapacity = 1 << 16;
+
+const char* AllocatorName(BufferAllocatorType type) {
+  return type == kFirstFitAllocator ? "first fit" : "segregated fit";
+}
+
+void TestAllocateAndFree(BufferAllocatorType type) {
+  auto allocator = CreateBufferAllocator(type, kCapacity);
+  int32_t a = allocator->Alloc(100);
+  int32_t b = allocator->Alloc(200);
+  CHECK(a != BufferAllocator::kInvalidOffset);
+  CHECK(b != BufferAllocator::kInvalidOffset);
+  CHECK(a + 100 <= b || b + 200 <= a);
+  BufferAllocatorStats stats = allocator->stats();
+  CHECK(stats.used_size == 300);
+  CHECK(stats.free_size == kCapacity - 300);
+  CHECK(stats.allocation_count == 2);
+
+  allocator->Free(a, 100);
+  allocator->Free(b, 200);
+  stats = allocator->stats();
+  CHECK(stats.used_size == 0);
+  CHECK(stats.allocation_count == 0);
+
+  // Too large, and then exactly the whole block.
+  CHECK(allocator->Alloc(kCapacity + 1) == BufferAllocator::kInvalidOffset);
+  int32_t all = allocator->Alloc(kCapacity);
+  CHECK(all == 0);
+  CHECK(allocator->Alloc(1) == BufferAllocator::kInvalidOffset);
+  allocator->Free(all, kCapacity);
+}
+
+void TestCoalescing(BufferAllocatorType type) {
+  auto allocator = CreateBufferAllocator(type, kCapacity);
+  constexpr int32_t kSize = kCapacity / 4;
+  int32_t offsets[4];
+  for (int32_t& offset : offsets) {
+    offset = allocator->Alloc(kSize);
+    CHECK(offset != BufferAllocator::kInvalidOffset);
+  }
+  CHECK(allocator->Alloc(1) == BufferAllocator::kInvalidOffset);
+
+  // Freeing the second and fourth leaves two separate ranges, freeing the
+  // third in between merges all three.
+  allocator->Free(offsets[1], kSize);
+  allocator->Free(offsets[3], kSize);
+  BufferAllocatorStats stats = allocator->stats();
+  CHECK(stats.free_range_count == 2);
+  CHECK(stats.largest_free_range == kSize);
+  CHECK(allocator->Alloc(kSize * 2) == BufferAllocator::kInvalidOffset);
+
+  allocator->Free(offsets[2], kSize);
+  stats = allocator->stats();
+  CHECK(stats.free_range_count == 1);
+  CHECK(stats.largest_free_range == kSize * 3);
+  CHECK(stats.fragmentation() == 0.0f);
+
+  allocator->Free(offsets[0], kSize);
+  stats = allocator->stats();
+  CHECK(stats.free_range_count == 1);
+  CHECK(stats.largest_free_range == kCapacity);
+  CHECK(allocator->Alloc(kCapacity) == 0);
+}
+
+void TestAlignment(BufferAllocatorType type) {
+  auto allocator = CreateBufferAllocator(type, kCapacity);
+  // Powers of two and vertex strides.
+  for (int32_t alignment : {1, 4, 16, 256, 12, 20, 24}) {
+    CHECK(allocator->Alloc(3) != BufferAllocator::kInvalidOffset);
+    int32_t offset = allocator->Alloc(alignment * 5, alignment);
+    CHECK(offset != BufferAllocator::kInvalidOffset);
+    CHECK(offset % alignment == 0);
+  }
+}
+
+// Random allocations and frees, every allocation is checked to be aligned
+// and not to overlap a live one, and freeing everything gives back one range.
+void TestRandom(BufferAllocatorType type) {
+  struct Allocation {
+    int32_t offset;
+    int32_t size;
+  };
+  auto allocator = CreateBufferAllocator(type, kCapacity);
+  std::vector<bool> used(kCapacity, false);
+  std::vector<Allocation> live;
+  std::mt19937 rng(1000);
+  const int32_t alignments[] = {1, 2, 4, 8, 12, 16, 24};
+  for (int step = 0; step < 20000; ++step) {
+    if (!live.empty() && rng() % 2) {
+      size_t index = rng() % live.size();
+      Allocation allocation = live[index];
+      live[index] = live.back();
+      live.pop_back();
+      allocator->Free(allocation.offset, allocation.size);
+      for (int32_t i = 0; i < allocation.size; ++i) {
+        used[allocation.offset + i] = false;
+      }
+      continue;
+    }
+    int32_t alignment = alignments[rng() % 7];
+    int32_t size = 1 + rng() % 1024;
+    int32_t offset = allocator->Alloc(size, alignment);
+    if (offset == BufferAllocator::kInvalidOffset) {
+      continue;
+    }
+    CHECK(offset % alignment == 0);
+    CHECK(offset >= 0 && offset + size <= kCapacity);
+    bool overlap = false;
+    for (int32_t i = 0; i < size; ++i) {
+      overlap |= used[offset + i];
+      used[offset + i] = true;
+    }
+    CHECK(!overlap);
+    live.push_back({offset, size});
+  }
+  for (const Allocation& allocation : live) {
+    allocator->Free(allocation.offset, allocation.size);
+  }
+  BufferAllocatorStats stats = allocator->stats();
+  CHECK(stats.used_size == 0);
+  CHECK(stats.free_range_count == 1);
+  CHECK(stats.largest_free_range == kCapacity);
+}
+
+}  // namespace
+
+int main() {
+  for (BufferAllocatorType type :
+       {kFirstFitAllocator, kSegregatedFitAllocator}) {
+    int failures_before = failure_count;
+    TestAllocateAndFree(type);
+    TestCoalescing(type);
+    TestAlignment(type);
+    TestRandom(type);
+    printf("%s: %s\n", AllocatorName(type),
+           failure_count == failures_before ? "ok" : "FAILED");
+  }
+  return failure_count ? 1 : 0;
+}
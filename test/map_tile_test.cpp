@@ -0,0 +1,114 @@
+// CPU tests of MapTile::Validate: a well formed tile opens, tiles with a
+// child cycle or a leaf node without a mesh record are rejected. Prints the
+// failed checks and exits with 1 if there are any.
+//
+//   make map_tile_test && ./map_tile_test
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "core/map_tile.h"
+
+namespace {
+
+int failure_count = 0;
+
+#define CHECK(condition)                                               \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      printf("%s:%d: %s failed\n", __FILE__, __LINE__, #condition);    \
+      ++failure_count;                                                 \
+    }                                                                  \
+  } while (0)
+
+constexpr char kTilePath[] = "map_tile_test.nvmt";
+
+// A group node 0 with two leaf children 1 and 2, like json_to_map_tile.py
+// writes a RoadElementObject of two meshes.
+std::vector<MapTileNode> ValidNodes() {
+  return {
+      {0, kMapTileInvalidIndex, 1, 2},
+      {1, 0, 0, 0},
+      {1, 1, 0, 0},
+  };
+}
+
+// Writes a tile of one root, |nodes| and two mesh records without blobs,
+// then opens it.
+bool OpenTile(const std::vector<MapTileNode>& nodes) {
+  const char strings[2][kMapTileStringSize] = {"RoadElementObject",
+                                               "LineObject"};
+  MapTileMeshRecord records[2] = {};
+  for (MapTileMeshRecord& record : records) {
+    record.position_offset = kMapTileNoBlob;
+    record.color_offset = kMapTileNoBlob;
+    record.uv_offset = kMapTileNoBlob;
+    record.index_offset = kMapTileNoBlob;
+  }
+
+  MapTileHeader header = {};
+  memcpy(header.magic, kMapTileMagic, sizeof(kMapTileMagic));
+  header.version = kMapTileVersion;
+  header.string_count = 2;
+  header.node_count = nodes.size();
+  header.root_count = 1;
+  header.record_count = 2;
+  header.string_table_offset = sizeof(header);
+  header.node_table_offset = header.string_table_offset + sizeof(strings);
+  header.record_table_offset =
+      header.node_table_offset + nodes.size() * sizeof(MapTileNode);
+  header.blob_offset = header.record_table_offset + sizeof(records);
+  header.blob_size = 0;
+
+  FILE* file = fopen(kTilePath, "wb");
+  if (!file) {
+    printf("open file error: %s\n", kTilePath);
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(strings, sizeof(strings), 1, file);
+  fwrite(nodes.data(), sizeof(MapTileNode), nodes.size(), file);
+  fwrite(records, sizeof(records), 1, file);
+  fclose(file);
+
+  MapTile tile;
+  bool opened = tile.Open(kTilePath);
+  tile.Close();
+  remove(kTilePath);
+  return opened;
+}
+
+void TestValid() { CHECK(OpenTile(ValidNodes())); }
+
+void TestChildCycle() {
+  // The second leaf turned into a group whose child is the root.
+  std::vector<MapTileNode> nodes = ValidNodes();
+  nodes[2] = {0, kMapTileInvalidIndex, 0, 1};
+  CHECK(!OpenTile(nodes));
+  // A group that is its own child.
+  nodes = ValidNodes();
+  nodes[0].first_child = 0;
+  nodes[0].child_count = 1;
+  CHECK(!OpenTile(nodes));
+}
+
+void TestLeafWithoutRecord() {
+  std::vector<MapTileNode> nodes = ValidNodes();
+  nodes[1].record = kMapTileInvalidIndex;
+  CHECK(!OpenTile(nodes));
+  // Out of range records are rejected as well.
+  nodes = ValidNodes();
+  nodes[2].record = 2;
+  CHECK(!OpenTile(nodes));
+}
+
+}  // namespace
+
+int main() {
+  TestValid();
+  TestChildCycle();
+  TestLeafWithoutRecord();
+  printf("map tile: %s\n", failure_count ? "FAILED" : "ok");
+  return failure_count ? 1 : 0;
+}